@@ -0,0 +1,68 @@
+#ifndef LIBURING_H
+#define LIBURING_H
+
+/*
+ * declaration-only stand-in for the parts of liburing that lfl_uring.h and
+ * its tests use, so both can be compiled where liburing is not installed
+ * (make check-uring-stub). prototypes and field types follow liburing 2.4;
+ * nothing here can be linked or run.
+ */
+
+#include <stdint.h>
+
+#define IOSQE_BUFFER_SELECT             (1U << 5)
+#define IORING_CQE_F_BUFFER             (1U << 0)
+#define IORING_CQE_BUFFER_SHIFT         16
+
+struct io_uring_sqe {
+        uint8_t opcode;
+        uint8_t flags;
+        uint16_t ioprio;
+        int32_t fd;
+        uint64_t off;
+        uint64_t addr;
+        uint32_t len;
+        uint32_t rw_flags;
+        uint64_t user_data;
+        uint16_t buf_group;
+};
+
+struct io_uring_cqe {
+        uint64_t user_data;
+        int32_t res;
+        uint32_t flags;
+};
+
+struct io_uring_buf {
+        uint64_t addr;
+        uint32_t len;
+        uint16_t bid;
+        uint16_t resv;
+};
+
+struct io_uring_buf_ring {
+        struct io_uring_buf bufs[1];
+};
+
+struct io_uring {
+        unsigned flags;
+        int ring_fd;
+};
+
+int io_uring_queue_init(unsigned entries, struct io_uring *ring, unsigned flags);
+void io_uring_queue_exit(struct io_uring *ring);
+struct io_uring_sqe *io_uring_get_sqe(struct io_uring *ring);
+int io_uring_submit(struct io_uring *ring);
+int io_uring_wait_cqe(struct io_uring *ring, struct io_uring_cqe **cqe_ptr);
+void io_uring_cqe_seen(struct io_uring *ring, struct io_uring_cqe *cqe);
+void io_uring_prep_read(struct io_uring_sqe *sqe, int fd, void *buf, unsigned nbytes, uint64_t offset);
+
+struct io_uring_buf_ring *io_uring_setup_buf_ring(struct io_uring *ring, unsigned int nentries, int bgid,
+                                                  unsigned int flags, int *ret);
+int io_uring_free_buf_ring(struct io_uring *ring, struct io_uring_buf_ring *br, unsigned int nentries, int bgid);
+int io_uring_buf_ring_mask(uint32_t ring_entries);
+void io_uring_buf_ring_add(struct io_uring_buf_ring *br, void *addr, unsigned int len, unsigned short bid,
+                           int mask, int buf_offset);
+void io_uring_buf_ring_advance(struct io_uring_buf_ring *br, int count);
+
+#endif /* LIBURING_H */
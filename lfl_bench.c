@@ -0,0 +1,396 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "lock_free_list.h"
+#include "lfl_percpu.h"
+#include "lfl_rcu.h"
+
+lfl_def(bench)
+        long id;
+        long payload;
+lfl_end
+lfl_state(bench);
+
+typedef lfl_type(bench) bench_t;
+
+static double now_sec(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* open a dTLB read-miss counter for this thread; -1 when unavailable */
+static int dtlb_open(void)
+{
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+struct worker_sum {
+        _Alignas(64) long sum;
+};
+
+static void sum_fn(bench_t *item, void *ctx, int worker)
+{
+        ((struct worker_sum *)ctx)[worker].sum += item->id;
+}
+
+/* build a list of n nodes, walk it, and report time and dTLB misses */
+static void run(const char *label, long n)
+{
+        lfl_vars(bench, list);
+        lfl_init(bench, list);
+        long sum = 0;
+        uint64_t misses = 0;
+        int fd;
+
+        for (long i = 0; i < n; i++) {
+                lfl_add_tail(bench, list, node);
+                node->id = i;
+        }
+
+        fd = dtlb_open();
+        if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+        double t0 = now_sec();
+        lfl_foreach(bench, list, item) {
+                sum += item->id;
+        }
+        double t1 = now_sec();
+        if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+                if (read(fd, &misses, sizeof(misses)) != sizeof(misses))
+                        misses = 0;
+                close(fd);
+        }
+
+        printf("%-8s nodes=%ld walk=%.3fs (%.2f ns/node)", label, n, t1 - t0, (t1 - t0) * 1e9 / n);
+        if (fd >= 0)
+                printf(" dTLB-load-misses=%llu (%.3f/node)", (unsigned long long)misses, (double)misses / n);
+        else
+                printf(" dTLB-load-misses=n/a");
+        printf(" checksum=%ld\n", sum);
+
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        struct worker_sum *sums = aligned_alloc(64, (cpus > 0 ? cpus : 1) * sizeof(*sums));
+        memset(sums, 0, (cpus > 0 ? cpus : 1) * sizeof(*sums));
+        t0 = now_sec();
+        int workers = lfl_parallel_foreach(bench, list, (int)cpus, sum_fn, sums);
+        t1 = now_sec();
+        sum = 0;
+        for (int w = 0; w < workers; w++)
+                sum += sums[w].sum;
+        printf("%-8s parallel walk=%.3fs with %d workers checksum=%ld\n", label, t1 - t0, workers, sum);
+        free(sums);
+
+        lfl_clear(bench, list);
+}
+
+/* one sequential walk, in ns per node */
+static double walk_list(_Atomic(bench_t *) *head, long n, long *sum)
+{
+        double t0 = now_sec();
+
+        *sum = 0;
+        for (bench_t *item = atomic_load(head); item; item = lfl_get_next(item))
+                *sum += item->id;
+        return (now_sec() - t0) * 1e9 / n;
+}
+
+/* scatter a list across an arena by building it in shuffled slot order, then compact it */
+static int run_compact(long n)
+{
+        struct lfl_arena arena;
+        struct lfl_rcu dom;
+        bench_t **slots = malloc(n * sizeof(*slots));
+        long sum, moved;
+        lfl_vars(bench, list);
+
+        if (!slots || lfl_arena_init(&arena, sizeof(bench_t), 2 * n + 1, LFL_ARENA_2M) != 0 ||
+            lfl_rcu_init(&dom) != 0) {
+                fprintf(stderr, "arena reservation failed\n");
+                return 1;
+        }
+        lfl_arena_bind(bench, &arena);
+        lfl_init(bench, list);
+        for (long i = 0; i < n; i++)
+                slots[i] = lfl_new(bench);
+        for (long i = n - 1; i > 0; i--) {
+                long j = rand() % (i + 1);
+                bench_t *t = slots[i];
+                slots[i] = slots[j];
+                slots[j] = t;
+        }
+        for (long i = 0; i < n; i++) {
+                slots[i]->id = i;
+                lfl_add_tail_ptr(bench, list, slots[i]);
+        }
+        printf("scattered nodes=%ld walk=%.2f ns/node", n, walk_list(&list_head, n, &sum));
+        printf(" checksum=%ld\n", sum);
+        double t0 = now_sec();
+        lfl_compact(bench, list, refcount, dom, NULL, moved);
+        double t1 = now_sec();
+        printf("compact   moved=%ld in %.3fs\n", moved, t1 - t0);
+        printf("compacted nodes=%ld walk=%.2f ns/node", n, walk_list(&list_head, n, &sum));
+        printf(" checksum=%ld\n", sum);
+
+        lfl_clear(bench, list);
+        lfl_arena_bind(bench, NULL);
+        lfl_arena_destroy(&arena);
+        lfl_rcu_destroy(&dom);
+        free(slots);
+        return 0;
+}
+
+/* a few dependent multiplies per node, standing in for real per-item work */
+static long mix(long v)
+{
+        for (int i = 0; i < 8; i++)
+                v = v * 6364136223846793005L + 1442695040888963407L;
+        return v;
+}
+
+static void mix_fn(bench_t *item, void *ctx, int worker)
+{
+        ((struct worker_sum *)ctx)[worker].sum += mix(item->id);
+}
+
+/* serial walk vs plain and indexed parallel scans over a scattered list */
+static int run_parallel(long n, int nthreads)
+{
+        bench_t **slots = malloc(n * sizeof(*slots));
+        struct worker_sum *sums = aligned_alloc(64, nthreads * sizeof(*sums));
+        struct lfl_par_index ix;
+        long sum = 0, count = 0;
+        int workers = 0;
+        double t0, t1;
+        lfl_vars(bench, list);
+
+        if (!slots || !sums) {
+                fprintf(stderr, "out of memory\n");
+                return 1;
+        }
+        lfl_init(bench, list);
+        for (long i = 0; i < n; i++)
+                slots[i] = lfl_new(bench);
+        for (long i = n - 1; i > 0; i--) {
+                long j = rand() % (i + 1);
+                bench_t *t = slots[i];
+                slots[i] = slots[j];
+                slots[j] = t;
+        }
+        for (long i = 0; i < n; i++) {
+                slots[i]->id = i;
+                lfl_add_tail_ptr(bench, list, slots[i]);
+        }
+        printf("parallel nodes=%ld threads=%d ways=%d online-cpus=%ld\n",
+               n, nthreads, LFL_PAR_WAYS, sysconf(_SC_NPROCESSORS_ONLN));
+
+        t0 = now_sec();
+        lfl_foreach(bench, list, item) {
+                sum += mix(item->id);
+        }
+        t1 = now_sec();
+        printf("serial   foreach %.2f ns/node checksum=%ld\n", (t1 - t0) * 1e9 / n, sum);
+
+        memset(sums, 0, nthreads * sizeof(*sums));
+        t0 = now_sec();
+        workers = lfl_parallel_foreach(bench, list, nthreads, mix_fn, sums);
+        t1 = now_sec();
+        sum = 0;
+        for (int w = 0; w < workers; w++)
+                sum += sums[w].sum;
+        printf("parallel foreach %.2f ns/node checksum=%ld\n", (t1 - t0) * 1e9 / n, sum);
+
+        /* the first indexed scan walks and samples; time the ones after it */
+        lfl_par_index_init(bench, ix, refcount);
+        lfl_parallel_count_ix(bench, list, &ix, nthreads, count);
+        memset(sums, 0, nthreads * sizeof(*sums));
+        t0 = now_sec();
+        workers = lfl_parallel_foreach_ix(bench, list, &ix, nthreads, mix_fn, sums);
+        t1 = now_sec();
+        sum = 0;
+        for (int w = 0; w < workers; w++)
+                sum += sums[w].sum;
+        printf("indexed  foreach %.2f ns/node checksum=%ld splits=%zu\n", (t1 - t0) * 1e9 / n, sum, ix.n);
+
+        t0 = now_sec();
+        lfl_count(bench, list, count);
+        t1 = now_sec();
+        printf("serial   count   %.2f ns/node count=%ld\n", (t1 - t0) * 1e9 / n, count);
+        t0 = now_sec();
+        lfl_parallel_count_ix(bench, list, &ix, nthreads, count);
+        t1 = now_sec();
+        printf("indexed  count   %.2f ns/node count=%ld\n", (t1 - t0) * 1e9 / n, count);
+
+        lfl_par_index_destroy(&ix);
+        lfl_clear(bench, list);
+        free(sums);
+        free(slots);
+        return 0;
+}
+
+lfl_vars_static(bench, qlist);
+static struct lfl_faaq qfaa;
+lfl_kfifo_vars_static(bench, qkfifo, 64);
+static struct lfl_percpu qpercpu;
+
+enum { QUEUE_LIST, QUEUE_FAAQ, QUEUE_KFIFO, QUEUE_PERCPU, QUEUE_KINDS };
+
+static const char *queue_names[QUEUE_KINDS] = { "cas-list", "faaq", "kfifo", "percpu" };
+
+struct queue_arg {
+        int kind;
+        bench_t *nodes;
+        long ops;
+        pthread_barrier_t *start;
+};
+
+/* enqueue / dequeue pairs; nodes are never reused while others may touch them */
+static void *queue_worker(void *arg)
+{
+        struct queue_arg *qa = arg;
+        bench_t *out = NULL;
+
+        pthread_barrier_wait(qa->start);
+        for (long i = 0; i < qa->ops; i++) {
+                bench_t *node = &qa->nodes[i];
+                switch (qa->kind) {
+                case QUEUE_FAAQ:
+                        lfl_faaq_add_tail(bench, qfaa, node);
+                        lfl_faaq_pop_head(bench, qfaa, out);
+                        break;
+                case QUEUE_PERCPU:
+                        /* pooled nodes: the caller's array is not used */
+                        node = lfl_percpu_new(bench, qpercpu);
+                        lfl_percpu_add_head_ptr(bench, qpercpu, node);
+                        lfl_percpu_pop_head(bench, qpercpu, out);
+                        if (out)
+                                lfl_percpu_free(bench, qpercpu, out);
+                        break;
+                case QUEUE_KFIFO:
+                        lfl_kfifo_add_tail_ptr(bench, qkfifo, node);
+                        lfl_kfifo_pop_head(bench, qkfifo, out);
+                        break;
+                default:
+                        lfl_add_tail_ptr(bench, qlist, node);
+                        lfl_pop_head(bench, qlist, out);
+                        break;
+                }
+        }
+        return out;
+}
+
+/* pairs/s for the cas list, the fetch-and-add queue and the k-fifo at 1, 2, 4 .. max threads */
+static void run_queue(int max_threads, long ops)
+{
+        bench_t *nodes = calloc((size_t)max_threads * ops, sizeof(bench_t));
+        pthread_t *threads = calloc(max_threads, sizeof(pthread_t));
+        struct queue_arg *args = calloc(max_threads, sizeof(struct queue_arg));
+
+        for (int t = 1;; t = t * 2 < max_threads ? t * 2 : max_threads) {
+                for (int kind = 0; kind < QUEUE_KINDS; kind++) {
+                        pthread_barrier_t start;
+                        memset(nodes, 0, (size_t)max_threads * ops * sizeof(bench_t));
+                        lfl_init(bench, qlist);
+                        lfl_kfifo_init(bench, qkfifo);
+                        if (kind == QUEUE_PERCPU && lfl_percpu_init(&qpercpu) != 0) {
+                                fprintf(stderr, "percpu init failed\n");
+                                return;
+                        }
+                        if (kind == QUEUE_FAAQ && lfl_faaq_init(&qfaa, (size_t)t * ops / LFL_FAAQ_SEG + 16) != 0) {
+                                fprintf(stderr, "faaq init failed\n");
+                                return;
+                        }
+                        pthread_barrier_init(&start, NULL, t + 1);
+                        for (int i = 0; i < t; i++) {
+                                args[i] = (struct queue_arg){ kind, nodes + (size_t)i * ops, ops, &start };
+                                pthread_create(&threads[i], NULL, queue_worker, &args[i]);
+                        }
+                        double t0 = now_sec();
+                        pthread_barrier_wait(&start);
+                        for (int i = 0; i < t; i++)
+                                pthread_join(threads[i], NULL);
+                        double t1 = now_sec();
+                        printf("%-8s threads=%-3d %.2f Mpairs/s\n", queue_names[kind], t,
+                               t * ops / (t1 - t0) / 1e6);
+                        pthread_barrier_destroy(&start);
+                        if (kind == QUEUE_FAAQ)
+                                lfl_faaq_destroy(&qfaa);
+                        if (kind == QUEUE_PERCPU) {
+                                bench_t *left;
+                                for (;;) {
+                                        lfl_percpu_pop_head(bench, qpercpu, left);
+                                        if (!left)
+                                                break;
+                                        lfl_node_free(bench, left);
+                                }
+                                lfl_percpu_destroy(bench, qpercpu);
+                        }
+                }
+                if (t == max_threads)
+                        break;
+        }
+        free(args);
+        free(threads);
+        free(nodes);
+}
+
+int main(int argc, char **argv)
+{
+        if (argc > 1 && strcmp(argv[1], "queue") == 0) {
+                long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                run_queue(argc > 2 ? atoi(argv[2]) : (int)(cpus > 0 ? cpus : 1),
+                          argc > 3 ? atol(argv[3]) : 1000000);
+                return 0;
+        }
+
+        if (argc > 1 && strcmp(argv[1], "compact") == 0)
+                return run_compact(argc > 2 ? atol(argv[2]) : 1000 * 1000);
+
+        if (argc > 1 && strcmp(argv[1], "parallel") == 0) {
+                long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                return run_parallel(argc > 2 ? atol(argv[2]) : 4 * 1000 * 1000,
+                                    argc > 3 ? atoi(argv[3]) : (int)(cpus > 0 ? cpus : 1));
+        }
+
+        long n = argc > 1 ? atol(argv[1]) : 10 * 1000 * 1000;
+        size_t page = argc > 2 && strcmp(argv[2], "1g") == 0 ? LFL_ARENA_1G : LFL_ARENA_2M;
+        struct lfl_arena arena;
+
+        run("calloc", n);
+
+        if (lfl_arena_init(&arena, sizeof(bench_t), n, page) != 0) {
+                fprintf(stderr, "arena reservation failed\n");
+                return 1;
+        }
+        lfl_arena_bind(bench, &arena);
+        run("arena", n);
+        printf("arena chunks: %zu MAP_HUGETLB, %zu THP fallback\n",
+               atomic_load(&arena.huge_chunks), atomic_load(&arena.thp_chunks));
+        lfl_arena_bind(bench, NULL);
+        lfl_arena_destroy(&arena);
+        return 0;
+}
@@ -0,0 +1,98 @@
+#ifndef LFL_BLOCKING_H
+#define LFL_BLOCKING_H
+
+#include "lock_free_list.h"
+
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 Michael Miller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @brief operations on lfl lists that may wait for another thread
+ *
+ *        nothing in lock_free_list.h blocks. the operations here trade that
+ *        guarantee for something else, such as bounded unfairness between
+ *        consumers, and a thread descheduled inside one of them can hold
+ *        up the others. include this header only where that is acceptable.
+ */
+
+/* head CASes a consumer may lose before it queues for a ticket */
+#define LFL_FAIR_PATIENCE 4
+
+/**
+ * @brief declare the ticket counters of a list's fairness front end
+ *
+ *        consumers using lfl_pop_head_fair_blocking first try a few plain
+ *        CAS pops. one that keeps losing takes a ticket and is served in
+ *        ticket order, and while anyone holds a ticket new consumers queue
+ *        behind it instead of racing. so no consumer loses more than
+ *        LFL_FAIR_PATIENCE CASes plus the fast-path attempts already in
+ *        flight when it reached the front. the ticket queue is a lock: a
+ *        ticket holder that is descheduled delays those behind it.
+ *
+ * @param inst list instance name
+ */
+#define lfl_fair_vars(inst) \
+        _Atomic(unsigned long) inst##_ticket; \
+        _Atomic(unsigned long) inst##_serving
+
+#define lfl_fair_vars_static(inst) \
+        static _Atomic(unsigned long) inst##_ticket = 0; \
+        static _Atomic(unsigned long) inst##_serving = 0
+
+#define lfl_fair_init(inst) \
+        do { \
+                atomic_store(&(inst##_ticket), 0); \
+                atomic_store(&(inst##_serving), 0); \
+        } while (0)
+
+/**
+ * @brief pop the head with bounded CAS failures per consumer (blocking)
+ *
+ *        lock-free until a consumer runs out of patience; from then on
+ *        consumers wait for their ticket to come up.
+ *
+ * @param name list type name
+ * @param inst list instance name (declared with lfl_vars and lfl_fair_vars)
+ * @param item variable receiving the popped node, or NULL if empty; as with
+ *             lfl_pop_head_n its next pointer is left as it was
+ */
+#define lfl_pop_head_fair_blocking(name, inst, item) \
+        do { \
+                size_t _fair_n __attribute__((unused)) = 0; \
+                item = NULL; \
+                if (atomic_load_explicit(&(inst##_serving), memory_order_acquire) == \
+                    atomic_load_explicit(&(inst##_ticket), memory_order_acquire)) { \
+                        lfl__pop_head_n(name, inst, item, 1, _fair_n, LFL_FAIR_PATIENCE); \
+                        if (item || !atomic_load_explicit(&(inst##_head), memory_order_acquire)) \
+                                break; \
+                } \
+                unsigned long _fair_t = atomic_fetch_add_explicit(&(inst##_ticket), 1, memory_order_acq_rel); \
+                unsigned int _fair_spins = 0; \
+                while (atomic_load_explicit(&(inst##_serving), memory_order_acquire) != _fair_t) \
+                        lfl__spin_wait(&_fair_spins); \
+                lfl_pop_head_n(name, inst, item, 1, _fair_n); \
+                atomic_store_explicit(&(inst##_serving), _fair_t + 1, memory_order_release); \
+        } while (0)
+
+#endif /* LFL_BLOCKING_H */
@@ -2,12 +2,21 @@
 #include <stdlib.h>
 #include <stdatomic.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <signal.h>
 
 #include "lock_free_list.h"
+#include "lfl_blocking.h"
+#include "lfl_percpu.h"
+#include "lfl_rcu.h"
+#include "lfl_shm.h"
 
 lfl_def(test)
         int id;
 lfl_end
+lfl_state(test);
 
 typedef lfl_type(test) test_t;
 
@@ -1030,3 +1039,2992 @@ Test(lfl_iteration, foreach_from_starts_at_given_node)
 
         lfl_clear(test, q);
 }
+
+Test(lfl_arena, bound_type_allocates_from_arena)
+{
+        struct lfl_arena arena;
+
+        cr_assert_eq(lfl_arena_init(&arena, sizeof(test_t), 1024, LFL_ARENA_2M), 0, "arena reservation failed");
+        lfl_arena_bind(test, &arena);
+
+        lfl_vars(test, q);
+        lfl_init(test, q);
+
+        lfl_add_tail(test, q, n1);
+        n1->id = 1;
+        lfl_add_tail(test, q, n2);
+        n2->id = 2;
+
+        cr_expect(lfl_arena_owns(&arena, n1), "node was not carved from the arena");
+        cr_expect_eq((char *)n2 - (char *)n1, (long)arena.slot, "nodes are not carved sequentially");
+
+        /* a deleted node's slot is handed out again before fresh ones */
+        lfl_delete(test, q, n1);
+        lfl_add_tail(test, q, n3);
+        cr_expect_eq((void *)n3, (void *)arena.base, "freed slot was not recycled");
+        cr_expect_eq(n3->id, 0, "recycled slot was not zeroed");
+
+        int count = 0;
+        lfl_count(test, q, count);
+        cr_expect_eq(count, 2, "expected 2 nodes, got %d", count);
+
+        lfl_clear(test, q);
+        lfl_arena_bind(test, NULL);
+        lfl_arena_destroy(&arena);
+}
+
+Test(lfl_arena, slot_straddling_a_chunk_boundary_is_mapped)
+{
+        struct lfl_arena arena;
+
+        /* 48-byte slots do not divide 2 MiB, so slot per_chunk starts in chunk 0 */
+        cr_assert_eq(lfl_arena_init(&arena, 48, 100000, LFL_ARENA_2M), 0, "arena reservation failed");
+        cr_assert_neq(arena.chunk % arena.slot, 0);
+        atomic_store(&arena.bump, arena.per_chunk);
+        char *p = lfl_arena_alloc(&arena);
+        cr_assert_not_null(p);
+        cr_expect_lt((size_t)(p - arena.base), arena.chunk);
+        memset(p, 0xa5, arena.slot);
+        lfl_arena_destroy(&arena);
+}
+
+Test(lfl_arena, oversized_run_leaves_fresh_slots_usable)
+{
+        struct lfl_arena arena;
+
+        cr_assert_eq(lfl_arena_init(&arena, sizeof(test_t), 64, 0), 0, "arena reservation failed");
+        char *first = lfl_arena_alloc_run(&arena, 8);
+        cr_assert_not_null(first);
+        cr_expect_null(lfl_arena_alloc_run(&arena, arena.capacity), "run larger than the arena was granted");
+        cr_expect_null(lfl_arena_alloc_run(&arena, (size_t)-1), "run size overflow was granted");
+
+        /* the failed requests reserved nothing: the rest of the arena is still there */
+        char *rest = lfl_arena_alloc_run(&arena, arena.capacity - 8);
+        cr_assert_not_null(rest, "failed run consumed fresh slots");
+        cr_expect_eq(rest, first + 8 * arena.slot);
+        cr_expect_null(lfl_arena_alloc(&arena));
+        lfl_arena_destroy(&arena);
+}
+
+lfl_shm_def(msg)
+        int seq;
+        long value;
+lfl_end
+
+Test(lfl_shm, cross_process_fifo)
+{
+        struct lfl_shm seg;
+        const int total = 10000;
+
+        cr_assert_eq(lfl_shm_create(msg, seg, NULL, 64), 0, "segment creation failed");
+
+        pid_t child = fork();
+        cr_assert_neq(child, -1, "fork failed");
+        if (child == 0) {
+                /* producer: keep at most 64 nodes in flight */
+                for (int i = 0; i < total; i++) {
+                        lfl_shm_type(msg) *m;
+                        while (!(m = lfl_shm_new(msg, seg)))
+                                usleep(10);
+                        m->seq = i;
+                        m->value = (long)i * 3;
+                        lfl_shm_add_tail_ptr(msg, seg, m);
+                }
+                _exit(0);
+        }
+
+        int expect = 0;
+        while (expect < total) {
+                lfl_shm_type(msg) m;
+                if (!lfl_shm_pop_head(msg, seg, &m))
+                        continue;
+                cr_assert_eq(m.seq, expect, "out of order: expected %d, got %d", expect, m.seq);
+                cr_assert_eq(m.value, (long)expect * 3, "payload mismatch at %d", expect);
+                expect++;
+        }
+
+        int status = 0;
+        waitpid(child, &status, 0);
+        cr_expect(WIFEXITED(status) && WEXITSTATUS(status) == 0, "producer failed");
+
+        lfl_shm_type(msg) m;
+        cr_expect_eq(lfl_shm_pop_head(msg, seg, &m), 0, "queue should be empty");
+        lfl_shm_close(msg, seg);
+}
+
+Test(lfl_shm, reap_slots_of_dead_process)
+{
+        struct lfl_shm seg;
+
+        cr_assert_eq(lfl_shm_create(msg, seg, NULL, 8), 0, "segment creation failed");
+
+        /* the child grabs two slots and dies without publishing them */
+        pid_t child = fork();
+        cr_assert_neq(child, -1, "fork failed");
+        if (child == 0) {
+                lfl_shm_new(msg, seg);
+                lfl_shm_new(msg, seg);
+                _exit(0);
+        }
+        waitpid(child, NULL, 0);
+
+        cr_expect_eq(lfl_shm_reap(msg, seg), 2, "expected 2 stranded slots to be reaped");
+        cr_expect_eq(lfl_shm_reap(msg, seg), 0, "slots were reaped twice");
+
+        /* the reaped slots are usable again */
+        for (int i = 0; i < 8; i++) {
+                lfl_shm_type(msg) *m = lfl_shm_new(msg, seg);
+                cr_assert_not_null(m, "slot %d unavailable after reap", i);
+                lfl_shm_add_tail_ptr(msg, seg, m);
+        }
+        lfl_shm_close(msg, seg);
+}
+
+Test(lfl_shm, reap_tells_a_reused_pid_from_its_first_owner)
+{
+        struct lfl_shm seg;
+        struct lfl_shm_proc *gone, *live;
+        int32_t pid = (int32_t)getpid();
+
+        cr_assert_eq(lfl_shm_create(msg, seg, NULL, 8), 0, "segment creation failed");
+        lfl_shm_type(msg) *a = lfl_shm_new(msg, seg);
+        lfl_shm_type(msg) *b = lfl_shm_new(msg, seg);
+        cr_assert(a && b);
+
+        /* two entries carrying a pid that is alive; only one matches its start time */
+        gone = &seg.hdr->proc[LFL_SHM_PROCS - 1];
+        live = &seg.hdr->proc[LFL_SHM_PROCS - 2];
+        atomic_store(&gone->pid, pid);
+        atomic_store(&gone->ns, lfl__shm_pidns());
+        atomic_store(&gone->start, lfl__shm_start_time(pid) + 1);
+        atomic_store(&live->pid, pid);
+        atomic_store(&live->ns, lfl__shm_pidns());
+        atomic_store(&live->start, lfl__shm_start_time(pid));
+        atomic_store(&a->lfl_link.owner, lfl__shm_pack(7, LFL_SHM_PROCS));
+        atomic_store(&b->lfl_link.owner, lfl__shm_pack(7, LFL_SHM_PROCS - 1));
+
+        cr_expect_eq(lfl_shm_reap(msg, seg), 1, "only the slot of the earlier process should be reaped");
+        cr_expect_eq(atomic_load(&gone->pid), 0, "the entry of the earlier process was not freed");
+        cr_expect_eq(atomic_load(&live->pid), pid, "the entry of a live process was freed");
+        lfl_shm_close(msg, seg);
+}
+
+Test(lfl_shm, reap_recovers_slots_dropped_mid_operation)
+{
+        struct lfl_shm seg;
+        lfl_shm_type(msg) out;
+        int n = 0;
+
+        cr_assert_eq(lfl_shm_create(msg, seg, NULL, 4), 0, "segment creation failed");
+        for (int i = 0; i < 3; i++) {
+                lfl_shm_type(msg) *m = lfl_shm_new(msg, seg);
+                m->seq = i;
+                lfl_shm_add_tail_ptr(msg, seg, m);
+        }
+
+        /* the child dequeues one node and dies before recycling the old dummy */
+        pid_t child = fork();
+        cr_assert_neq(child, -1, "fork failed");
+        if (child == 0) {
+                struct lfl_shm_hdr *h = seg.hdr;
+                uint64_t head = atomic_load(&h->head);
+                uint64_t next = atomic_load(&lfl__shm_node(&seg, lfl__shm_idx(head))->next);
+                atomic_store(&h->head, lfl__shm_pack(lfl__shm_tag(head) + 1, lfl__shm_idx(next)));
+                _exit(0);
+        }
+        waitpid(child, NULL, 0);
+
+        /* another child links a node and dies before handing it to the queue */
+        child = fork();
+        cr_assert_neq(child, -1, "fork failed");
+        if (child == 0) {
+                lfl_shm_type(msg) *m = lfl_shm_new(msg, seg);
+                uint64_t own = atomic_load(&m->lfl_link.owner);
+                m->seq = 3;
+                lfl_shm_add_tail_ptr(msg, seg, m);
+                atomic_store(&m->lfl_link.owner, own);
+                _exit(0);
+        }
+        waitpid(child, NULL, 0);
+
+        cr_expect_eq(lfl_shm_reap(msg, seg), 1, "the dropped dummy should be reaped");
+        cr_expect_eq(lfl_shm_reap(msg, seg), 0, "slots were reaped twice");
+
+        /* the queued node survived the reap and nothing leaked */
+        for (int want = 1; want <= 3; want++) {
+                cr_assert_eq(lfl_shm_pop_head(msg, seg, &out), 1);
+                cr_expect_eq(out.seq, want);
+        }
+        cr_expect_eq(lfl_shm_pop_head(msg, seg, &out), 0);
+        while (lfl_shm_new(msg, seg))
+                n++;
+        cr_expect_eq(n, 4, "%d of 4 slots free after recovery", n);
+        lfl_shm_close(msg, seg);
+}
+
+Test(lfl_shm, snapshot_and_restore)
+{
+        struct lfl_shm seg, restored;
+        char path[] = "/tmp/lfl_snapshot_XXXXXX";
+        int fd = mkstemp(path);
+
+        cr_assert_geq(fd, 0, "mkstemp failed");
+        close(fd);
+        cr_assert_eq(lfl_shm_create(msg, seg, NULL, 128), 0, "segment creation failed");
+
+        for (int i = 0; i < 100; i++) {
+                lfl_shm_type(msg) *m = lfl_shm_new(msg, seg);
+                m->seq = i;
+                lfl_shm_add_tail_ptr(msg, seg, m);
+        }
+        for (int i = 0; i < 10; i++) {
+                lfl_shm_type(msg) m;
+                lfl_shm_pop_head(msg, seg, &m);
+        }
+        /* an unpublished node must not leak into the image */
+        lfl_shm_new(msg, seg);
+
+        cr_assert_eq(lfl_shm_snapshot(msg, seg, path), 0, "snapshot failed");
+        lfl_shm_close(msg, seg);
+
+        cr_assert_eq(lfl_shm_restore(msg, restored, path, MAP_PRIVATE), 0, "restore failed");
+        for (int i = 10; i < 100; i++) {
+                lfl_shm_type(msg) m;
+                cr_assert_eq(lfl_shm_pop_head(msg, restored, &m), 1, "restored queue ran dry at %d", i);
+                cr_assert_eq(m.seq, i, "expected %d, got %d", i, m.seq);
+        }
+
+        /* every slot is free again once the restored queue is drained */
+        int slots = 0;
+        while (lfl_shm_new(msg, restored))
+                slots++;
+        cr_expect_eq(slots, 128, "expected 128 free slots after drain, got %d", slots);
+        lfl_shm_close(msg, restored);
+
+        /* the private restore left the image alone */
+        lfl_shm_type(msg) m;
+        cr_assert_eq(lfl_shm_restore(msg, restored, path, MAP_PRIVATE), 0, "second restore failed");
+        cr_assert_eq(lfl_shm_pop_head(msg, restored, &m), 1, "private changes reached the image");
+        cr_expect_eq(m.seq, 10);
+        lfl_shm_close(msg, restored);
+        unlink(path);
+}
+
+Test(lfl_shm, shared_restore_continues_in_the_image)
+{
+        struct lfl_shm seg;
+        lfl_shm_type(msg) m;
+        char path[] = "/tmp/lfl_snapshot_XXXXXX";
+        int fd = mkstemp(path);
+
+        cr_assert_geq(fd, 0, "mkstemp failed");
+        close(fd);
+        cr_assert_eq(lfl_shm_create(msg, seg, NULL, 16), 0, "segment creation failed");
+        for (int i = 0; i < 4; i++) {
+                lfl_shm_type(msg) *n = lfl_shm_new(msg, seg);
+                n->seq = i;
+                lfl_shm_add_tail_ptr(msg, seg, n);
+        }
+        cr_assert_eq(lfl_shm_snapshot(msg, seg, path), 0, "snapshot failed");
+        lfl_shm_close(msg, seg);
+
+        cr_assert_eq(lfl_shm_restore(msg, seg, path, MAP_SHARED), 0, "shared restore failed");
+        cr_assert_eq(lfl_shm_pop_head(msg, seg, &m), 1);
+        cr_expect_eq(m.seq, 0);
+        lfl_shm_close(msg, seg);
+
+        /* the dequeue went to the file */
+        cr_assert_eq(lfl_shm_restore(msg, seg, path, MAP_PRIVATE), 0, "restore failed");
+        cr_assert_eq(lfl_shm_pop_head(msg, seg, &m), 1);
+        cr_expect_eq(m.seq, 1, "expected 1, got %d", m.seq);
+        lfl_shm_close(msg, seg);
+        unlink(path);
+}
+
+Test(lfl_shm, file_backed_segment_survives_reopen)
+{
+        struct lfl_shm seg;
+        char path[] = "/tmp/lfl_segment_XXXXXX";
+        int fd = mkstemp(path);
+
+        cr_assert_geq(fd, 0, "mkstemp failed");
+        close(fd);
+        unlink(path);
+
+        cr_assert_eq(lfl_shm_map_file(msg, seg, path, 16), 0, "mapping new file failed");
+        lfl_shm_type(msg) *m = lfl_shm_new(msg, seg);
+        m->seq = 7;
+        lfl_shm_add_tail_ptr(msg, seg, m);
+        lfl_shm_close(msg, seg);
+
+        cr_assert_eq(lfl_shm_map_file(msg, seg, path, 16), 0, "remapping file failed");
+        lfl_shm_type(msg) out;
+        cr_assert_eq(lfl_shm_pop_head(msg, seg, &out), 1, "queued node did not persist");
+        cr_expect_eq(out.seq, 7, "expected 7, got %d", out.seq);
+        lfl_shm_close(msg, seg);
+        unlink(path);
+}
+
+static void encode_id(const test_t *node, void *rec)
+{
+        int32_t v = node->id;
+        memcpy(rec, &v, sizeof(v));
+}
+
+static void decode_id(const void *rec, test_t *node)
+{
+        int32_t v;
+        memcpy(&v, rec, sizeof(v));
+        node->id = v;
+}
+
+Test(lfl_stream, serialize_then_deserialize_roundtrip)
+{
+        char path[] = "/tmp/lfl_stream_XXXXXX";
+        int fd = mkstemp(path);
+        long written = 0, loaded = 0;
+
+        cr_assert_geq(fd, 0, "mkstemp failed");
+        unlink(path);
+
+        lfl_vars(test, src);
+        lfl_init(test, src);
+        for (int i = 0; i < 300000; i++) {
+                lfl_add_tail(test, src, n);
+                n->id = i;
+                if (i % 3 == 0)
+                        lfl_remove(test, src, n);
+        }
+
+        lfl_serialize_fd(test, src, fd, sizeof(int32_t), encode_id, written);
+        cr_assert_eq(written, 200000, "expected 200000 records, wrote %ld", written);
+
+        lfl_vars(test, dst);
+        lfl_init(test, dst);
+        lfl_add_tail(test, dst, existing);
+        existing->id = -1;
+
+        lseek(fd, 0, SEEK_SET);
+        lfl_deserialize_fd(test, dst, fd, sizeof(int32_t), decode_id, loaded);
+        cr_assert_eq(loaded, written, "expected %ld nodes, loaded %ld", written, loaded);
+
+        int expect = -1, count = 0;
+        lfl_foreach(test, dst, item) {
+                cr_assert_eq(item->id, expect, "order mismatch: expected %d, got %d", expect, item->id);
+                expect = expect < 0 ? 1 : (expect % 3 == 2 ? expect + 2 : expect + 1);
+                count++;
+        }
+        cr_expect_eq(count, 200001, "expected 200001 nodes, got %d", count);
+        cr_expect_eq(lfl_get_tail(dst)->id, 299999, "tail not updated by splice");
+
+        int rev = 0;
+        lfl_foreach_rev(test, dst, item2) {
+                rev++;
+        }
+        cr_expect_eq(rev, count, "prev links broken by splice");
+
+        close(fd);
+        lfl_clear(test, src);
+        lfl_clear(test, dst);
+}
+
+Test(lfl_stream, deserialize_rejects_truncated_record)
+{
+        int fds[2];
+        long loaded = 0;
+
+        cr_assert_eq(pipe(fds), 0, "pipe failed");
+        cr_assert_eq(write(fds[1], "\1\0\0\0\2\0", 6), 6, "pipe write failed");
+        close(fds[1]);
+
+        lfl_vars(test, dst);
+        lfl_init(test, dst);
+        lfl_deserialize_fd(test, dst, fds[0], sizeof(int32_t), decode_id, loaded);
+        cr_expect_eq(loaded, -1, "truncated stream should report an error");
+
+        int count = 0;
+        lfl_count(test, dst, count);
+        cr_expect_eq(count, 1, "the complete record should still be loaded");
+
+        close(fds[0]);
+        lfl_clear(test, dst);
+}
+
+/* an in-memory sink and source for the callback forms */
+struct mem_stream {
+        char *buf;
+        size_t len;
+        size_t pos;
+        int calls;
+        int fail_after;
+};
+
+static int mem_write(const void *buf, size_t len, void *ctx)
+{
+        struct mem_stream *m = ctx;
+        char *grown;
+
+        if (m->fail_after && m->calls == m->fail_after) {
+                errno = ENOSPC;
+                return -1;
+        }
+        grown = realloc(m->buf, m->len + len);
+        if (!grown)
+                return -1;
+        memcpy(grown + m->len, buf, len);
+        m->buf = grown;
+        m->len += len;
+        m->calls++;
+        return 0;
+}
+
+static ssize_t mem_read(void *buf, size_t len, void *ctx)
+{
+        struct mem_stream *m = ctx;
+        size_t n = m->len - m->pos < len ? m->len - m->pos : len;
+
+        memcpy(buf, m->buf + m->pos, n);
+        m->pos += n;
+        m->calls++;
+        return (ssize_t)n;
+}
+
+Test(lfl_stream, writer_callback_gets_whole_buffers)
+{
+        struct mem_stream m = { 0 };
+        long written = 0, loaded = 0;
+        int expect = 0;
+
+        lfl_vars(test, src);
+        lfl_init(test, src);
+        for (int i = 0; i < 600000; i++) {
+                lfl_add_tail(test, src, n);
+                n->id = i;
+        }
+        lfl_serialize(test, src, mem_write, &m, sizeof(int32_t), encode_id, written);
+        cr_assert_eq(written, 600000);
+        cr_expect_eq(m.len, 600000 * sizeof(int32_t));
+        cr_expect_eq(m.calls, (int)((m.len + LFL_STREAM_BUF - 1) / LFL_STREAM_BUF),
+                     "%d writer calls for %zu bytes", m.calls, m.len);
+
+        lfl_vars(test, dst);
+        lfl_init(test, dst);
+        m.calls = 0;
+        lfl_deserialize(test, dst, mem_read, &m, sizeof(int32_t), decode_id, loaded);
+        cr_assert_eq(loaded, written);
+        lfl_foreach(test, dst, item) {
+                cr_assert_eq(item->id, expect++);
+        }
+        cr_expect_eq(expect, 600000);
+
+        /* a failing writer turns into an error result */
+        free(m.buf);
+        memset(&m, 0, sizeof(m));
+        m.fail_after = 1;
+        errno = 0;
+        lfl_serialize(test, src, mem_write, &m, sizeof(int32_t), encode_id, written);
+        cr_expect_eq(written, -1);
+        cr_expect_eq(errno, ENOSPC);
+        free(m.buf);
+        lfl_clear(test, src);
+        lfl_clear(test, dst);
+}
+
+struct session {
+        int id;
+        _Atomic(int) hooks;
+        lfl_hook active;
+        lfl_hook expiry;
+};
+
+static _Atomic(int) sessions_freed;
+
+static void session_put(struct session *s)
+{
+        if (atomic_fetch_sub(&s->hooks, 1) == 1) {
+                atomic_fetch_add(&sessions_freed, 1);
+                free(s);
+        }
+}
+
+static void active_unhooked(lfl_hook *hook)
+{
+        session_put(lfl_hook_entry(hook, struct session, active));
+}
+
+static void expiry_unhooked(lfl_hook *hook)
+{
+        session_put(lfl_hook_entry(hook, struct session, expiry));
+}
+
+Test(lfl_hook, one_object_on_two_lists)
+{
+        lfl_hook_vars(active);
+        lfl_hook_vars(expiry);
+        lfl_hook_init(active);
+        lfl_hook_init(expiry);
+        atomic_store(&sessions_freed, 0);
+
+        for (int i = 0; i < 10; i++) {
+                struct session *s = calloc(1, sizeof(*s));
+                s->id = i;
+                atomic_store(&s->hooks, 2);
+                lfl_hook_add_tail(active, s, active);
+                lfl_hook_add_head(expiry, s, expiry);
+        }
+
+        int seen = 0;
+        lfl_hook_foreach(struct session, active, active, s) {
+                cr_assert_eq(s->id, seen, "active order: expected %d, got %d", seen, s->id);
+                seen++;
+        }
+        cr_expect_eq(seen, 10, "expected 10 active sessions, got %d", seen);
+
+        lfl_hook_find(struct session, expiry, expiry, found, id, 5);
+        cr_assert_not_null(found, "session 5 not found through expiry hook");
+
+        /* expire the even sessions: off the expiry list, still active */
+        lfl_hook_foreach(struct session, expiry, expiry, e) {
+                if (e->id % 2 == 0)
+                        lfl_hook_remove(expiry, e, expiry);
+        }
+        lfl_hook_sweep(expiry, expiry_unhooked);
+
+        int n_active = 0, n_expiry = 0;
+        lfl_hook_count(active, n_active);
+        lfl_hook_count(expiry, n_expiry);
+        cr_expect_eq(n_active, 10, "active list lost sessions: %d", n_active);
+        cr_expect_eq(n_expiry, 5, "expected 5 on expiry list, got %d", n_expiry);
+        cr_expect_eq(atomic_load(&sessions_freed), 0, "freed while still on a list");
+        cr_expect(lfl_hook_linked(found, active) && lfl_hook_linked(found, expiry),
+                  "removal flags are per hook");
+
+        /* drop every session from the active list: evens are now unhooked everywhere */
+        lfl_hook_foreach(struct session, active, active, a) {
+                lfl_hook_remove(active, a, active);
+        }
+        lfl_hook_sweep(active, active_unhooked);
+        cr_expect_eq(atomic_load(&sessions_freed), 5, "expected 5 freed, got %d", atomic_load(&sessions_freed));
+        cr_expect_null(lfl_get_head(active), "active list not empty after sweep");
+
+        struct session *first = NULL;
+        lfl_hook_pop_head(struct session, expiry, expiry, first);
+        cr_assert_not_null(first, "pop from expiry list failed");
+        cr_expect_eq(first->id, 9, "expected session 9 at the expiry head, got %d", first->id);
+        session_put(first);
+        lfl_hook_foreach(struct session, expiry, expiry, rest) {
+                lfl_hook_unlink(expiry, rest, expiry);
+                session_put(rest);
+        }
+        cr_expect_eq(atomic_load(&sessions_freed), 10, "sessions leaked");
+}
+
+struct par_sums {
+        _Alignas(64) long sum;
+        long visits;
+};
+
+static void par_sum_fn(test_t *item, void *ctx, int worker)
+{
+        struct par_sums *sums = ctx;
+        sums[worker].sum += item->id;
+        sums[worker].visits++;
+}
+
+Test(lfl_parallel, foreach_visits_every_live_node_once)
+{
+        struct par_sums sums[4];
+        long expect = 0, total = 0, visits = 0, count = 0;
+        int used = 0;
+
+        lfl_vars(test, list);
+        lfl_init(test, list);
+        for (int i = 0; i < 100000; i++) {
+                lfl_add_tail(test, list, n);
+                n->id = i;
+                if (i % 5 == 0)
+                        lfl_remove(test, list, n);
+                else
+                        expect += i;
+        }
+
+        memset(sums, 0, sizeof(sums));
+        used = lfl_parallel_foreach(test, list, 4, par_sum_fn, sums);
+        cr_assert(used >= 1 && used <= 4, "unexpected worker count %d", used);
+        for (int t = 0; t < 4; t++) {
+                total += sums[t].sum;
+                visits += sums[t].visits;
+        }
+        cr_expect_eq(visits, 80000, "expected 80000 visits, got %ld", visits);
+        cr_expect_eq(total, expect, "merged sum %ld != %ld", total, expect);
+
+        lfl_parallel_count(test, list, 0, count);
+        cr_expect_eq(count, 80000, "parallel count %ld", count);
+
+        lfl_vars(test, empty);
+        lfl_init(test, empty);
+        lfl_parallel_count(test, empty, 8, count);
+        cr_expect_eq(count, 0, "empty list counted %ld", count);
+
+        lfl_clear(test, list);
+}
+
+static void par_seen_fn(test_t *item, void *ctx, int worker)
+{
+        (void)worker;
+        atomic_fetch_add(&((_Atomic(int) *)ctx)[item->id], 1);
+}
+
+Test(lfl_parallel, index_skips_the_walk_and_follows_the_list)
+{
+        static _Atomic(int) seen[60000];
+        struct lfl_par_index ix;
+        static struct test_linked_list *nodes[60000];
+        long count = 0, pinned = 0, tail_splits = 0;
+
+        lfl_vars(test, list);
+        lfl_init(test, list);
+        lfl_par_index_init(test, ix, refcount);
+        for (int i = 0; i < 40000; i++) {
+                lfl_add_tail(test, list, n);
+                n->id = i;
+                nodes[i] = n;
+        }
+
+        lfl_parallel_count_ix(test, list, &ix, 4, count);
+        cr_expect_eq(count, 40000, "first indexed count %ld", count);
+        cr_assert(ix.n >= 8, "scan left only %zu splits", ix.n);
+
+        /* grow at both ends, drop a long run in the middle */
+        for (int i = 40000; i < 60000; i++) {
+                lfl_add_tail(test, list, n);
+                n->id = i;
+                nodes[i] = n;
+        }
+        for (int i = 10000; i < 30000; i++)
+                lfl_remove(test, list, nodes[i]);
+
+        memset(seen, 0, sizeof(seen));
+        cr_assert(lfl_parallel_foreach_ix(test, list, &ix, 4, par_seen_fn, seen) >= 1, "indexed scan failed");
+        for (int i = 0; i < 60000; i++)
+                cr_assert_eq(atomic_load(&seen[i]), i >= 10000 && i < 30000 ? 0 : 1,
+                             "node %d visited %d times", i, atomic_load(&seen[i]));
+        for (size_t k = 0; k < ix.n; k++) {
+                struct test_linked_list *split = ix.nodes[k];
+                cr_assert(!atomic_load(&split->removed), "split %zu is a removed node", k);
+                cr_assert(!k || split->id > ((struct test_linked_list *)ix.nodes[k - 1])->id,
+                          "splits out of list order at %zu", k);
+                tail_splits += split->id >= 40000;
+        }
+        cr_expect(tail_splits >= 4, "index did not pick up the appended nodes (%ld splits)", tail_splits);
+
+        lfl_parallel_count_ix(test, list, &ix, 1, count);
+        cr_expect_eq(count, 40000, "indexed count after changes %ld", count);
+
+        lfl_par_index_destroy(&ix);
+        for (int i = 0; i < 60000; i++)
+                pinned += atomic_load(&nodes[i]->refcount);
+        cr_expect_eq(pinned, 0, "%ld pins left after destroy", pinned);
+        lfl_clear(test, list);
+}
+
+static _Atomic(long) psweep_cleaned;
+
+static void psweep_cleanup(test_t *node)
+{
+        (void)node;
+        atomic_fetch_add(&psweep_cleaned, 1);
+}
+
+Test(lfl_parallel, sweep_reclaims_backlog_and_keeps_links)
+{
+        long freed = 0, live = 0, fwd = 0, rev = 0, removed = 0;
+
+        lfl_vars(test, list);
+        lfl_init(test, list);
+        atomic_store(&psweep_cleaned, 0);
+        for (int i = 0; i < 50000; i++) {
+                lfl_add_tail(test, list, n);
+                n->id = i;
+                /* runs of removed nodes that straddle chunk boundaries */
+                if (i % 10 != 3 && i != 49999) {
+                        lfl_remove(test, list, n);
+                        removed++;
+                }
+                if (i == 8192)
+                        atomic_store(&n->refcount, 1);
+        }
+
+        lfl_parallel_sweep(test, list, refcount, 4, psweep_cleanup, freed);
+        cr_expect_eq(freed, removed - 1, "expected %ld freed, got %ld", removed - 1, freed);
+        cr_expect_eq(atomic_load(&psweep_cleaned), freed, "cleanup ran %ld times", atomic_load(&psweep_cleaned));
+
+        lfl_count(test, list, live);
+        cr_expect_eq(live, 5001, "expected 5001 live nodes, got %ld", live);
+
+        struct test_linked_list *prev = NULL;
+        for (struct test_linked_list *c = lfl_get_head(list); c; c = lfl_get_next(c)) {
+                cr_assert_eq(atomic_load(&c->prev), prev, "prev link broken at id %d", c->id);
+                prev = c;
+                fwd++;
+        }
+        cr_expect_eq(lfl_get_tail(list), prev, "tail does not match last node");
+        lfl_foreach_rev(test, list, r) {
+                rev++;
+        }
+        cr_expect_eq(fwd, 5002, "expected the pinned node to survive, walked %ld", fwd);
+        cr_expect_eq(rev, live, "reverse walk saw %ld nodes", rev);
+
+        lfl_clear(test, list);
+}
+
+static _Atomic(long) remove_if_cleaned;
+
+static int id_divisible(test_t *item, void *ctx)
+{
+        return item->id % *(int *)ctx == 0;
+}
+
+static void remove_if_cleanup(test_t *item)
+{
+        (void)item;
+        atomic_fetch_add(&remove_if_cleaned, 1);
+}
+
+Test(lfl_lockfree, remove_if_unlinks_matching_runs)
+{
+        int divisor = 3;
+        long marked = 0;
+        int live = 0, pending = 0;
+
+        lfl_vars(test, list);
+        lfl_init(test, list);
+        atomic_store(&remove_if_cleaned, 0);
+        for (int i = 0; i < 3000; i++) {
+                lfl_add_tail(test, list, n);
+                n->id = i < 1000 ? 0 : i; /* a leading run of 1000 matches */
+                if (i == 1500)
+                        atomic_store(&n->refcount, 1);
+        }
+
+        marked = lfl_remove_if(test, list, refcount, id_divisible, &divisor, remove_if_cleanup);
+        cr_expect_eq(marked, 1666, "expected 1666 marked, got %ld", marked);
+        cr_expect_eq(atomic_load(&remove_if_cleaned), 1665, "expected 1665 cleaned, got %ld",
+                     atomic_load(&remove_if_cleaned));
+
+        lfl_count(test, list, live);
+        cr_expect_eq(live, 1334, "expected 1334 live nodes, got %d", live);
+        lfl_count_pending_cleanup(test, list, refcount, pending);
+        cr_expect_eq(pending, 1, "referenced match should stay linked, got %d", pending);
+
+        struct test_linked_list *prev = NULL;
+        for (struct test_linked_list *c = lfl_get_head(list); c; c = lfl_get_next(c)) {
+                cr_assert_eq(atomic_load(&c->prev), prev, "prev link broken at id %d", c->id);
+                prev = c;
+        }
+        cr_expect_eq(lfl_get_tail(list), prev, "tail does not match last node");
+
+        marked = lfl_remove_if(test, list, refcount, id_divisible, &divisor, NULL);
+        cr_expect_eq(marked, 0, "second pass marked %ld", marked);
+        lfl_clear(test, list);
+}
+
+lfl_vars_static(test, rif_list);
+static _Atomic(int) rif_stop;
+
+struct rif_run {
+        struct lfl_rcu *dom;
+        _Atomic(long) walks;
+};
+
+static void *rif_reader(void *arg)
+{
+        struct rif_run *run = arg;
+
+        while (!atomic_load(&rif_stop)) {
+                long sum = 0;
+                int n = 0;
+                if (lfl_rcu_read_lock(run->dom) != 0)
+                        continue;
+                {
+                        lfl_foreach(test, rif_list, item) {
+                                sum += item->id;
+                                if (++n % 32 == 0)
+                                        sched_yield();
+                        }
+                }
+                lfl_rcu_read_unlock(run->dom);
+                atomic_fetch_add(&run->walks, sum >= 0);
+        }
+        return NULL;
+}
+
+Test(lfl_lockfree, rcu_remove_if_waits_out_readers)
+{
+        struct lfl_rcu dom;
+        pthread_t threads[2];
+        struct rif_run runs[2] = { { &dom, 0 }, { &dom, 0 } };
+        long marked = 0;
+        int next_id = 1, left = 0;
+
+        cr_assert_eq(lfl_rcu_init(&dom), 0);
+        lfl_init(test, rif_list);
+        atomic_store(&rif_stop, 0);
+        atomic_store(&remove_if_cleaned, 0);
+        for (; next_id <= 256; next_id++) {
+                lfl_add_tail_init(test, rif_list, node, { node->id = next_id; });
+        }
+        for (int t = 0; t < 2; t++)
+                pthread_create(&threads[t], NULL, rif_reader, &runs[t]);
+        for (int round = 0; round < 1000; round++) {
+                int divisor = round % 5 + 2;
+                long m = lfl_rcu_remove_if(test, rif_list, refcount, dom, id_divisible, &divisor, remove_if_cleanup);
+                marked += m;
+                while (m--) {
+                        lfl_add_tail_init(test, rif_list, node, { node->id = next_id++; });
+                }
+                sched_yield();
+        }
+        for (int t = 0; t < 2; t++)
+                while (!atomic_load(&runs[t].walks))
+                        sched_yield();
+        atomic_store(&rif_stop, 1);
+        for (int t = 0; t < 2; t++)
+                pthread_join(threads[t], NULL);
+
+        /* every marked node was freed once, except a marked last node */
+        for (test_t *c = lfl_get_head(rif_list); c; c = lfl_get_next(c))
+                left += atomic_load(&c->removed);
+        cr_expect_eq(atomic_load(&remove_if_cleaned) + left, marked, "cleaned %ld + left %d != marked %ld",
+                     atomic_load(&remove_if_cleaned), left, marked);
+        lfl_clear(test, rif_list);
+        lfl_rcu_destroy(&dom);
+}
+
+static void *rif_sweeper(void *arg)
+{
+        (void)arg;
+        while (!atomic_load(&rif_stop)) {
+                lfl_sweep(test, rif_list, refcount, remove_if_cleanup);
+                sched_yield();
+        }
+        return NULL;
+}
+
+Test(lfl_lockfree, remove_if_and_sweep_share_a_list)
+{
+        pthread_t sweeper;
+        long marked = 0;
+        test_t *prev = NULL;
+        int live = 0, expect_live = 0;
+
+        lfl_init(test, rif_list);
+        atomic_store(&rif_stop, 0);
+        atomic_store(&remove_if_cleaned, 0);
+        for (int i = 1; i <= 20000; i++) {
+                lfl_add_tail_init(test, rif_list, node, { node->id = i; });
+        }
+        pthread_create(&sweeper, NULL, rif_sweeper, NULL);
+        /* the sweeper unlinks nodes marked here while remove_if unlinks runs of its own */
+        for (int divisor = 97; divisor > 1; divisor--) {
+                marked += lfl_remove_if(test, rif_list, refcount, id_divisible, &divisor, remove_if_cleanup);
+                {
+                        lfl_foreach(test, rif_list, item) {
+                                if (item->id % (divisor + 100) == 0) {
+                                        lfl_remove(test, rif_list, item);
+                                        marked++;
+                                }
+                        }
+                }
+                sched_yield();
+        }
+        atomic_store(&rif_stop, 1);
+        pthread_join(sweeper, NULL);
+        lfl_sweep(test, rif_list, refcount, remove_if_cleanup);
+
+        cr_expect_eq(atomic_load(&remove_if_cleaned), marked, "cleaned %ld, marked %ld",
+                     atomic_load(&remove_if_cleaned), marked);
+        for (test_t *c = lfl_get_head(rif_list); c; c = lfl_get_next(c)) {
+                cr_assert_eq(atomic_load(&c->prev), prev, "prev link broken at id %d", c->id);
+                cr_assert_not(atomic_load(&c->removed), "removed node %d left behind", c->id);
+                prev = c;
+                live++;
+        }
+        cr_expect_eq(lfl_get_tail(rif_list), prev);
+        for (int i = 1; i <= 20000; i++) {
+                int keep = 1;
+                for (int d = 2; d <= 97 && keep; d++)
+                        keep = i % d && i % (d + 100);
+                expect_live += keep;
+        }
+        cr_expect_eq(live, expect_live, "expected %d live, got %d", expect_live, live);
+        lfl_clear(test, rif_list);
+}
+
+Test(lfl_cursor, resumes_across_sweeps)
+{
+        lfl_cursor cur;
+        int seen = 0, last = -1;
+
+        lfl_vars(test, list);
+        lfl_init(test, list);
+        for (int i = 0; i < 3000; i++) {
+                lfl_add_tail(test, list, n);
+                n->id = i;
+        }
+
+        lfl_cursor_init(test, list, cur);
+        for (int slice = 0; slice < 1000; slice++) {
+                test_t *n = lfl_cursor_next(test, cur);
+                cr_assert_not_null(n, "cursor ended early");
+                last = n->id;
+                seen++;
+        }
+        cr_expect_eq(last, 999, "expected to pause on 999, got %d", last);
+
+        /* between ticks: remove the paused node and every odd node, then sweep */
+        lfl_foreach(test, list, item) {
+                if (item->id == 999 || item->id % 2)
+                        lfl_remove(test, list, item);
+        }
+        lfl_sweep(test, list, refcount, NULL);
+
+        test_t *n;
+        while ((n = lfl_cursor_next(test, cur)) != NULL) {
+                cr_assert_eq(n->id % 2, 0, "cursor returned removed node %d", n->id);
+                cr_assert_gt(n->id, last, "cursor went backwards: %d after %d", n->id, last);
+                last = n->id;
+                seen++;
+        }
+        cr_expect_eq(seen, 2000, "expected 2000 visits, got %d", seen);
+        cr_expect_null(lfl_cursor_next(test, cur), "cursor should stay at the end");
+        lfl_cursor_close(cur);
+
+        /* the once-pinned node is now unreferenced and can be swept */
+        int pending = -1;
+        lfl_sweep(test, list, refcount, NULL);
+        lfl_count_pending_cleanup(test, list, refcount, pending);
+        cr_expect_eq(pending, 0, "cursor left a reference behind");
+        lfl_clear(test, list);
+}
+
+Test(lfl_cursor, skips_removed_runs_hand_over_hand)
+{
+        lfl_cursor cur;
+        test_t *nodes[12], *n;
+        int expect[] = { 0, 4, 5, 11 };
+        int k = 0;
+
+        lfl_vars(test, list);
+        lfl_init(test, list);
+        for (int i = 0; i < 12; i++) {
+                lfl_add_tail(test, list, node);
+                node->id = i;
+                nodes[i] = node;
+                if ((i >= 1 && i <= 3) || (i >= 6 && i <= 10))
+                        lfl_remove(test, list, node);
+        }
+        lfl_cursor_init(test, list, cur);
+        while ((n = lfl_cursor_next(test, cur)) != NULL) {
+                cr_assert_eq(n->id, expect[k++]);
+                /* only the node the cursor returned holds a reference */
+                for (int i = 0; i < 12; i++)
+                        cr_assert_eq(atomic_load(&nodes[i]->refcount), nodes[i] == n,
+                                     "node %d refcount %d at %d", i, atomic_load(&nodes[i]->refcount), n->id);
+        }
+        cr_expect_eq(k, 4);
+        for (int i = 0; i < 12; i++)
+                cr_expect_eq(atomic_load(&nodes[i]->refcount), 0);
+        lfl_clear(test, list);
+}
+
+lfl_def(pair)
+        lfl_seq seq;
+        long a;
+        long b;
+lfl_end
+
+struct seq_run {
+        struct pair_linked_list *node;
+        _Atomic(int) stop;
+        long torn;
+        long reads;
+};
+
+static void *seq_reader(void *arg)
+{
+        struct seq_run *run = arg;
+
+        while (!atomic_load(&run->stop)) {
+                unsigned int s;
+                long a, b;
+                do {
+                        s = lfl_read_begin(run->node, seq);
+                        a = run->node->a;
+                        b = run->node->b;
+                } while (lfl_read_retry(run->node, seq, s));
+                if (b != a * 2)
+                        run->torn++;
+                run->reads++;
+        }
+        return NULL;
+}
+
+Test(lfl_seqlock, readers_never_see_torn_payload)
+{
+        struct seq_run run = { 0 };
+        pthread_t reader;
+
+        lfl_vars(pair, list);
+        lfl_init(pair, list);
+        lfl_add_tail(pair, list, node);
+        run.node = node;
+
+        cr_assert_eq(pthread_create(&reader, NULL, seq_reader, &run), 0, "reader thread failed");
+        for (long i = 1; i <= 200000; i++) {
+                lfl_write_begin(node, seq);
+                node->a = i;
+                node->b = i * 2;
+                lfl_write_end(node, seq);
+        }
+        atomic_store(&run.stop, 1);
+        pthread_join(reader, NULL);
+
+        cr_expect_eq(run.torn, 0, "reader saw %ld torn snapshots in %ld reads", run.torn, run.reads);
+        cr_expect_eq(atomic_load(&node->seq), 400000u, "sequence should advance by two per write");
+        cr_expect_eq(node->a, 200000, "last write lost");
+        lfl_clear(pair, list);
+}
+
+lfl_vars(test, published);
+
+struct init_run {
+        _Atomic(int) stop;
+        long unset;
+};
+
+static void *init_reader(void *arg)
+{
+        struct init_run *run = arg;
+
+        while (!atomic_load(&run->stop)) {
+                for (struct test_linked_list *c = atomic_load(&published_head); c; c = lfl_get_next(c))
+                        if (c->id == 0)
+                                run->unset++;
+        }
+        return NULL;
+}
+
+Test(lfl_lockfree, add_init_publishes_initialized_nodes)
+{
+        struct init_run run = { 0 };
+        pthread_t reader;
+
+        lfl_init(test, published);
+        cr_assert_eq(pthread_create(&reader, NULL, init_reader, &run), 0, "reader thread failed");
+        for (int i = 1; i <= 20000; i++) {
+                if (i % 2) {
+                        lfl_add_tail_init(test, published, node, { node->id = i; });
+                } else {
+                        lfl_add_head_init(test, published, node, { node->id = i, (void)0; });
+                }
+        }
+        atomic_store(&run.stop, 1);
+        pthread_join(reader, NULL);
+
+        int count = 0;
+        lfl_count(test, published, count);
+        cr_expect_eq(count, 20000, "expected 20000 nodes, got %d", count);
+        cr_expect_eq(run.unset, 0, "reader saw %ld uninitialized nodes", run.unset);
+        cr_expect_eq(lfl_get_head(published)->id, 20000, "head init lost");
+        cr_expect_eq(lfl_get_tail(published)->id, 19999, "tail init lost");
+        lfl_clear(test, published);
+}
+
+lfl_vars(test, buffered);
+static lfl_buffer_vars(producer_buf);
+
+static void *buffered_producer(void *arg)
+{
+        int base = *(int *)arg;
+
+        lfl_buffer_init(producer_buf, 32, 1000000);
+        for (int i = 0; i < 10000; i++) {
+                test_t *n = lfl_new(test);
+                n->id = base + i;
+                lfl_add_tail_buffered(test, buffered, producer_buf, n);
+        }
+        lfl_buffer_flush(test, buffered, producer_buf);
+        return NULL;
+}
+
+Test(lfl_buffer, per_thread_batches_keep_order)
+{
+        pthread_t threads[2];
+        int bases[2] = { 0, 100000 };
+        int next[2] = { 0, 100000 };
+        int count = 0;
+
+        lfl_init(test, buffered);
+        for (int t = 0; t < 2; t++)
+                cr_assert_eq(pthread_create(&threads[t], NULL, buffered_producer, &bases[t]), 0, "thread failed");
+        for (int t = 0; t < 2; t++)
+                pthread_join(threads[t], NULL);
+
+        lfl_foreach(test, buffered, item) {
+                int t = item->id >= 100000;
+                cr_assert_eq(item->id, next[t], "producer %d out of order: %d != %d", t, item->id, next[t]);
+                next[t]++;
+                count++;
+        }
+        cr_expect_eq(count, 20000, "expected 20000 nodes, got %d", count);
+        lfl_clear(test, buffered);
+}
+
+Test(lfl_buffer, holds_until_batch_or_deadline)
+{
+        struct lfl_buffer buf;
+        int count = -1;
+
+        lfl_vars(test, list);
+        lfl_init(test, list);
+        lfl_buffer_init(buf, 4, 2000);
+
+        for (int i = 0; i < 3; i++) {
+                test_t *n = lfl_new(test);
+                n->id = i;
+                lfl_add_tail_buffered(test, list, buf, n);
+        }
+        cr_expect_null(lfl_get_head(list), "partial batch published early");
+        test_t *n = lfl_new(test);
+        n->id = 3;
+        lfl_add_tail_buffered(test, list, buf, n);
+        lfl_count(test, list, count);
+        cr_expect_eq(count, 4, "full batch not flushed, count %d", count);
+
+        test_t *late = lfl_new(test);
+        late->id = 4;
+        lfl_add_tail_buffered(test, list, buf, late);
+        lfl_buffer_poll(test, list, buf);
+        cr_expect_eq(lfl_get_tail(list)->id, 3, "flushed before the deadline");
+        usleep(20000);
+        lfl_buffer_poll(test, list, buf);
+        cr_expect_eq(lfl_get_tail(list)->id, 4, "deadline flush missing");
+        lfl_clear(test, list);
+}
+
+Test(lfl_lockfree, pop_head_n_claims_prefix)
+{
+        test_t *first = NULL;
+        size_t got = 0;
+
+        lfl_vars(test, list);
+        lfl_init(test, list);
+        for (int i = 0; i < 10; i++) {
+                lfl_add_tail(test, list, n);
+                n->id = i;
+        }
+
+        lfl_pop_head_n(test, list, first, 4, got);
+        cr_assert_eq(got, 4, "expected 4 claimed, got %zu", got);
+        test_t *c = first;
+        for (int i = 0; i < 4; i++) {
+                cr_expect_eq(c->id, i, "batch order: expected %d, got %d", i, c->id);
+                test_t *next = lfl_get_next(c);
+                free(c);
+                c = next;
+        }
+        cr_expect_eq(lfl_get_head(list)->id, 4, "head not advanced past the batch");
+        cr_expect_null(atomic_load(&lfl_get_head(list)->prev), "new head still points back into the batch");
+
+        lfl_pop_head_n(test, list, first, 100, got);
+        cr_assert_eq(got, 6, "expected the remaining 6, got %zu", got);
+        cr_expect_null(lfl_get_head(list), "head not cleared on drain");
+        cr_expect_null(lfl_get_tail(list), "tail not cleared on drain");
+        for (size_t i = 0; i < got; i++) {
+                test_t *next = lfl_get_next(first);
+                free(first);
+                first = next;
+        }
+
+        lfl_pop_head_n(test, list, first, 8, got);
+        cr_expect_eq(got, 0, "empty list yielded %zu nodes", got);
+        cr_expect_null(first, "empty list yielded a node");
+
+        lfl_add_tail(test, list, again);
+        again->id = 42;
+        cr_expect_eq(lfl_get_head(list), again, "list unusable after drain");
+        lfl_clear(test, list);
+}
+
+Test(lfl_lockfree, pop_head_n_closes_the_drained_tail)
+{
+        test_t *first = NULL, *late = lfl_new(test);
+        size_t got = 0;
+        lfl_vars(test, list);
+        lfl_init(test, list);
+
+        for (int i = 0; i < 3; i++) {
+                lfl_add_tail(test, list, n);
+                n->id = i;
+        }
+        /* an appender that loaded the tail before the drain must not link onto it */
+        test_t *stale = lfl_get_tail(list), *open = NULL;
+        lfl_pop_head_n(test, list, first, 8, got);
+        cr_assert_eq(got, 3);
+        cr_expect(!atomic_compare_exchange_strong(&stale->next, &open, late), "drained tail still open");
+        cr_expect(atomic_load(&open->removed), "closed link does not read as removed");
+        cr_expect_null(atomic_load(&open->next));
+        cr_expect_null(lfl_get_head(list));
+        cr_expect_null(lfl_get_tail(list));
+        for (int i = 0; i < 3; i++) {
+                test_t *next = lfl_get_next(first);
+                lfl_node_free(test, first);
+                first = next;
+        }
+        lfl_node_free(test, late);
+}
+
+Test(lfl_lockfree, pop_head_n_leaves_a_node_whose_tail_is_unpublished)
+{
+        test_t *first = NULL, *lone = lfl_new(test);
+        size_t got = 0;
+        lfl_vars(test, list);
+        lfl_init(test, list);
+
+        /* an appender that found the list empty has set the head but not the tail yet */
+        atomic_store(&lone->next, NULL);
+        atomic_store(&list_head, lone);
+        lfl_pop_head_n(test, list, first, 4, got);
+        cr_expect_eq(got, 0, "popped a node whose appender was still running");
+        cr_expect_eq(lfl_get_head(list), lone);
+
+        atomic_store(&list_tail, lone);
+        lfl_pop_head_n(test, list, first, 4, got);
+        cr_expect_eq(got, 1);
+        cr_expect_eq(first, lone);
+        cr_expect_null(lfl_get_tail(list));
+        lfl_node_free(test, lone);
+}
+
+lfl_vars(test, batchq);
+static _Atomic(int) batch_done;
+
+static test_t *batch_popped[40000];
+
+/* popped nodes are freed after the run: an appender may still be linking onto one */
+static void *batch_consumer(void *arg)
+{
+        long *seen = arg;
+
+        for (;;) {
+                int finished = atomic_load(&batch_done);
+                test_t *first = NULL;
+                size_t got = 0;
+                lfl_pop_head_n(test, batchq, first, 16, got);
+                if (!got && finished)
+                        break;
+                for (size_t i = 0; i < got; i++) {
+                        test_t *next = lfl_get_next(first);
+                        seen[first->id]++;
+                        batch_popped[first->id] = first;
+                        first = next;
+                }
+        }
+        return NULL;
+}
+
+Test(lfl_lockfree, pop_head_n_concurrent_consumers)
+{
+        static long seen[2][40000];
+        pthread_t consumers[2];
+
+        memset(seen, 0, sizeof(seen));
+        lfl_init(test, batchq);
+        atomic_store(&batch_done, 0);
+        for (int t = 0; t < 2; t++)
+                cr_assert_eq(pthread_create(&consumers[t], NULL, batch_consumer, seen[t]), 0, "thread failed");
+        for (int i = 0; i < 40000; i++) {
+                lfl_add_tail_init(test, batchq, n, { n->id = i; });
+        }
+        atomic_store(&batch_done, 1);
+        for (int t = 0; t < 2; t++)
+                pthread_join(consumers[t], NULL);
+
+        for (int i = 0; i < 40000; i++)
+                cr_assert_eq(seen[0][i] + seen[1][i], 1, "node %d popped %ld times", i, seen[0][i] + seen[1][i]);
+        for (int i = 0; i < 40000; i++)
+                free(batch_popped[i]);
+}
+
+lfl_vars(test, fairq);
+lfl_fair_vars_static(fairq);
+static _Atomic(int) fair_done;
+
+static void *fair_consumer(void *arg)
+{
+        long *seen = arg;
+
+        for (;;) {
+                int finished = atomic_load(&fair_done);
+                test_t *item = NULL;
+                lfl_pop_head_fair_blocking(test, fairq, item);
+                if (!item) {
+                        if (finished)
+                                break;
+                        continue;
+                }
+                seen[item->id]++;
+                batch_popped[item->id] = item;
+        }
+        return NULL;
+}
+
+Test(lfl_fair, ticketed_consumers_take_each_node_once)
+{
+        static long seen[4][40000];
+        pthread_t consumers[4];
+
+        memset(seen, 0, sizeof(seen));
+        lfl_init(test, fairq);
+        lfl_fair_init(fairq);
+        atomic_store(&fair_done, 0);
+        for (int t = 0; t < 4; t++)
+                cr_assert_eq(pthread_create(&consumers[t], NULL, fair_consumer, seen[t]), 0, "thread failed");
+        for (int i = 0; i < 40000; i++) {
+                lfl_add_tail_init(test, fairq, n, { n->id = i; });
+        }
+        atomic_store(&fair_done, 1);
+        for (int t = 0; t < 4; t++)
+                pthread_join(consumers[t], NULL);
+
+        for (int i = 0; i < 40000; i++) {
+                long total = seen[0][i] + seen[1][i] + seen[2][i] + seen[3][i];
+                cr_assert_eq(total, 1, "node %d popped %ld times", i, total);
+        }
+        cr_expect_eq(atomic_load(&fairq_ticket), atomic_load(&fairq_serving), "ticket left unserved");
+        for (int i = 0; i < 40000; i++)
+                free(batch_popped[i]);
+}
+
+Test(lfl_faaq, fifo_across_recycled_segments)
+{
+        struct lfl_faaq q;
+        static test_t nodes[3000];
+        test_t *item = NULL;
+
+        cr_assert_eq(lfl_faaq_init(&q, 4), 0, "queue init failed");
+        for (int round = 0; round < 20; round++) {
+                for (int i = 0; i < 3000; i++) {
+                        nodes[i].id = round * 3000 + i;
+                        cr_assert_eq(lfl_faaq_add_tail(test, q, &nodes[i]), 0, "enqueue failed in round %d", round);
+                }
+                for (int i = 0; i < 3000; i++) {
+                        lfl_faaq_pop_head(test, q, item);
+                        cr_assert_not_null(item, "queue ran dry at %d", i);
+                        cr_assert_eq(item->id, round * 3000 + i, "FIFO order broken");
+                }
+                lfl_faaq_pop_head(test, q, item);
+                cr_assert_null(item, "queue should be empty");
+        }
+        lfl_faaq_destroy(&q);
+}
+
+static struct lfl_faaq faa_queue;
+static _Atomic(int) faa_producers_left;
+
+static void *faa_producer(void *arg)
+{
+        test_t *nodes = arg;
+
+        for (int i = 0; i < 50000; i++)
+                while (lfl_faaq_add_tail(test, faa_queue, &nodes[i]) != 0)
+                        sched_yield();
+        atomic_fetch_sub(&faa_producers_left, 1);
+        return NULL;
+}
+
+static void *faa_consumer(void *arg)
+{
+        long *seen = arg;
+
+        for (;;) {
+                int left = atomic_load(&faa_producers_left);
+                test_t *item = NULL;
+                lfl_faaq_pop_head(test, faa_queue, item);
+                if (item)
+                        seen[item->id]++;
+                else if (!left)
+                        break;
+        }
+        return NULL;
+}
+
+Test(lfl_faaq, concurrent_producers_and_consumers)
+{
+        static test_t nodes[100000];
+        static long seen[2][100000];
+        pthread_t threads[4];
+
+        memset(seen, 0, sizeof(seen));
+        for (int i = 0; i < 100000; i++)
+                nodes[i].id = i;
+        cr_assert_eq(lfl_faaq_init(&faa_queue, 256), 0, "queue init failed");
+        atomic_store(&faa_producers_left, 2);
+        pthread_create(&threads[0], NULL, faa_consumer, seen[0]);
+        pthread_create(&threads[1], NULL, faa_consumer, seen[1]);
+        pthread_create(&threads[2], NULL, faa_producer, &nodes[0]);
+        pthread_create(&threads[3], NULL, faa_producer, &nodes[50000]);
+        for (int t = 0; t < 4; t++)
+                pthread_join(threads[t], NULL);
+
+        for (int i = 0; i < 100000; i++)
+                cr_assert_eq(seen[0][i] + seen[1][i], 1, "item %d dequeued %ld times", i, seen[0][i] + seen[1][i]);
+        lfl_faaq_destroy(&faa_queue);
+}
+
+Test(lfl_kfifo, bounded_reordering_and_no_loss)
+{
+        lfl_kfifo_vars(test, kq, 8);
+        static test_t nodes[20000];
+        static char seen[20000];
+        test_t *item = NULL;
+        long worst = 0;
+
+        lfl_kfifo_init(test, kq);
+        memset(seen, 0, sizeof(seen));
+        for (int i = 0; i < 20000; i++) {
+                nodes[i].id = i;
+                lfl_kfifo_add_tail_ptr(test, kq, &nodes[i]);
+        }
+        for (int i = 0; i < 20000; i++) {
+                lfl_kfifo_pop_head(test, kq, item);
+                cr_assert_not_null(item, "queue ran dry at %d", i);
+                cr_assert_eq(seen[item->id], 0, "item %d popped twice", item->id);
+                seen[item->id] = 1;
+                long off = labs(item->id - i);
+                if (off > worst)
+                        worst = off;
+        }
+        lfl_kfifo_pop_head(test, kq, item);
+        cr_assert_null(item, "queue should be empty");
+        cr_assert(worst < 8 * 32, "item displaced by %ld positions", worst);
+}
+
+lfl_kfifo_vars_static(test, kfq, 16);
+static _Atomic(int) kfifo_producers_left;
+
+static void *kfifo_producer(void *arg)
+{
+        test_t *nodes = arg;
+
+        for (int i = 0; i < 50000; i++)
+                lfl_kfifo_add_tail_ptr(test, kfq, &nodes[i]);
+        atomic_fetch_sub(&kfifo_producers_left, 1);
+        return NULL;
+}
+
+static void *kfifo_consumer(void *arg)
+{
+        long *seen = arg;
+        test_t *item = NULL;
+
+        for (;;) {
+                int left = atomic_load(&kfifo_producers_left);
+                lfl_kfifo_pop_head(test, kfq, item);
+                if (item)
+                        seen[item->id]++;
+                else if (!left)
+                        break;
+        }
+        return NULL;
+}
+
+Test(lfl_kfifo, concurrent_producers_and_consumers)
+{
+        static test_t nodes[100000];
+        static long seen[2][100000];
+        pthread_t threads[4];
+
+        memset(seen, 0, sizeof(seen));
+        for (int i = 0; i < 100000; i++)
+                nodes[i].id = i;
+        lfl_kfifo_init(test, kfq);
+        atomic_store(&kfifo_producers_left, 2);
+        pthread_create(&threads[0], NULL, kfifo_consumer, seen[0]);
+        pthread_create(&threads[1], NULL, kfifo_consumer, seen[1]);
+        pthread_create(&threads[2], NULL, kfifo_producer, &nodes[0]);
+        pthread_create(&threads[3], NULL, kfifo_producer, &nodes[50000]);
+        for (int t = 0; t < 4; t++)
+                pthread_join(threads[t], NULL);
+        for (int i = 0; i < 100000; i++)
+                cr_assert_eq(seen[0][i] + seen[1][i], 1, "item %d dequeued %ld times", i, seen[0][i] + seen[1][i]);
+}
+
+lfl_def_ex(slim, LFL_SINGLY | LFL_NO_REFCOUNT | LFL_STATS | LFL_NO_SPARE)
+        int id;
+lfl_end
+lfl_state(slim);
+
+lfl_def_ex(padded, LFL_PADDED)
+        int id;
+lfl_end
+lfl_state(padded);
+
+Test(lfl_flavor, singly_queue_drops_fields_and_keeps_working)
+{
+        lfl_vars(slim, q);
+        lfl_init(slim, q);
+        lfl_type(slim) *item = NULL;
+        int ids[8], n = 0;
+
+        cr_assert_lt(sizeof(lfl_type(slim)), sizeof(test_t), "slim node should be smaller than a full node");
+        for (int i = 1; i <= 5; i++) {
+                lfl_add_tail(slim, q, node);
+                node->id = i;
+        }
+        lfl_add_head(slim, q, first);
+        first->id = 0;
+
+        /* unlink from the middle and the end without prev links */
+        lfl_find(slim, q, mid, id, 3);
+        cr_assert_not_null(mid);
+        lfl_delete(slim, q, mid);
+        lfl_find(slim, q, last, id, 5);
+        lfl_delete(slim, q, last);
+        cr_expect_eq(lfl_get_tail(q)->id, 4, "tail not moved back to the predecessor");
+
+        lfl_find(slim, q, two, id, 2);
+        lfl_remove(slim, q, two);
+        lfl_sweep(slim, q, refcount, NULL);
+
+        lfl_pop_tail(slim, q, item);
+        cr_assert_not_null(item);
+        cr_expect_eq(item->id, 4);
+        lfl_node_free(slim, item);
+        for (;;) {
+                item = NULL;
+                lfl_pop_head(slim, q, item);
+                if (!item)
+                        break;
+                ids[n++] = item->id;
+                lfl_node_free(slim, item);
+        }
+        cr_assert_eq(n, 2, "expected 2 nodes left, got %d", n);
+        cr_expect_eq(ids[0], 0);
+        cr_expect_eq(ids[1], 1);
+
+        struct lfl_stats *st = lfl_stats(slim);
+        cr_expect_eq(atomic_load(&st->adds), 6);
+        cr_expect_eq(atomic_load(&st->removes), 1);
+        cr_expect_eq(atomic_load(&st->reclaimed), 1);
+        cr_expect_eq(atomic_load(&st->pops), 3);
+}
+
+Test(lfl_flavor, padded_nodes_own_a_cache_line)
+{
+        lfl_vars(padded, list);
+        lfl_init(padded, list);
+
+        cr_assert_eq(sizeof(lfl_type(padded)) % 64, 0, "padded node size %zu", sizeof(lfl_type(padded)));
+        for (int i = 0; i < 4; i++) {
+                lfl_add_tail(padded, list, node);
+                node->id = i;
+                cr_assert_eq((uintptr_t)node % 64, 0, "node %d not line aligned", i);
+        }
+        cr_expect_eq(atomic_load(&lfl_stats(padded)->adds), 0, "stats kept without LFL_STATS");
+        lfl_clear(padded, list);
+}
+
+Test(lfl_flavor, default_layout_is_unchanged)
+{
+        cr_expect_eq(offsetof(test_t, next), 0);
+        cr_expect_eq(offsetof(test_t, nextc), sizeof(void *));
+        cr_expect_eq(offsetof(test_t, prev), 2 * sizeof(void *));
+        cr_expect_eq(offsetof(test_t, prevc), 3 * sizeof(void *));
+        cr_expect_eq(offsetof(test_t, removed), 4 * sizeof(void *));
+        cr_expect_eq(offsetof(test_t, refcount), 4 * sizeof(void *) + sizeof(int));
+}
+
+Test(lfl_flavor, block_scope_type_without_state)
+{
+        lfl_def_ex(local, LFL_STATS)
+                int id;
+        lfl_end
+        lfl_vars(local, list);
+        lfl_init(local, list);
+        size_t count = 0;
+
+        cr_expect_null(lfl_stats(local));
+        cr_expect_eq(lfl_arena_bind(local, NULL), -1);
+        cr_expect_eq(lfl_arena_bind(test, NULL), 0);
+        for (int i = 0; i < 3; i++) {
+                lfl_add_tail(local, list, node);
+                node->id = i;
+        }
+        lfl_type(local) *first = NULL;
+        lfl_pop_head(local, list, first);
+        cr_assert_not_null(first);
+        cr_expect_eq(first->id, 0);
+        lfl_node_free(local, first);
+        lfl_count(local, list, count);
+        cr_expect_eq(count, 2);
+        lfl_clear(local, list);
+}
+
+lfl_impl(test)
+
+Test(lfl_impl, generated_functions_match_macros)
+{
+        lfl_vars(test, list);
+        lfl_init(test, list);
+        test_t *batch = NULL;
+
+        for (int i = 0; i < 6; i++) {
+                test_t *n = lfl_new(test);
+                n->id = i;
+                test_add_tail(lfl_inst(list), n);
+        }
+        test_t *h = lfl_new(test);
+        h->id = -1;
+        test_add_head(lfl_inst(list), h);
+        cr_expect_eq(test_count(lfl_inst(list)), 7);
+
+        test_t *first = test_pop_head(lfl_inst(list));
+        cr_assert_not_null(first);
+        cr_expect_eq(first->id, -1);
+        lfl_node_free(test, first);
+
+        test_t *last = test_pop_tail(lfl_inst(list));
+        cr_assert_not_null(last);
+        cr_expect_eq(last->id, 5);
+        lfl_node_free(test, last);
+
+        lfl_find(test, list, two, id, 2);
+        test_remove(lfl_inst(list), two);
+        cr_expect_eq(test_count(lfl_inst(list)), 4);
+        test_sweep(lfl_inst(list), NULL);
+
+        size_t n = test_pop_head_n(lfl_inst(list), &batch, 2);
+        cr_assert_eq(n, 2);
+        cr_expect_eq(batch->id, 0);
+        cr_expect_eq(atomic_load(&batch->next)->id, 1);
+        test_t *second = atomic_load(&batch->next);
+        lfl_node_free(test, batch);
+        lfl_node_free(test, second);
+
+        cr_expect_eq(test_count(lfl_inst(list)), 2);
+        cr_expect_eq(lfl_get_head(list)->id, 3);
+        test_clear(lfl_inst(list));
+        cr_expect_null(lfl_get_head(list));
+        cr_expect_null(test_pop_head(lfl_inst(list)));
+}
+
+struct counting_heap {
+        _Atomic(long) allocs;
+        _Atomic(long) frees;
+};
+
+static void *counting_alloc(void *ctx, size_t size, size_t align)
+{
+        atomic_fetch_add(&((struct counting_heap *)ctx)->allocs, 1);
+        return lfl__default_alloc(size, align);
+}
+
+static void counting_free(void *ctx, void *p)
+{
+        atomic_fetch_add(&((struct counting_heap *)ctx)->frees, 1);
+        free(p);
+}
+
+lfl_def(hooked)
+        int id;
+lfl_end
+lfl_state(hooked);
+
+Test(lfl_alloc, bound_hooks_serve_every_node_path)
+{
+        struct counting_heap heap = { 0 };
+        const struct lfl_allocator hooks = { counting_alloc, counting_free, &heap };
+        lfl_vars(hooked, list);
+        lfl_init(hooked, list);
+
+        lfl_allocator_bind(hooked, &hooks);
+        for (int i = 0; i < 10; i++) {
+                lfl_add_tail(hooked, list, node);
+                node->id = i;
+        }
+        lfl_add_head(hooked, list, h);
+        h->id = -1;
+        cr_expect_eq(atomic_load(&heap.allocs), 11);
+
+        lfl_delete(hooked, list, h);
+        lfl_foreach(hooked, list, item) {
+                if (item->id % 2)
+                        lfl_remove(hooked, list, item);
+        }
+        lfl_sweep(hooked, list, refcount, NULL);
+        cr_expect_eq(atomic_load(&heap.frees), 6);
+
+        lfl_clear(hooked, list);
+        cr_expect_eq(atomic_load(&heap.frees), 11, "clear did not return nodes to the hooks");
+        lfl_allocator_bind(hooked, NULL);
+}
+
+Test(lfl_percpu, lifo_and_pool_reuse)
+{
+        struct lfl_percpu pc;
+        test_t *item = NULL;
+
+        cr_assert_eq(lfl_percpu_init(&pc), 0);
+        for (int i = 0; i < 5; i++) {
+                lfl_percpu_add_head(test, pc, node);
+                node->id = i;
+        }
+        for (int i = 4; i >= 0; i--) {
+                lfl_percpu_pop_head(test, pc, item);
+                cr_assert_not_null(item);
+                cr_expect_eq(item->id, i, "per-cpu list is LIFO");
+                if (i)
+                        lfl_percpu_free(test, pc, item);
+        }
+        lfl_percpu_pop_head(test, pc, item);
+        cr_expect_null(item);
+
+        test_t *last = lfl_percpu_new(test, pc);
+        if (pc.rseq)
+                cr_expect_eq(last->id, 0, "pooled node not zeroed");
+        lfl_node_free(test, last);
+        lfl_percpu_destroy(test, pc);
+}
+
+static struct lfl_percpu percpu_q;
+
+static void *percpu_worker(void *arg)
+{
+        long *seen = arg;
+        test_t *item = NULL;
+
+        for (int i = 0; i < 50000; i++) {
+                test_t *node = lfl_percpu_new(test, percpu_q);
+                node->id = 1;
+                lfl_percpu_add_head_ptr(test, percpu_q, node);
+                lfl_percpu_pop_head(test, percpu_q, item);
+                if (!item)
+                        continue;
+                *seen += item->id;
+                /* the CAS fallback frees to the heap at once: pops must never read a freed node */
+                lfl_percpu_free(test, percpu_q, item);
+        }
+        return NULL;
+}
+
+Test(lfl_percpu, concurrent_rseq_and_cas_modes_lose_nothing)
+{
+        for (int mode = 0; mode < 2; mode++) {
+                long seen[4] = { 0 };
+                pthread_t threads[4];
+                test_t *item = NULL;
+                long total = 0;
+
+                cr_assert_eq(lfl_percpu_init(&percpu_q), 0);
+                if (mode == 1)
+                        percpu_q.rseq = 0;
+                for (int t = 0; t < 4; t++)
+                        pthread_create(&threads[t], NULL, percpu_worker, &seen[t]);
+                for (int t = 0; t < 4; t++) {
+                        pthread_join(threads[t], NULL);
+                        total += seen[t];
+                }
+                for (;;) {
+                        lfl_percpu_pop_head(test, percpu_q, item);
+                        if (!item)
+                                break;
+                        total += item->id;
+                        lfl_node_free(test, item);
+                }
+                cr_assert_eq(total, 4 * 50000, "mode %d: %ld of %d nodes came back", mode, total, 4 * 50000);
+                lfl_percpu_destroy(test, percpu_q);
+        }
+}
+
+#if LFL_HAVE_RSEQ
+static _Atomic(int) percpu_storm_stop;
+
+static void percpu_storm_noop(int sig)
+{
+        (void)sig;
+}
+
+static void *percpu_storm(void *arg)
+{
+        pthread_t target = *(pthread_t *)arg;
+
+        while (!atomic_load(&percpu_storm_stop)) {
+                pthread_kill(target, SIGURG);
+                sched_yield();
+        }
+        return NULL;
+}
+
+Test(lfl_percpu, aborted_pops_never_hand_out_a_node)
+{
+        enum { N = 20000 };
+        static char seen[N];
+        struct sigaction sa = { .sa_handler = percpu_storm_noop };
+        struct lfl_percpu pc;
+        pthread_t self = pthread_self(), storm;
+        long aborts = 0, popped = 0;
+
+        cr_assert_eq(lfl_percpu_init(&pc), 0);
+        if (!pc.rseq) {
+                lfl_percpu_destroy(test, pc);
+                return;
+        }
+        sigaction(SIGURG, &sa, NULL);
+        atomic_store(&percpu_storm_stop, 0);
+        pthread_create(&storm, NULL, percpu_storm, &self);
+        for (int i = 0; i < N; i++) {
+                lfl_percpu_add_head(test, pc, node);
+                cr_assert_not_null(node);
+                node->id = i;
+        }
+        /* drive the primitive directly: an aborted attempt must leave out alone */
+        while (popped < N / 2) {
+                int cpu = lfl__rseq_cpu();
+                void *out = &seen;
+                int ret = lfl__rseq_pop(&pc.slot[cpu].list, offsetof(test_t, next), &out, cpu);
+                if (ret < 0) {
+                        cr_assert_eq(out, (void *)&seen);
+                        aborts++;
+                        continue;
+                }
+                if (ret > 0)
+                        break;
+                test_t *item = out;
+                cr_assert_eq(seen[item->id]++, 0, "node %d popped twice", item->id);
+                lfl_node_free(test, item);
+                popped++;
+        }
+        for (;;) {
+                test_t *item;
+                lfl_percpu_pop_head(test, pc, item);
+                if (!item)
+                        break;
+                cr_assert_eq(seen[item->id]++, 0, "node %d popped twice", item->id);
+                lfl_node_free(test, item);
+                popped++;
+        }
+        atomic_store(&percpu_storm_stop, 1);
+        pthread_join(storm, NULL);
+        signal(SIGURG, SIG_DFL);
+        cr_assert_eq(popped, N, "%ld of %d nodes came back (%ld aborts)", popped, N, aborts);
+        lfl_percpu_destroy(test, pc);
+}
+#endif /* LFL_HAVE_RSEQ */
+
+static struct lfl_rcu rcu_dom;
+lfl_vars_static(test, rcu_list);
+static _Atomic(int) rcu_stop;
+
+static void *rcu_reader(void *arg)
+{
+        _Atomic(long) *walks = arg;
+
+        while (!atomic_load(&rcu_stop)) {
+                long sum = 0;
+                lfl_rcu_read_lock(&rcu_dom);
+                {
+                        lfl_foreach(test, rcu_list, item) {
+                                sum += item->id;
+                        }
+                }
+                lfl_rcu_read_unlock(&rcu_dom);
+                atomic_fetch_add(walks, sum >= 0);
+        }
+        return NULL;
+}
+
+Test(lfl_rcu, sweep_frees_nodes_under_unreferenced_readers)
+{
+        pthread_t threads[3];
+        _Atomic(long) walks[3] = { 0 };
+
+        cr_assert_eq(lfl_rcu_init(&rcu_dom), 0);
+        lfl_init(test, rcu_list);
+        atomic_store(&rcu_stop, 0);
+        for (int i = 0; i < 64; i++) {
+                lfl_add_tail(test, rcu_list, node);
+                node->id = i;
+        }
+        for (int t = 0; t < 3; t++)
+                pthread_create(&threads[t], NULL, rcu_reader, &walks[t]);
+        /* churn: every removed node is freed while readers may stand on it */
+        for (int round = 0; round < 2000; round++) {
+                int n = 0, dropped = 0;
+                {
+                        lfl_foreach(test, rcu_list, item) {
+                                if (n++ % 3 == round % 3) {
+                                        lfl_remove(test, rcu_list, item);
+                                        dropped++;
+                                }
+                        }
+                }
+                cr_assert_eq(lfl_rcu_sweep(test, rcu_list, refcount, rcu_dom, NULL), 0);
+                while (dropped--) {
+                        lfl_add_tail(test, rcu_list, node);
+                        node->id = round;
+                }
+        }
+        /* on a loaded machine the churn can finish before a reader runs */
+        for (int t = 0; t < 3; t++)
+                while (!atomic_load(&walks[t]))
+                        sched_yield();
+        atomic_store(&rcu_stop, 1);
+        for (int t = 0; t < 3; t++)
+                pthread_join(threads[t], NULL);
+        lfl_clear(test, rcu_list);
+        lfl_rcu_destroy(&rcu_dom);
+}
+
+static _Atomic(int) rcu_in_section;
+static _Atomic(int) rcu_leave;
+
+static void *rcu_holder(void *arg)
+{
+        (void)arg;
+        lfl_rcu_read_lock(&rcu_dom);
+        lfl_rcu_read_lock(&rcu_dom);
+        lfl_rcu_read_unlock(&rcu_dom);
+        atomic_store(&rcu_in_section, 1);
+        while (!atomic_load(&rcu_leave))
+                usleep(100);
+        lfl_rcu_read_unlock(&rcu_dom);
+        return NULL;
+}
+
+static void *rcu_syncer(void *arg)
+{
+        lfl_rcu_synchronize(&rcu_dom);
+        atomic_store((_Atomic(int) *)arg, 1);
+        return NULL;
+}
+
+Test(lfl_rcu, synchronize_waits_for_nested_read_section)
+{
+        pthread_t holder, syncer;
+        _Atomic(int) synced = 0;
+
+        cr_assert_eq(lfl_rcu_init(&rcu_dom), 0);
+        atomic_store(&rcu_in_section, 0);
+        atomic_store(&rcu_leave, 0);
+        pthread_create(&holder, NULL, rcu_holder, NULL);
+        while (!atomic_load(&rcu_in_section))
+                usleep(100);
+        pthread_create(&syncer, NULL, rcu_syncer, &synced);
+        usleep(20000);
+        cr_expect_eq(atomic_load(&synced), 0, "grace period ended inside a read section");
+        atomic_store(&rcu_leave, 1);
+        pthread_join(syncer, NULL);
+        pthread_join(holder, NULL);
+        cr_expect_eq(atomic_load(&synced), 1);
+        lfl_rcu_destroy(&rcu_dom);
+}
+
+/* a flavor that keeps its own pin count in place of refcount */
+lfl_def_ex(pinned, LFL_NO_REFCOUNT)
+        _Atomic(int) pins;
+        int id;
+lfl_end
+
+Test(lfl_rcu, sweep_honours_a_custom_reference_field)
+{
+        struct lfl_rcu dom;
+        lfl_type(pinned) *held = NULL;
+        int left = 0;
+        lfl_vars(pinned, list);
+
+        cr_assert_eq(lfl_rcu_init(&dom), 0);
+        lfl_init(pinned, list);
+        for (int i = 0; i < 16; i++) {
+                lfl_add_tail(pinned, list, node);
+                node->id = i;
+                if (i == 5)
+                        held = node;
+        }
+        atomic_store(&held->pins, 1);
+        {
+                lfl_foreach(pinned, list, item) {
+                        lfl_remove(pinned, list, item);
+                }
+        }
+        cr_assert_eq(lfl_rcu_sweep(pinned, list, pins, dom, NULL), 0);
+        for (lfl_type(pinned) *n = lfl_get_head(list); n; n = lfl_get_next(n))
+                left++;
+        cr_expect_eq(left, 1, "pinned node was swept");
+        cr_expect_eq(lfl_get_head(list), held);
+        atomic_store(&held->pins, 0);
+        cr_assert_eq(lfl_rcu_sweep(pinned, list, pins, dom, NULL), 0);
+        cr_expect_null(lfl_get_head(list));
+        lfl_rcu_destroy(&dom);
+}
+
+lfl_vars_static(test, cursor_list);
+static _Atomic(int) cursor_stop;
+
+struct cursor_run {
+        _Atomic(long) walks;
+        _Atomic(long) bad;
+};
+
+/* scan with a cursor that pauses on every node while the list is swept underneath */
+static void *cursor_walker(void *arg)
+{
+        struct cursor_run *run = arg;
+
+        while (!atomic_load(&cursor_stop)) {
+                lfl_cursor cur;
+                test_t *n;
+                int last = -1;
+
+                lfl_rcu_cursor_init(test, cursor_list, cur, rcu_dom);
+                while ((n = lfl_cursor_next(test, cur)) != NULL) {
+                        int id = n->id;
+                        sched_yield();
+                        if (n->id != id || id <= last || atomic_load(&n->refcount) < 1)
+                                atomic_fetch_add(&run->bad, 1);
+                        last = id;
+                }
+                lfl_cursor_close(cur);
+                atomic_fetch_add(&run->walks, 1);
+        }
+        return NULL;
+}
+
+Test(lfl_cursor, pinned_node_survives_a_concurrent_sweep)
+{
+        pthread_t threads[2];
+        struct cursor_run runs[2] = { 0 };
+        int next_id = 0, pending = -1;
+
+        cr_assert_eq(lfl_rcu_init(&rcu_dom), 0);
+        lfl_init(test, cursor_list);
+        atomic_store(&cursor_stop, 0);
+        for (; next_id < 128; next_id++) {
+                lfl_add_tail(test, cursor_list, node);
+                node->id = next_id;
+        }
+        for (int t = 0; t < 2; t++)
+                pthread_create(&threads[t], NULL, cursor_walker, &runs[t]);
+        /* remove a third of the list each round, including nodes a cursor is paused on */
+        for (int round = 0; round < 3000; round++) {
+                int n = 0, dropped = 0;
+                {
+                        lfl_foreach(test, cursor_list, item) {
+                                if (n++ % 3 == round % 3) {
+                                        lfl_remove(test, cursor_list, item);
+                                        dropped++;
+                                }
+                        }
+                }
+                cr_assert_eq(lfl_rcu_sweep(test, cursor_list, refcount, rcu_dom, NULL), 0);
+                while (dropped--) {
+                        lfl_add_tail_init(test, cursor_list, node, { node->id = next_id++; });
+                }
+                sched_yield();
+        }
+        for (int t = 0; t < 2; t++)
+                while (!atomic_load(&runs[t].walks))
+                        sched_yield();
+        atomic_store(&cursor_stop, 1);
+        for (int t = 0; t < 2; t++) {
+                pthread_join(threads[t], NULL);
+                cr_expect_eq(atomic_load(&runs[t].bad), 0, "walker %d saw %ld bad steps", t,
+                             atomic_load(&runs[t].bad));
+        }
+        /* every pin was released and nothing stays claimed */
+        cr_assert_eq(lfl_rcu_sweep(test, cursor_list, refcount, rcu_dom, NULL), 0);
+        lfl_count_pending_cleanup(test, cursor_list, refcount, pending);
+        cr_expect_eq(pending, 0);
+        for (test_t *c = lfl_get_head(cursor_list); c; c = lfl_get_next(c))
+                cr_expect_eq(atomic_load(&c->refcount), 0, "node %d refcount %d", c->id, atomic_load(&c->refcount));
+        lfl_clear(test, cursor_list);
+        lfl_rcu_destroy(&rcu_dom);
+}
+
+Test(lfl_help, custom_reference_field_keeps_pinned_nodes)
+{
+        struct lfl_rcu dom;
+        lfl_type(pinned) *held = NULL;
+        int visited = 0, chained = 0;
+        lfl_vars(pinned, list);
+
+        cr_assert_eq(lfl_rcu_init(&dom), 0);
+        lfl_init(pinned, list);
+        for (int i = 0; i < 10; i++) {
+                lfl_add_tail(pinned, list, node);
+                node->id = i;
+                if (i == 4)
+                        held = node;
+        }
+        atomic_store(&held->pins, 1);
+        {
+                lfl_foreach(pinned, list, item) {
+                        if (item->id < 5)
+                                lfl_remove(pinned, list, item);
+                }
+        }
+        cr_assert_eq(lfl_rcu_read_lock(&dom), 0);
+        {
+                lfl_foreach_help(pinned, list, pins, dom, item) {
+                        visited++;
+                }
+        }
+        lfl_rcu_read_unlock(&dom);
+        cr_expect_eq(visited, 5);
+        for (lfl_type(pinned) *n = lfl_get_head(list); n; n = lfl_get_next(n))
+                chained++;
+        cr_expect_eq(chained, 6, "helping unlinked a pinned node or missed the rest");
+        cr_expect_eq(lfl_get_head(list), held);
+        cr_expect_eq(lfl_rcu_reclaim(&dom), 4);
+        atomic_store(&held->pins, 0);
+        lfl_clear(pinned, list);
+        lfl_rcu_destroy(&dom);
+}
+
+lfl_impl_ex(pinned, pins)
+
+Test(lfl_impl, sweep_uses_the_named_reference_field)
+{
+        lfl_type(pinned) *held = NULL;
+        lfl_vars(pinned, list);
+
+        lfl_init(pinned, list);
+        for (int i = 0; i < 8; i++) {
+                lfl_type(pinned) *n = lfl_new(pinned);
+                n->id = i;
+                pinned_add_tail(lfl_inst(list), n);
+                if (i == 2)
+                        held = n;
+        }
+        atomic_store(&held->pins, 1);
+        {
+                lfl_foreach(pinned, list, item) {
+                        pinned_remove(lfl_inst(list), item);
+                }
+        }
+        pinned_sweep(lfl_inst(list), NULL);
+        cr_expect_eq(pinned_count(lfl_inst(list)), 0);
+        cr_expect_eq(lfl_get_head(list), held, "pinned node was swept");
+        cr_expect_null(lfl_get_next(held));
+        atomic_store(&held->pins, 0);
+        pinned_sweep(lfl_inst(list), NULL);
+        cr_expect_null(lfl_get_head(list));
+}
+
+static int pinned_even(lfl_type(pinned) *item, void *ctx)
+{
+        (void)ctx;
+        return item->id % 2 == 0;
+}
+
+Test(lfl_lockfree, remove_if_honours_a_custom_reference_field)
+{
+        lfl_type(pinned) *held = NULL;
+        int chained = 0;
+        lfl_vars(pinned, list);
+
+        lfl_init(pinned, list);
+        for (int i = 0; i < 20; i++) {
+                lfl_add_tail(pinned, list, node);
+                node->id = i;
+                if (i == 6)
+                        held = node;
+        }
+        atomic_store(&held->pins, 1);
+        cr_expect_eq(lfl_remove_if(pinned, list, pins, pinned_even, NULL, NULL), 10);
+        for (lfl_type(pinned) *n = lfl_get_head(list); n; n = lfl_get_next(n)) {
+                cr_expect(n->id % 2 == 1 || n == held, "node %d should be gone", n->id);
+                chained++;
+        }
+        cr_expect_eq(chained, 11, "pinned node was unlinked");
+        atomic_store(&held->pins, 0);
+        lfl_clear(pinned, list);
+}
+
+/* every node still chained, removed or not */
+static int chained_nodes(test_t *n, int *removed)
+{
+        int total = 0;
+
+        *removed = 0;
+        for (; n; n = atomic_load(&n->next), total++)
+                *removed += atomic_load(&n->removed);
+        return total;
+}
+
+Test(lfl_help, traversal_unlinks_tombstones_it_passes)
+{
+        struct lfl_rcu dom;
+        int visited = 0, removed;
+        lfl_vars(test, list);
+
+        cr_assert_eq(lfl_rcu_init(&dom), 0);
+        lfl_init(test, list);
+        for (int i = 0; i < 100; i++) {
+                lfl_add_tail(test, list, node);
+                node->id = i;
+        }
+        {
+                lfl_foreach(test, list, item) {
+                        if (item->id % 2 == 0 || item->id == 99)
+                                lfl_remove(test, list, item);
+                }
+        }
+        lfl_rcu_read_lock(&dom);
+        {
+                lfl_foreach_help(test, list, refcount, dom, item) {
+                        cr_expect_eq(item->id % 2, 1);
+                        visited++;
+                }
+        }
+        lfl_rcu_read_unlock(&dom);
+        cr_expect_eq(visited, 49);
+        /* the removed tail stays for appenders */
+        cr_expect_eq(chained_nodes(atomic_load(&list_head), &removed), 50);
+        cr_expect_eq(removed, 1);
+        cr_expect_eq(atomic_load(&atomic_load(&list_head)->prev), NULL, "prev links not repaired");
+        cr_expect_eq(lfl_rcu_reclaim(&dom), 50);
+        cr_expect_eq(lfl_rcu_reclaim(&dom), 0);
+        lfl_clear(test, list);
+        lfl_rcu_destroy(&dom);
+}
+
+static struct lfl_rcu help_dom;
+lfl_vars_static(test, help_list);
+static _Atomic(int) help_stop;
+
+static void *help_walker(void *arg)
+{
+        (void)arg;
+        while (!atomic_load(&help_stop)) {
+                lfl_rcu_read_lock(&help_dom);
+                {
+                        lfl_foreach_help(test, help_list, refcount, help_dom, item) {
+                                cr_assert_geq(item->id, 0, "walked into a freed node");
+                        }
+                }
+                lfl_rcu_read_unlock(&help_dom);
+        }
+        return NULL;
+}
+
+Test(lfl_help, concurrent_helpers_keep_live_nodes)
+{
+        pthread_t threads[3];
+        int removed, live = 0;
+
+        cr_assert_eq(lfl_rcu_init(&help_dom), 0);
+        lfl_init(test, help_list);
+        atomic_store(&help_stop, 0);
+        for (int i = 0; i < 256; i++) {
+                lfl_add_tail(test, help_list, node);
+                node->id = i;
+        }
+        for (int t = 0; t < 3; t++)
+                pthread_create(&threads[t], NULL, help_walker, NULL);
+        for (int round = 0; round < 3000; round++) {
+                int n = 0, dropped = 0;
+                lfl_rcu_read_lock(&help_dom);
+                {
+                        lfl_foreach(test, help_list, item) {
+                                if (n++ % 7 == round % 7) {
+                                        lfl_remove(test, help_list, item);
+                                        dropped++;
+                                }
+                        }
+                }
+                lfl_rcu_read_unlock(&help_dom);
+                while (dropped--) {
+                        test_t *node = lfl_new(test);
+                        node->id = round;
+                        lfl_add_tail_ptr(test, help_list, node);
+                }
+                if (round % 16 == 0)
+                        lfl_rcu_reclaim(&help_dom);
+        }
+        atomic_store(&help_stop, 1);
+        for (int t = 0; t < 3; t++)
+                pthread_join(threads[t], NULL);
+        lfl_rcu_read_lock(&help_dom);
+        {
+                lfl_foreach_help(test, help_list, refcount, help_dom, item) {
+                        live++;
+                }
+        }
+        lfl_rcu_read_unlock(&help_dom);
+        cr_expect_eq(live, 256, "live nodes lost or duplicated");
+        cr_expect_eq(chained_nodes(atomic_load(&help_list_head), &removed), 256 + removed);
+        cr_expect_leq(removed, 1, "tombstones left behind");
+        lfl_rcu_reclaim(&help_dom);
+        lfl_clear(test, help_list);
+        lfl_rcu_destroy(&help_dom);
+}
+
+Test(lfl_help, skips_while_another_unlinker_holds_the_list)
+{
+        struct lfl_rcu dom;
+        int removed = 0;
+
+        lfl_vars(test, list);
+        cr_assert_eq(lfl_rcu_init(&dom), 0);
+        lfl_init(test, list);
+        for (int i = 0; i < 8; i++) {
+                lfl_add_tail(test, list, node);
+                node->id = i;
+                if (i % 2)
+                        lfl_remove(test, list, node);
+        }
+        /* a sweep in progress elsewhere holds the token */
+        atomic_store(&list_unlinker, 1);
+        cr_assert_eq(lfl_rcu_read_lock(&dom), 0);
+        {
+                lfl_foreach_help(test, list, refcount, dom, item) {
+                        (void)item;
+                }
+        }
+        lfl_rcu_read_unlock(&dom);
+        cr_expect_eq(chained_nodes(atomic_load(&list_head), &removed), 8, "helped while the list was held");
+        atomic_store(&list_unlinker, 0);
+        cr_assert_eq(lfl_rcu_read_lock(&dom), 0);
+        {
+                lfl_foreach_help(test, list, refcount, dom, item) {
+                        (void)item;
+                }
+        }
+        lfl_rcu_read_unlock(&dom);
+        /* the removed last node stays for appenders */
+        cr_expect_eq(chained_nodes(atomic_load(&list_head), &removed), 5);
+        cr_expect_eq(removed, 1);
+        cr_expect_eq(lfl_rcu_reclaim(&dom), 3);
+        lfl_clear(test, list);
+        lfl_rcu_destroy(&dom);
+}
+
+static int id_odd(test_t *item, void *ctx)
+{
+        (void)ctx;
+        return item->id % 2;
+}
+
+Test(lfl_help, helpers_and_rcu_sweeps_share_a_list)
+{
+        pthread_t threads[2];
+        int removed, live = 0, next_id = 0;
+
+        cr_assert_eq(lfl_rcu_init(&help_dom), 0);
+        lfl_init(test, help_list);
+        atomic_store(&help_stop, 0);
+        for (; next_id < 256; next_id += 2) {
+                lfl_add_tail_init(test, help_list, node, { node->id = next_id; });
+        }
+        for (int t = 0; t < 2; t++)
+                pthread_create(&threads[t], NULL, help_walker, NULL);
+        /* helpers, sweeps and remove_if (of odd ids) all unlink from the one list */
+        for (int round = 0; round < 2000; round++) {
+                int n = 0;
+                lfl_rcu_read_lock(&help_dom);
+                {
+                        lfl_foreach(test, help_list, item) {
+                                if (n++ % 5 == round % 5)
+                                        lfl_remove(test, help_list, item);
+                        }
+                }
+                lfl_rcu_read_unlock(&help_dom);
+                for (int i = 0; i < 8; i++) {
+                        int id = next_id++;
+                        lfl_add_tail_init(test, help_list, node, { node->id = id; });
+                }
+                if (round % 3 == 0)
+                        cr_assert_eq(lfl_rcu_sweep(test, help_list, refcount, help_dom, NULL), 0);
+                else if (round % 3 == 1)
+                        lfl_rcu_remove_if(test, help_list, refcount, help_dom, id_odd, NULL, NULL);
+                else
+                        lfl_rcu_reclaim(&help_dom);
+        }
+        atomic_store(&help_stop, 1);
+        for (int t = 0; t < 2; t++)
+                pthread_join(threads[t], NULL);
+        cr_assert_eq(lfl_rcu_sweep(test, help_list, refcount, help_dom, NULL), 0);
+        lfl_rcu_read_lock(&help_dom);
+        {
+                lfl_foreach(test, help_list, item) {
+                        live++;
+                }
+        }
+        lfl_rcu_read_unlock(&help_dom);
+        cr_expect_eq(chained_nodes(atomic_load(&help_list_head), &removed), live + removed);
+        cr_expect_leq(removed, 1, "tombstones left behind");
+        lfl_rcu_reclaim(&help_dom);
+        lfl_clear(test, help_list);
+        lfl_rcu_destroy(&help_dom);
+}
+
+lfl_vars_static(test, reclaim_list);
+static _Atomic(int) reclaim_cleaned;
+static struct lfl_reclaim_watch *reclaim_watch;
+
+static void reclaim_cleanup(test_t *node)
+{
+        (void)node;
+        atomic_fetch_add(&reclaim_cleaned, 1);
+}
+
+/* remove every live node with id below limit */
+static void reclaim_remove_below(int limit)
+{
+        lfl_foreach(test, reclaim_list, item) {
+                if (item->id < limit)
+                        lfl_reclaimer_remove(test, reclaim_list, reclaim_watch, item);
+        }
+}
+
+Test(lfl_reclaim, thresholds_and_budget_drive_polled_sweeps)
+{
+        struct lfl_reclaimer rec;
+        size_t count = 0;
+
+        lfl_reclaimer_init(&rec, 25, 0, 0);
+        lfl_init(test, reclaim_list);
+        atomic_store(&reclaim_cleaned, 0);
+        reclaim_watch = lfl_reclaimer_watch(test, reclaim_list, rec, reclaim_cleanup);
+        cr_assert_not_null(reclaim_watch);
+        for (int i = 0; i < 1000; i++) {
+                lfl_add_tail(test, reclaim_list, node);
+                node->id = i;
+        }
+        reclaim_remove_below(30);
+        cr_expect_eq(lfl_reclaimer_poll(&rec), 0, "below LFL_RECLAIM_MIN");
+        reclaim_remove_below(100);
+        cr_expect_eq(lfl_reclaimer_poll(&rec), 100, "length unknown: any pile is due");
+
+        /* the sweep measured 900 nodes: 150 removes are under 25%, 300 reach it */
+        reclaim_remove_below(250);
+        cr_expect_eq(lfl_reclaimer_poll(&rec), 0, "swept below the ratio");
+        reclaim_remove_below(400);
+        cr_expect_eq(lfl_reclaimer_poll(&rec), 300);
+
+        /* absolute trigger with a per-pass budget */
+        rec.max_garbage = 64;
+        rec.budget = 50;
+        reclaim_remove_below(500);
+        cr_expect_eq(lfl_reclaimer_poll(&rec), 50);
+        cr_expect_eq(lfl_reclaimer_poll(&rec), 50);
+        cr_expect_eq(lfl_reclaimer_poll(&rec), 0);
+
+        lfl_count(test, reclaim_list, count);
+        cr_expect_eq(count, 500);
+        cr_expect_eq(lfl_get_head(reclaim_list)->id, 500);
+        cr_expect_eq(atomic_load(&reclaim_cleaned), 500);
+        cr_expect_eq(atomic_load(&rec.reclaimed), 500);
+
+        /* plain removes are invisible to the reclaimer */
+        lfl_foreach(test, reclaim_list, item) {
+                if (item->id < 600)
+                        lfl_remove(test, reclaim_list, item);
+        }
+        cr_expect_eq(atomic_load(&reclaim_watch->garbage), 0);
+        cr_expect_eq(lfl_reclaimer_poll(&rec), 0);
+        lfl_clear(test, reclaim_list);
+}
+
+lfl_vars_static(test, reclaim_bg);
+static test_t *reclaim_window[100];
+
+Test(lfl_reclaim, background_thread_keeps_garbage_bounded)
+{
+        struct lfl_reclaimer rec;
+        size_t count = 0;
+        struct lfl_reclaim_watch *w;
+        int removed;
+
+        lfl_reclaimer_init(&rec, 0, 64, 0);
+        rec.interval_us = 200;
+        lfl_init(test, reclaim_bg);
+        w = lfl_reclaimer_watch(test, reclaim_bg, rec, NULL);
+        cr_assert_not_null(w);
+        cr_assert_eq(lfl_reclaimer_start(&rec), 0);
+        /* sliding window: retire the node added 100 adds ago */
+        for (int i = 0; i < 20000; i++) {
+                lfl_add_tail(test, reclaim_bg, node);
+                node->id = i;
+                if (i >= 100)
+                        lfl_reclaimer_remove(test, reclaim_bg, w, reclaim_window[i % 100]);
+                reclaim_window[i % 100] = node;
+        }
+        for (int tries = 0; tries < 1000 && atomic_load(&rec.reclaimed) < 19900 - 64; tries++)
+                usleep(1000);
+        lfl_reclaimer_stop(&rec);
+        lfl_count(test, reclaim_bg, count);
+        cr_expect_eq(count, 100);
+        cr_expect_eq(chained_nodes(lfl_get_head(reclaim_bg), &removed), 100 + removed);
+        cr_expect_lt(removed, 64, "%d tombstones left behind", removed);
+        cr_expect_gt(atomic_load(&rec.sweeps), 0);
+        lfl_clear(test, reclaim_bg);
+}
+
+lfl_vars_static(test, reclaim_a);
+lfl_vars_static(test, reclaim_b);
+
+static int reclaim_below_8(test_t *item, void *ctx)
+{
+        (void)ctx;
+        return item->id < 8;
+}
+
+Test(lfl_reclaim, every_list_counts_its_own_garbage)
+{
+        struct lfl_reclaimer rec;
+        struct lfl_reclaim_watch *wa, *wb;
+        test_t *a[20], *pin = NULL;
+
+        lfl_reclaimer_init(&rec, 0, 10, 0);
+        lfl_init(test, reclaim_a);
+        lfl_init(test, reclaim_b);
+        wa = lfl_reclaimer_watch(test, reclaim_a, rec, NULL);
+        wb = lfl_reclaimer_watch(test, reclaim_b, rec, NULL);
+        cr_assert(wa && wb);
+        for (int i = 0; i < 20; i++) {
+                lfl_add_tail(test, reclaim_a, na);
+                na->id = i;
+                a[i] = na;
+                lfl_add_tail(test, reclaim_b, nb);
+                nb->id = i;
+                if (i == 3)
+                        pin = nb;
+        }
+        for (int i = 0; i < 5; i++)
+                lfl_reclaimer_remove(test, reclaim_a, wa, a[i]);
+        /* remove_if unlinks what it can at once; only the pinned match is left as garbage */
+        atomic_store(&pin->refcount, 1);
+        cr_expect_eq(lfl_reclaimer_remove_if(test, reclaim_b, refcount, wb, reclaim_below_8, NULL, NULL), 8);
+        cr_expect_eq(atomic_load(&wa->garbage), 5);
+        cr_expect_eq(atomic_load(&wb->garbage), 1);
+
+        cr_expect_eq(lfl_reclaimer_poll(&rec), 0, "neither list reached max_garbage");
+        for (int i = 5; i < 10; i++)
+                lfl_reclaimer_remove(test, reclaim_a, wa, a[i]);
+        cr_expect_eq(lfl_reclaimer_poll(&rec), 10);
+        cr_expect_eq(atomic_load(&wb->garbage), 1, "list b was not touched");
+        atomic_store(&pin->refcount, 0);
+        lfl_clear(test, reclaim_a);
+        lfl_clear(test, reclaim_b);
+}
+
+Test(lfl_reclaim, budgeted_sweep_resumes_where_it_stopped)
+{
+        struct lfl_reclaimer rec;
+        test_t *n[10];
+        struct lfl_reclaim_watch *w;
+        int ids[10], k = 0;
+
+        lfl_reclaimer_init(&rec, 0, 1, 2);
+        lfl_init(test, reclaim_a);
+        w = lfl_reclaimer_watch(test, reclaim_a, rec, NULL);
+        cr_assert_not_null(w);
+        for (int i = 0; i < 10; i++) {
+                lfl_add_tail(test, reclaim_a, node);
+                node->id = i;
+                n[i] = node;
+        }
+        for (int i = 2; i < 10; i += 2)
+                lfl_reclaimer_remove(test, reclaim_a, w, n[i]);
+
+        cr_expect_eq(lfl_reclaimer_poll(&rec), 2);
+        cr_expect_eq(atomic_load(&n[3]->refcount), 1, "the sweep pins where it stopped");
+
+        /* garbage behind the resume point waits for the next pass from the head */
+        lfl_reclaimer_remove(test, reclaim_a, w, n[0]);
+        cr_expect_eq(lfl_reclaimer_poll(&rec), 2);
+        cr_expect_eq(atomic_load(&n[3]->refcount), 0);
+        cr_expect_eq(lfl_get_head(reclaim_a), n[0], "resumed pass went back to the head");
+        cr_expect_eq(lfl_reclaimer_poll(&rec), 0, "the pass finished at the tail");
+        cr_expect_eq(lfl_reclaimer_poll(&rec), 1);
+        for (test_t *p = lfl_get_head(reclaim_a); p; p = lfl_get_next(p))
+                ids[k++] = p->id;
+        cr_assert_eq(k, 5);
+        for (int i = 0; i < 5; i++)
+                cr_expect_eq(ids[i], 2 * i + 1);
+
+        /* stopping finishes a sweep left pinned */
+        for (int i = 3; i < 8; i += 2)
+                lfl_reclaimer_remove(test, reclaim_a, w, n[i]);
+        cr_expect_eq(lfl_reclaimer_poll(&rec), 2);
+        cr_expect_eq(atomic_load(&n[1]->refcount), 1);
+        lfl_reclaimer_stop(&rec);
+        cr_expect_eq(atomic_load(&n[1]->refcount), 0);
+        cr_expect_eq(lfl_get_next(n[1]), n[9]);
+        cr_expect_eq(atomic_load(&rec.reclaimed), 8);
+        lfl_clear(test, reclaim_a);
+}
+
+static void *reclaim_hand_sweeper(void *arg)
+{
+        _Atomic(int) *stop = arg;
+
+        while (!atomic_load(stop))
+                lfl_sweep(test, reclaim_bg, refcount, NULL);
+        return NULL;
+}
+
+Test(lfl_reclaim, hand_sweeps_share_a_watched_list)
+{
+        struct lfl_reclaimer rec;
+        struct lfl_reclaim_watch *w;
+        _Atomic(int) stop = 0;
+        pthread_t sweeper;
+        size_t count = 0;
+        int removed;
+
+        lfl_reclaimer_init(&rec, 0, 8, 0);
+        rec.interval_us = 50;
+        lfl_init(test, reclaim_bg);
+        w = lfl_reclaimer_watch(test, reclaim_bg, rec, NULL);
+        cr_assert_not_null(w);
+        cr_assert_eq(lfl_reclaimer_start(&rec), 0);
+        cr_assert_eq(pthread_create(&sweeper, NULL, reclaim_hand_sweeper, &stop), 0);
+        for (int i = 0; i < 20000; i++) {
+                lfl_add_tail_init(test, reclaim_bg, node, node->id = i;);
+                if (i >= 100)
+                        lfl_reclaimer_remove(test, reclaim_bg, w, reclaim_window[i % 100]);
+                reclaim_window[i % 100] = node;
+                if (i % 64 == 0)
+                        lfl_reclaimer_poll(&rec);
+        }
+        atomic_store(&stop, 1);
+        pthread_join(sweeper, NULL);
+        lfl_reclaimer_stop(&rec);
+        lfl_sweep(test, reclaim_bg, refcount, NULL);
+        lfl_count(test, reclaim_bg, count);
+        cr_expect_eq(count, 100);
+        cr_expect_eq(chained_nodes(lfl_get_head(reclaim_bg), &removed), 100 + removed);
+        cr_expect_leq(removed, 1);
+        lfl_clear(test, reclaim_bg);
+}
+
+static _Atomic(int) compact_cleaned;
+
+static void compact_cleanup(test_t *node)
+{
+        cr_expect(atomic_load(&node->removed), "cleanup ran on a live node");
+        atomic_fetch_add(&compact_cleaned, 1);
+}
+
+Test(lfl_compact, relocates_live_nodes_in_order_and_drops_tombstones)
+{
+        struct lfl_arena arena;
+        struct lfl_rcu dom;
+        size_t before = 0, after = 0;
+        int tombstones = 0, last_id = -1;
+        test_t *prev = NULL, *last;
+        long moved;
+        lfl_vars(test, list);
+
+        cr_assert_eq(lfl_arena_init(&arena, sizeof(test_t), 8192, LFL_ARENA_2M), 0, "arena reservation failed");
+        lfl_arena_bind(test, &arena);
+        cr_assert_eq(lfl_rcu_init(&dom), 0);
+        lfl_init(test, list);
+        atomic_store(&compact_cleaned, 0);
+
+        /* churn so that later nodes land in recycled, scattered slots */
+        for (int i = 0; i < 600; i++) {
+                lfl_add_tail(test, list, node);
+                node->id = i;
+        }
+        {
+                lfl_foreach(test, list, item) {
+                        if (item->id % 3 == 0)
+                                lfl_remove(test, list, item);
+                }
+        }
+        lfl_sweep(test, list, refcount, NULL);
+        for (int i = 600; i < 800; i++) {
+                lfl_add_tail(test, list, node);
+                node->id = i;
+        }
+        {
+                lfl_foreach(test, list, item) {
+                        if (item->id % 5 == 0) {
+                                lfl_remove(test, list, item);
+                                tombstones++;
+                        }
+                }
+        }
+        lfl_count(test, list, before);
+
+        lfl_compact(test, list, refcount, dom, compact_cleanup, moved);
+        cr_assert_eq(moved, (long)before - 1, "every live node but the last moves");
+        cr_expect_eq(atomic_load(&compact_cleaned), tombstones);
+
+        last = lfl_get_tail(list);
+        cr_expect_eq(last->id, 799, "the last node stays in place");
+        for (test_t *n = lfl_get_head(list); n; n = lfl_get_next(n)) {
+                cr_assert_not(atomic_load(&n->removed), "tombstone %d kept", n->id);
+                cr_assert_gt(n->id, last_id, "order changed at %d", n->id);
+                cr_assert_eq(atomic_load(&n->prev), prev, "prev link of %d", n->id);
+                if (prev && n != last)
+                        cr_assert_eq((char *)n, (char *)prev + arena.slot, "node %d not contiguous", n->id);
+                last_id = n->id;
+                prev = n;
+                after++;
+        }
+        cr_expect_eq(after, before);
+
+        lfl_compact(test, list, refcount, dom, compact_cleanup, moved);
+        cr_expect_eq(moved, (long)before - 1, "compacting again is harmless");
+        lfl_clear(test, list);
+        lfl_arena_bind(test, NULL);
+        lfl_arena_destroy(&arena);
+        lfl_rcu_destroy(&dom);
+}
+
+Test(lfl_compact, slim_flavor_without_refcount)
+{
+        struct lfl_arena arena;
+        struct lfl_rcu dom;
+        long moved = 0;
+        int id = 0;
+
+        cr_assert_eq(lfl_arena_init(&arena, sizeof(lfl_type(slim)), 256, 0), 0);
+        cr_assert_eq(lfl_rcu_init(&dom), 0);
+        lfl_arena_bind(slim, &arena);
+        lfl_vars(slim, list);
+        lfl_init(slim, list);
+        for (int i = 0; i < 32; i++) {
+                lfl_add_tail(slim, list, node);
+                node->id = i;
+        }
+        lfl_compact(slim, list, refcount, dom, NULL, moved);
+        cr_assert_eq(moved, 31);
+        for (lfl_type(slim) *n = lfl_get_head(list); n; n = lfl_get_next(n))
+                cr_assert_eq(n->id, id++);
+        cr_expect_eq(id, 32);
+        lfl_clear(slim, list);
+        lfl_arena_bind(slim, NULL);
+        lfl_arena_destroy(&arena);
+        lfl_rcu_destroy(&dom);
+}
+
+Test(lfl_compact, referenced_nodes_refuse_and_pinned_tail_stays)
+{
+        struct lfl_arena arena;
+        struct lfl_rcu dom;
+        test_t *n[8];
+        long moved = 0;
+
+        cr_assert_eq(lfl_arena_init(&arena, sizeof(test_t), 256, 0), 0);
+        cr_assert_eq(lfl_rcu_init(&dom), 0);
+        lfl_arena_bind(test, &arena);
+        lfl_vars(test, list);
+        lfl_init(test, list);
+        for (int i = 0; i < 8; i++) {
+                lfl_add_tail(test, list, node);
+                node->id = i;
+                n[i] = node;
+        }
+
+        /* a reference in the middle: nothing moves and every claim is handed back */
+        atomic_store(&n[3]->refcount, 1);
+        lfl_compact(test, list, refcount, dom, NULL, moved);
+        cr_expect_eq(moved, -EBUSY);
+        for (int i = 0; i < 8; i++)
+                cr_expect_eq(atomic_load(&n[i]->refcount), i == 3, "node %d refcount", i);
+        cr_expect_eq(lfl_get_head(list), n[0]);
+        atomic_store(&n[3]->refcount, 0);
+
+        /* a reference on the tail only keeps it where it stays anyway */
+        atomic_store(&n[7]->refcount, 1);
+        lfl_compact(test, list, refcount, dom, NULL, moved);
+        cr_expect_eq(moved, 7);
+        cr_expect_eq(atomic_load(&n[7]->refcount), 1);
+        cr_expect_eq(lfl_get_tail(list), n[7]);
+        cr_expect_neq(lfl_get_head(list), n[0]);
+        atomic_store(&n[7]->refcount, 0);
+        lfl_clear(test, list);
+        lfl_arena_bind(test, NULL);
+        lfl_arena_destroy(&arena);
+        lfl_rcu_destroy(&dom);
+}
+
+static struct lfl_rcu compact_dom;
+lfl_vars_static(test, compact_list);
+static _Atomic(int) compact_stop;
+static _Atomic(int) compact_ready;
+
+static void *compact_reader(void *arg)
+{
+        long *walks = arg;
+
+        while (!atomic_load(&compact_stop)) {
+                int n = 0, last_id = -1;
+                lfl_rcu_read_lock(&compact_dom);
+                {
+                        lfl_foreach(test, compact_list, item) {
+                                cr_assert_gt(item->id, last_id, "walk saw %d after %d", item->id, last_id);
+                                last_id = item->id;
+                                n++;
+                        }
+                }
+                lfl_rcu_read_unlock(&compact_dom);
+                cr_assert_eq(n, 200, "walk saw %d of 200 nodes", n);
+                if ((*walks)++ == 0)
+                        atomic_fetch_add(&compact_ready, 1);
+        }
+        return NULL;
+}
+
+Test(lfl_compact, concurrent_readers_survive_relocation)
+{
+        struct lfl_arena arena;
+        pthread_t threads[2];
+        long walks[2] = { 0 };
+        long moved;
+
+        cr_assert_eq(lfl_arena_init(&arena, sizeof(test_t), 100000, LFL_ARENA_2M), 0, "arena reservation failed");
+        lfl_arena_bind(test, &arena);
+        cr_assert_eq(lfl_rcu_init(&compact_dom), 0);
+        lfl_init(test, compact_list);
+        atomic_store(&compact_stop, 0);
+        atomic_store(&compact_ready, 0);
+        for (int i = 0; i < 200; i++) {
+                lfl_add_tail(test, compact_list, node);
+                node->id = i;
+        }
+        for (int t = 0; t < 2; t++)
+                pthread_create(&threads[t], NULL, compact_reader, &walks[t]);
+        /* on a single cpu the readers might otherwise not run before the rounds end */
+        while (atomic_load(&compact_ready) < 2)
+                sched_yield();
+        for (int round = 0; round < 300; round++) {
+                test_t *scratch[64];
+                lfl_compact(test, compact_list, refcount, compact_dom, NULL, moved);
+                cr_assert_eq(moved, 199);
+                /* reuse the freed slots at once: a reader left on one would see it zeroed */
+                for (int i = 0; i < 64; i++)
+                        scratch[i] = lfl_new(test);
+                for (int i = 0; i < 64; i++)
+                        lfl_node_free(test, scratch[i]);
+        }
+        atomic_store(&compact_stop, 1);
+        for (int t = 0; t < 2; t++) {
+                pthread_join(threads[t], NULL);
+                cr_expect_gt(walks[t], 0);
+        }
+        lfl_clear(test, compact_list);
+        lfl_arena_bind(test, NULL);
+        lfl_arena_destroy(&arena);
+        lfl_rcu_destroy(&compact_dom);
+}
+
+#ifdef LFL_HAVE_URING
+#include "lfl_uring.h"
+
+lfl_uring_def(urx)
+        int conn;
+lfl_end
+
+lfl_uring_def_ex(urx_slim, LFL_SINGLY | LFL_NO_REFCOUNT)
+lfl_end
+
+/* one buffer-select read from fd, waited for synchronously */
+static struct io_uring_cqe *uring_read(struct io_uring *ring, int fd, int bgid, unsigned int len)
+{
+        struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+        struct io_uring_cqe *cqe = NULL;
+
+        io_uring_prep_read(sqe, fd, NULL, len, 0);
+        sqe->flags |= IOSQE_BUFFER_SELECT;
+        sqe->buf_group = bgid;
+        if (io_uring_submit(ring) != 1 || io_uring_wait_cqe(ring, &cqe) != 0)
+                return NULL;
+        return cqe;
+}
+
+Test(lfl_uring, completions_link_buffers_and_recycle)
+{
+        struct io_uring ring;
+        struct lfl_uring_pool pool;
+        struct io_uring_cqe none = { .res = -EIO };
+        lfl_type(urx) *item = NULL;
+        int fds[2];
+
+        /* skipped where the kernel offers no io_uring or provided-buffer rings */
+        if (io_uring_queue_init(8, &ring, 0) != 0)
+                return;
+        if (lfl_uring_pool_init(urx, pool, &ring, 1, 4, 64) != 0) {
+                io_uring_queue_exit(&ring);
+                return;
+        }
+        cr_assert_eq(pipe(fds), 0);
+        lfl_vars(urx, inbox);
+        lfl_init(urx, inbox);
+        lfl_uring_complete(urx, pool, inbox, &none, item);
+        cr_expect_null(item, "a completion without a buffer linked a node");
+
+        /* more rounds than buffers: each one must come back through replenish */
+        for (int round = 0; round < 10; round++) {
+                char msg[16];
+                int len = snprintf(msg, sizeof(msg), "msg %d", round), back = 0;
+                cr_assert_eq(write(fds[1], msg, (size_t)len), len);
+                struct io_uring_cqe *cqe = uring_read(&ring, fds[0], 1, 64);
+                cr_assert_not_null(cqe);
+                lfl_uring_complete(urx, pool, inbox, cqe, item);
+                io_uring_cqe_seen(&ring, cqe);
+                cr_assert_not_null(item, "round %d got no buffer", round);
+                cr_expect_eq(lfl_uring_len(item), len);
+                cr_expect_eq(memcmp(lfl_uring_data(pool, item), msg, (size_t)len), 0);
+                cr_expect_eq(lfl_get_head(inbox), item);
+                lfl_type(urx) *got = NULL;
+                lfl_pop_head(urx, inbox, got);
+                cr_assert_eq(got, item);
+                lfl_uring_recycle(urx, pool, got);
+                lfl_uring_replenish(urx, pool, back);
+                cr_expect_eq(back, 1);
+        }
+        cr_expect_null(lfl_get_head(inbox));
+        close(fds[0]);
+        close(fds[1]);
+        lfl_uring_pool_destroy(urx, pool);
+        io_uring_queue_exit(&ring);
+}
+
+Test(lfl_uring, slim_flavor_without_refcount)
+{
+        struct io_uring ring;
+        struct lfl_uring_pool pool;
+        lfl_type(urx_slim) *item = NULL;
+        int fds[2];
+
+        if (io_uring_queue_init(8, &ring, 0) != 0)
+                return;
+        if (lfl_uring_pool_init(urx_slim, pool, &ring, 2, 2, 32) != 0) {
+                io_uring_queue_exit(&ring);
+                return;
+        }
+        cr_assert_eq(pipe(fds), 0);
+        lfl_vars(urx_slim, inbox);
+        lfl_init(urx_slim, inbox);
+        cr_assert_eq(write(fds[1], "slim", 4), 4);
+        struct io_uring_cqe *cqe = uring_read(&ring, fds[0], 2, 32);
+        cr_assert_not_null(cqe);
+        lfl_uring_complete(urx_slim, pool, inbox, cqe, item);
+        io_uring_cqe_seen(&ring, cqe);
+        cr_assert_not_null(item);
+        cr_expect_eq(lfl_uring_len(item), 4);
+        cr_expect_eq(lfl_get_head(inbox), item);
+        close(fds[0]);
+        close(fds[1]);
+        lfl_uring_pool_destroy(urx_slim, pool);
+        io_uring_queue_exit(&ring);
+}
+#endif
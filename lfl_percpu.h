@@ -0,0 +1,525 @@
+#ifndef LFL_PERCPU_H
+#define LFL_PERCPU_H
+
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "lock_free_list.h"
+
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 Michael Miller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @brief per-cpu lists and node pools
+ *
+ *        linux-only: cpu affinity is read and set through raw syscalls,
+ *        and on x86-64 with glibc 2.35+ the fast paths are restartable
+ *        sequences.
+ */
+
+/*
+ * restartable sequences: with glibc 2.35+ every thread has an rseq area
+ * registered with the kernel. a critical section publishes a descriptor,
+ * checks it still runs on the expected cpu and commits with one plain
+ * store; preemption, migration or a signal before the commit sends it to
+ * the abort label instead. define LFL_NO_RSEQ to build without it.
+ */
+#if !defined(LFL_NO_RSEQ) && defined(__x86_64__) && defined(__has_include)
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define LFL_HAVE_RSEQ 1
+#endif
+#endif
+#ifndef LFL_HAVE_RSEQ
+#define LFL_HAVE_RSEQ 0
+#endif
+
+#if LFL_HAVE_RSEQ
+#define LFL__STR_(x) #x
+#define LFL__STR(x) LFL__STR_(x)
+
+/* descriptor (start 1, commit 2, abort 4), arming, and the cpu check */
+#define LFL__RSEQ_BEGIN \
+        ".pushsection __rseq_cs, \"aw\"\n\t" \
+        ".balign 32\n\t" \
+        "3:\n\t" \
+        ".long 0x0, 0x0\n\t" \
+        ".quad 1f, (2f - 1f), 4f\n\t" \
+        ".popsection\n\t" \
+        "leaq 3b(%%rip), %%rax\n\t" \
+        "movq %%rax, %%fs:8(%[rseq_off])\n\t" \
+        "1:\n\t" \
+        "cmpl %[cpu], %%fs:4(%[rseq_off])\n\t" \
+        "jnz 4f\n\t"
+
+/* commit point, then the signed abort handler out of line */
+#define LFL__RSEQ_END \
+        "2:\n\t" \
+        ".pushsection __rseq_failure, \"ax\"\n\t" \
+        ".byte 0x0f, 0xb9, 0x3d\n\t" \
+        ".long " LFL__STR(RSEQ_SIG) "\n\t" \
+        "4:\n\t" \
+        "jmp %l[abort]\n\t" \
+        ".popsection\n\t"
+
+/* cpu the calling thread runs on, or -1 when it has no rseq area */
+static inline int lfl__rseq_cpu(void)
+{
+        if (!__rseq_size)
+                return -1;
+        return (int32_t)*(volatile uint32_t *)((char *)__builtin_thread_pointer() + __rseq_offset +
+                                               offsetof(struct rseq, cpu_id));
+}
+
+/* on cpu: link node in front of *head. 0 done, -1 aborted */
+static inline int lfl__rseq_push(_Atomic(void *) *head, void *node, size_t next_off, int cpu)
+{
+        __asm__ __volatile__ goto(
+                LFL__RSEQ_BEGIN
+                "movq (%[head]), %%rbx\n\t"
+                "movq %%rbx, (%[node], %[next_off])\n\t"
+                "movq %[node], (%[head])\n\t"
+                LFL__RSEQ_END
+                :
+                : [cpu] "r"(cpu), [rseq_off] "r"(__rseq_offset), [head] "r"(head),
+                  [node] "r"(node), [next_off] "r"(next_off)
+                : "memory", "cc", "rax", "rbx"
+                : abort);
+        return 0;
+abort:
+        return -1;
+}
+
+/*
+ * on cpu: push node onto a pool whose head records the pool depth at
+ * depth_off. the old head is only read inside the critical section, where
+ * nothing else can pop it. 0 done, 1 pool holds max nodes, -1 aborted
+ */
+static inline int lfl__rseq_push_pool(_Atomic(void *) *head, void *node, size_t next_off, size_t depth_off,
+                                      int max, int cpu)
+{
+        __asm__ __volatile__ goto(
+                LFL__RSEQ_BEGIN
+                "movq (%[head]), %%rbx\n\t"
+                "xorl %%ecx, %%ecx\n\t"
+                "testq %%rbx, %%rbx\n\t"
+                "jz 5f\n\t"
+                "movl (%%rbx, %[depth_off]), %%ecx\n\t"
+                "5:\n\t"
+                "cmpl %[max], %%ecx\n\t"
+                "jge %l[full]\n\t"
+                "incl %%ecx\n\t"
+                "movl %%ecx, (%[node], %[depth_off])\n\t"
+                "movq %%rbx, (%[node], %[next_off])\n\t"
+                "movq %[node], (%[head])\n\t"
+                LFL__RSEQ_END
+                :
+                : [cpu] "r"(cpu), [rseq_off] "r"(__rseq_offset), [head] "r"(head),
+                  [node] "r"(node), [next_off] "r"(next_off), [depth_off] "r"(depth_off), [max] "r"(max)
+                : "memory", "cc", "rax", "rbx", "rcx"
+                : abort, full);
+        return 0;
+abort:
+        return -1;
+full:
+        return 1;
+}
+
+/*
+ * on cpu: unlink the first node. *out is written only after the commit,
+ * so an aborted attempt leaves it untouched. 0 done, 1 empty, -1 aborted
+ */
+static inline int lfl__rseq_pop(_Atomic(void *) *head, size_t next_off, void **out, int cpu)
+{
+        __asm__ __volatile__ goto(
+                LFL__RSEQ_BEGIN
+                "movq (%[head]), %%rcx\n\t"
+                "testq %%rcx, %%rcx\n\t"
+                "jz %l[empty]\n\t"
+                "movq (%%rcx, %[next_off]), %%rbx\n\t"
+                "movq %%rbx, (%[head])\n\t"
+                LFL__RSEQ_END
+                "movq %%rcx, (%[out])\n\t"
+                :
+                : [cpu] "r"(cpu), [rseq_off] "r"(__rseq_offset), [head] "r"(head),
+                  [next_off] "r"(next_off), [out] "r"(out)
+                : "memory", "cc", "rax", "rbx", "rcx"
+                : abort, empty);
+        return 0;
+abort:
+        return -1;
+empty:
+        return 1;
+}
+#else
+static inline int lfl__rseq_cpu(void)
+{
+        return -1;
+}
+#endif
+
+/* most nodes a cpu keeps in its free pool before handing them back */
+#define LFL_PERCPU_POOL_MAX 256
+
+struct lfl__percpu_slot {
+        _Alignas(64) _Atomic(void *) list;
+        _Atomic(void *) pool;
+};
+
+/**
+ * @brief per-cpu lists with per-cpu node pools
+ *
+ *        one LIFO list head and one free pool per cpu. when the calling
+ *        thread has a registered rseq area (glibc's default), pushes and
+ *        pops are rseq critical sections on the current cpu's slot: plain
+ *        loads and one plain store, no lock-prefixed instruction. otherwise
+ *        every operation falls back to CAS on a per-thread slot and the
+ *        pools are bypassed. a CAS-mode pop takes the slot's whole chain
+ *        with one exchange, keeps the first node and pushes the rest back:
+ *        it never reads a node another popper could free, so there is no
+ *        ABA, and no popper waits for another. a pop that overlaps another
+ *        on the same slot may find it empty for that moment.
+ *
+ *        in rseq mode a slot may only be written from its own cpu, so a
+ *        consumer that finds its cpu empty steals by briefly binding itself
+ *        to a cpu with work (sched_setaffinity) and popping there. that is
+ *        a slow path; the flavor pays off when producers and consumers
+ *        mostly share cpus. all threads using one instance must agree on
+ *        the mode, which holds unless rseq registration fails per thread.
+ */
+struct lfl_percpu {
+        struct lfl__percpu_slot *slot;
+        int ncpu;
+        int rseq;
+        int mask_words;                 /* affinity mask size the kernel takes, 0 if unknown */
+};
+
+/* words of an affinity mask the kernel accepts: ncpu bits, grown like CPU_ALLOC */
+static inline int lfl__percpu_mask_words(int ncpu)
+{
+        const int bits = 8 * (int)sizeof(unsigned long);
+
+        for (int words = (ncpu + bits - 1) / bits; words <= 1024; words *= 2) {
+                unsigned long *m = malloc((size_t)words * sizeof(*m));
+                long ret;
+                if (!m)
+                        return 0;
+                ret = syscall(SYS_sched_getaffinity, 0, (size_t)words * sizeof(*m), m);
+                free(m);
+                if (ret >= 0)
+                        return words;
+                if (errno != EINVAL)
+                        return 0;
+        }
+        return 0;
+}
+
+static inline int lfl_percpu_init(struct lfl_percpu *pc)
+{
+        long n = sysconf(_SC_NPROCESSORS_CONF);
+
+        memset(pc, 0, sizeof(*pc));
+        pc->ncpu = n > 0 ? (int)n : 1;
+        pc->slot = aligned_alloc(64, (size_t)pc->ncpu * sizeof(*pc->slot));
+        if (!pc->slot)
+                return -1;
+        memset(pc->slot, 0, (size_t)pc->ncpu * sizeof(*pc->slot));
+        pc->rseq = LFL_HAVE_RSEQ && lfl__rseq_cpu() >= 0;
+        if (pc->rseq)
+                pc->mask_words = lfl__percpu_mask_words(pc->ncpu);
+        return 0;
+}
+
+#define lfl__percpu_head(pc, cpu, in_pool) \
+        ((in_pool) ? &(pc)->slot[(cpu)].pool : &(pc)->slot[(cpu)].list)
+
+/* slot used in CAS mode: fixed per thread, spread round-robin */
+static inline int lfl__percpu_hint(const struct lfl_percpu *pc)
+{
+        static _Atomic(unsigned int) next;
+        static _Thread_local unsigned int hint;
+
+        if (!hint)
+                hint = atomic_fetch_add_explicit(&next, 1, memory_order_relaxed) + 1;
+        return (int)((hint - 1) % (unsigned int)pc->ncpu);
+}
+
+/* current cpu in rseq mode, or -1 for a thread without an rseq area */
+static inline int lfl__percpu_cpu(const struct lfl_percpu *pc)
+{
+        int cpu = lfl__rseq_cpu();
+
+        return cpu < pc->ncpu ? cpu : -1;
+}
+
+/*
+ * push onto this cpu's list or pool. pool nodes record the pool depth in
+ * their removed field. returns -1 when the pool is full or unavailable, or
+ * when the thread cannot join an rseq-mode instance.
+ */
+static inline int lfl__percpu_push(struct lfl_percpu *pc, int pool, void *node, size_t next_off, size_t depth_off)
+{
+        _Atomic(void *) *link = (_Atomic(void *) *)((char *)node + next_off);
+        _Atomic(void *) *head;
+        void *old;
+
+#if LFL_HAVE_RSEQ
+        if (pc->rseq) {
+                for (;;) {
+                        int cpu = lfl__percpu_cpu(pc), ret;
+                        if (cpu < 0)
+                                return -1;
+                        head = lfl__percpu_head(pc, cpu, pool);
+                        ret = pool ? lfl__rseq_push_pool(head, node, next_off, depth_off, LFL_PERCPU_POOL_MAX, cpu)
+                                   : lfl__rseq_push(head, node, next_off, cpu);
+                        if (ret >= 0)
+                                return -ret;
+                }
+        }
+#endif
+        (void)depth_off;
+        if (pool)
+                return -1;
+        head = lfl__percpu_head(pc, lfl__percpu_hint(pc), 0);
+        old = atomic_load_explicit(head, memory_order_relaxed);
+        do {
+                atomic_store_explicit(link, old, memory_order_relaxed);
+        } while (!atomic_compare_exchange_weak_explicit(head, &old, node, memory_order_release, memory_order_relaxed));
+        return 0;
+}
+
+#define lfl__percpu_next(node, next_off) ((_Atomic(void *) *)((char *)(node) + (next_off)))
+
+/*
+ * CAS pop from one slot's list: detach the whole chain, keep its first node
+ * and push the rest back. nodes pushed in between are spliced on top of it,
+ * walking only those.
+ */
+static inline void *lfl__percpu_cas_pop(struct lfl__percpu_slot *slot, size_t next_off)
+{
+        void *node, *rest, *more, *last;
+
+        if (!atomic_load_explicit(&slot->list, memory_order_relaxed))
+                return NULL;
+        node = atomic_exchange_explicit(&slot->list, NULL, memory_order_acquire);
+        if (!node)
+                return NULL;
+        rest = atomic_load_explicit(lfl__percpu_next(node, next_off), memory_order_relaxed);
+        while (rest) {
+                more = NULL;
+                if (atomic_compare_exchange_weak_explicit(&slot->list, &more, rest, memory_order_release,
+                                                          memory_order_relaxed))
+                        break;
+                more = atomic_exchange_explicit(&slot->list, NULL, memory_order_acquire);
+                if (!more)
+                        continue;
+                for (last = more; atomic_load_explicit(lfl__percpu_next(last, next_off), memory_order_relaxed);
+                     last = atomic_load_explicit(lfl__percpu_next(last, next_off), memory_order_relaxed))
+                        ;
+                atomic_store_explicit(lfl__percpu_next(last, next_off), rest, memory_order_relaxed);
+                rest = more;
+        }
+        return node;
+}
+
+/* pop from this cpu's list or pool */
+static inline void *lfl__percpu_pop_local(struct lfl_percpu *pc, int pool, size_t next_off)
+{
+#if LFL_HAVE_RSEQ
+        if (pc->rseq) {
+                for (;;) {
+                        void *node = NULL;
+                        int cpu = lfl__percpu_cpu(pc);
+                        int ret;
+                        if (cpu < 0)
+                                return NULL;
+                        ret = lfl__rseq_pop(lfl__percpu_head(pc, cpu, pool), next_off, &node, cpu);
+                        if (ret >= 0)
+                                return ret == 0 ? node : NULL;
+                }
+        }
+#endif
+        if (pool)
+                return NULL;
+        return lfl__percpu_cas_pop(&pc->slot[lfl__percpu_hint(pc)], next_off);
+}
+
+/* take a node from another cpu's list; see struct lfl_percpu */
+static inline void *lfl__percpu_steal(struct lfl_percpu *pc, size_t next_off)
+{
+        void *node = NULL;
+
+        if (!pc->rseq) {
+                for (int c = 0; c < pc->ncpu && !node; c++)
+                        node = lfl__percpu_cas_pop(&pc->slot[c], next_off);
+                return node;
+        }
+#if LFL_HAVE_RSEQ
+        int self = lfl__percpu_cpu(pc), words = pc->mask_words ? pc->mask_words : 1;
+        unsigned long old_mask[words], one[words];
+
+        if (self < 0 || !pc->mask_words ||
+            syscall(SYS_sched_getaffinity, 0, sizeof(old_mask), old_mask) < 0)
+                return NULL;
+        for (int c = 0; c < pc->ncpu && !node; c++) {
+                if (c == self || !atomic_load_explicit(&pc->slot[c].list, memory_order_relaxed))
+                        continue;
+                memset(one, 0, sizeof(one));
+                one[c / (8 * sizeof(long))] = 1UL << (c % (8 * sizeof(long)));
+                if (syscall(SYS_sched_setaffinity, 0, sizeof(one), one) != 0)
+                        continue;
+                /* an aborted attempt leaves got alone; only a committed pop counts */
+                for (;;) {
+                        void *got = NULL;
+                        int ret = lfl__rseq_cpu() == c ? lfl__rseq_pop(&pc->slot[c].list, next_off, &got, c) : 1;
+                        if (ret >= 0) {
+                                if (ret == 0)
+                                        node = got;
+                                break;
+                        }
+                }
+                syscall(SYS_sched_setaffinity, 0, sizeof(old_mask), old_mask);
+        }
+#endif
+        return node;
+}
+
+/* node from this cpu's pool, zeroed like a fresh allocation, or NULL */
+static inline void *lfl__percpu_new(struct lfl_percpu *pc, size_t size, size_t next_off)
+{
+        void *node = pc->rseq ? lfl__percpu_pop_local(pc, 1, next_off) : NULL;
+
+        if (node)
+                memset(node, 0, size);
+        return node;
+}
+
+/**
+ * @brief allocate a node, from the current cpu's pool when it has one
+ *
+ * @param name list type name
+ * @param pc   struct lfl_percpu
+ */
+#define lfl_percpu_new(name, pc) \
+        ({ \
+                struct name##_linked_list *_pnew = lfl__percpu_new(&(pc), sizeof(struct name##_linked_list), \
+                                                                   offsetof(struct name##_linked_list, next)); \
+                _pnew ? _pnew : lfl_new(name); \
+        })
+
+/**
+ * @brief release a node into the current cpu's pool, or free it when full
+ *
+ * @param name list type name
+ * @param pc   struct lfl_percpu
+ * @param ptr  node no longer on any list
+ */
+#define lfl_percpu_free(name, pc, ptr) \
+        do { \
+                struct name##_linked_list *_pfree = (ptr); \
+                if (lfl__percpu_push(&(pc), 1, _pfree, offsetof(struct name##_linked_list, next), \
+                                     offsetof(struct name##_linked_list, removed)) != 0) \
+                        lfl_node_free(name, _pfree); \
+        } while (0)
+
+static inline int lfl__percpu_add(struct lfl_percpu *pc, void *node, size_t next_off, size_t removed_off)
+{
+        atomic_store_explicit((_Atomic(int) *)((char *)node + removed_off), 0, memory_order_relaxed);
+        return lfl__percpu_push(pc, 0, node, next_off, removed_off);
+}
+
+/**
+ * @brief push an initialized node onto the current cpu's list
+ *
+ * @param name list type name
+ * @param pc   struct lfl_percpu
+ * @param ptr  node to insert
+ *
+ * @return 0, or -1 when the calling thread has no rseq area but the
+ *         instance runs in rseq mode (the node is left to the caller)
+ */
+#define lfl_percpu_add_head_ptr(name, pc, ptr) \
+        lfl__percpu_add(&(pc), (struct name##_linked_list *)(ptr), offsetof(struct name##_linked_list, next), \
+                        offsetof(struct name##_linked_list, removed))
+
+/**
+ * @brief allocate a node from the cpu pool and push it, like lfl_add_head
+ *
+ *        the node is published immediately; fill it first with
+ *        lfl_percpu_new and lfl_percpu_add_head_ptr if readers may see it.
+ *
+ * @param name list type name
+ * @param pc   struct lfl_percpu
+ * @param item variable declared to receive the new node, NULL on failure
+ */
+#define lfl_percpu_add_head(name, pc, item) \
+        struct name##_linked_list *item; \
+        do { \
+                item = lfl_percpu_new(name, pc); \
+                if (item && lfl_percpu_add_head_ptr(name, pc, item) != 0) { \
+                        lfl_node_free(name, item); \
+                        item = NULL; \
+                } \
+        } while (0)
+
+/**
+ * @brief pop the most recent node of the current cpu, else steal one
+ *
+ * @param name list type name
+ * @param pc   struct lfl_percpu
+ * @param item variable receiving the node, or NULL when every cpu is empty
+ */
+#define lfl_percpu_pop_head(name, pc, item) \
+        do { \
+                size_t _pnext = offsetof(struct name##_linked_list, next); \
+                item = (struct name##_linked_list *)lfl__percpu_pop_local(&(pc), 0, _pnext); \
+                if (!item) \
+                        item = (struct name##_linked_list *)lfl__percpu_steal(&(pc), _pnext); \
+        } while (0)
+
+/**
+ * @brief free pooled nodes and the per-cpu slots
+ *
+ *        call once no thread uses the instance; nodes still on the lists
+ *        are left to the caller (pop them first).
+ *
+ * @param name list type name
+ * @param pc   struct lfl_percpu
+ */
+#define lfl_percpu_destroy(name, pc) \
+        do { \
+                for (int _pc = 0; _pc < (pc).ncpu; _pc++) { \
+                        struct name##_linked_list *_pn = atomic_load(&(pc).slot[_pc].pool); \
+                        while (_pn) { \
+                                struct name##_linked_list *_px = atomic_load(&_pn->next); \
+                                lfl_node_free(name, _pn); \
+                                _pn = _px; \
+                        } \
+                } \
+                free((pc).slot); \
+                (pc).slot = NULL; \
+        } while (0)
+
+#endif /* LFL_PERCPU_H */
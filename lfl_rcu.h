@@ -0,0 +1,709 @@
+#ifndef LFL_RCU_H
+#define LFL_RCU_H
+
+#include <pthread.h>
+
+/* expedited membarrier is linux-only; elsewhere readers always fence */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/membarrier.h>)
+#include <sys/syscall.h>
+#include <linux/membarrier.h>
+#define LFL_HAVE_MEMBARRIER 1
+#endif
+#endif
+#ifndef LFL_HAVE_MEMBARRIER
+#define LFL_HAVE_MEMBARRIER 0
+#endif
+
+#include "lock_free_list.h"
+
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 Michael Miller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @brief grace-period reclamation for lfl lists
+ *
+ *        readers that traverse without references, the helping traversals
+ *        and sweeps that free behind them, cursors and lfl_remove_if
+ *        variants that respect read sections, and lfl_compact, which moves
+ *        nodes under readers. needs pthreads for the per-thread reader
+ *        records, and uses membarrier where linux provides it.
+ */
+
+/**
+ * @brief grace-period reclamation domain with asymmetric fences
+ *
+ *        readers bracket traversals with lfl_rcu_read_lock/unlock and take
+ *        no references: entering stores the current epoch into the thread's
+ *        reader record, leaving stores zero. nodes unlinked by
+ *        lfl_rcu_sweep (or handed to lfl_rcu_free) are freed only after
+ *        lfl_rcu_synchronize has seen every reader that might still hold
+ *        them leave.
+ *
+ *        a reader's record store must be ordered before its list loads.
+ *        where the kernel offers MEMBARRIER_CMD_PRIVATE_EXPEDITED, readers
+ *        use only a compiler barrier and the reclaimer pays instead: it
+ *        issues one membarrier, which runs a full fence on every cpu
+ *        executing a thread of the process, before scanning the records.
+ *        without membarrier readers fall back to a seq_cst fence.
+ *
+ *        read sections nest and may not call lfl_rcu_synchronize, which
+ *        would wait on itself.
+ *
+ *        helping traversals (lfl_foreach_help) unlink under the list's
+ *        unlink token like every sweep, and take the domain's own token
+ *        only to queue what they retired. a list read without references
+ *        inside read sections must only have nodes freed through the
+ *        domain: lfl_rcu_sweep, lfl_rcu_remove_if or helping, never
+ *        lfl_sweep or lfl_remove_if, which free at once.
+ */
+struct lfl__rcu_reader {
+        _Alignas(64) _Atomic(unsigned long) epoch;      /* 0 outside a read section */
+        unsigned int depth;                             /* nesting, owner only */
+        _Atomic(int) used;
+        struct lfl__rcu_reader *next;
+};
+
+/* a node unlinked by a helping traversal, freed after a grace period */
+struct lfl__rcu_retired {
+        void *node;
+        struct lfl_arena *arena;
+        const struct lfl_allocator *allocator;
+};
+
+struct lfl_rcu {
+        _Atomic(struct lfl__rcu_reader *) readers;
+        _Atomic(unsigned long) epoch;
+        pthread_key_t key;
+        int membarrier;
+        _Atomic(int) unlinking;                 /* guards retired */
+        struct lfl__rcu_retired *retired;
+        size_t nretired;
+        size_t capretired;
+};
+
+/* thread exit: give the record back for reuse */
+static void lfl__rcu_leave(void *p)
+{
+        struct lfl__rcu_reader *r = p;
+
+        r->depth = 0;
+        atomic_store_explicit(&r->epoch, 0, memory_order_release);
+        atomic_store_explicit(&r->used, 0, memory_order_release);
+}
+
+/**
+ * @brief initialize a domain and register for expedited membarrier
+ *
+ * @return 0 on success, -1 when no thread key is available
+ */
+static inline int lfl_rcu_init(struct lfl_rcu *d)
+{
+        long cmds;
+
+        memset(d, 0, sizeof(*d));
+        atomic_init(&d->epoch, 1);
+        if (pthread_key_create(&d->key, lfl__rcu_leave) != 0)
+                return -1;
+#if LFL_HAVE_MEMBARRIER
+        cmds = syscall(SYS_membarrier, MEMBARRIER_CMD_QUERY, 0, 0);
+        d->membarrier = cmds > 0 && (cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED) &&
+                        syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+#else
+        (void)cmds;
+#endif
+        return 0;
+}
+
+/* release the reader records and free retired nodes; no thread may use the domain afterwards */
+static inline void lfl_rcu_destroy(struct lfl_rcu *d)
+{
+        struct lfl__rcu_reader *r = atomic_load_explicit(&d->readers, memory_order_acquire);
+
+        for (size_t i = 0; i < d->nretired; i++)
+                lfl__node_free(d->retired[i].arena, d->retired[i].allocator, d->retired[i].node);
+        free(d->retired);
+        pthread_key_delete(d->key);
+        while (r) {
+                struct lfl__rcu_reader *next = r->next;
+                free(r);
+                r = next;
+        }
+        memset(d, 0, sizeof(*d));
+}
+
+/* first read lock of a thread: claim a free record or add one; NULL when out of memory */
+static inline struct lfl__rcu_reader *lfl__rcu_join(struct lfl_rcu *d)
+{
+        struct lfl__rcu_reader *r;
+
+        for (r = atomic_load_explicit(&d->readers, memory_order_acquire); r; r = r->next) {
+                int free_rec = 0;
+                if (atomic_compare_exchange_strong_explicit(&r->used, &free_rec, 1, memory_order_acq_rel,
+                                                            memory_order_relaxed))
+                        break;
+        }
+        if (!r) {
+                r = aligned_alloc(64, sizeof(*r));
+                if (!r)
+                        return NULL;
+                memset(r, 0, sizeof(*r));
+                atomic_init(&r->used, 1);
+                r->next = atomic_load_explicit(&d->readers, memory_order_relaxed);
+                while (!atomic_compare_exchange_weak_explicit(&d->readers, &r->next, r, memory_order_release,
+                                                              memory_order_relaxed))
+                        ;
+        }
+        pthread_setspecific(d->key, r);
+        return r;
+}
+
+/**
+ * @brief enter a read section: a plain store plus a compiler barrier
+ *
+ * @return 0 on success, -1 when a thread's first call cannot allocate its
+ *         reader record; the section was not entered and must not be
+ *         unlocked
+ */
+static inline int lfl_rcu_read_lock(struct lfl_rcu *d)
+{
+        struct lfl__rcu_reader *r = pthread_getspecific(d->key);
+
+        if (__builtin_expect(!r, 0) && !(r = lfl__rcu_join(d)))
+                return -1;
+        if (r->depth++)
+                return 0;
+        atomic_store_explicit(&r->epoch, atomic_load_explicit(&d->epoch, memory_order_acquire), memory_order_relaxed);
+        if (d->membarrier)
+                atomic_signal_fence(memory_order_seq_cst);
+        else
+                atomic_thread_fence(memory_order_seq_cst);
+        return 0;
+}
+
+/* leave a read section */
+static inline void lfl_rcu_read_unlock(struct lfl_rcu *d)
+{
+        struct lfl__rcu_reader *r = pthread_getspecific(d->key);
+
+        if (--r->depth)
+                return;
+        atomic_store_explicit(&r->epoch, 0, memory_order_release);
+}
+
+/**
+ * @brief wait until every read section begun before the call has ended
+ *
+ *        anything unlinked before the call is unreachable to readers once
+ *        it returns.
+ */
+static inline void lfl_rcu_synchronize(struct lfl_rcu *d)
+{
+        unsigned long target = atomic_fetch_add_explicit(&d->epoch, 1, memory_order_seq_cst) + 1;
+
+#if LFL_HAVE_MEMBARRIER
+        if (d->membarrier)
+                syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+        else
+#endif
+                atomic_thread_fence(memory_order_seq_cst);
+        for (struct lfl__rcu_reader *r = atomic_load_explicit(&d->readers, memory_order_acquire); r; r = r->next) {
+                unsigned int spins = 0;
+                unsigned long e;
+                while ((e = atomic_load_explicit(&r->epoch, memory_order_acquire)) != 0 && e < target)
+                        lfl__spin_wait(&spins);
+        }
+}
+
+static inline int lfl__rcu_trylock(struct lfl_rcu *d)
+{
+        return lfl__token_trylock(&d->unlinking);
+}
+
+static inline void lfl__rcu_lock(struct lfl_rcu *d)
+{
+        lfl__token_lock(&d->unlinking);
+}
+
+static inline void lfl__rcu_unlock(struct lfl_rcu *d)
+{
+        lfl__token_unlock(&d->unlinking);
+}
+
+/* room for one more retired node before a helper unlinks it; -1 when out of memory */
+static inline int lfl__rcu_retire_reserve(struct lfl_rcu *d)
+{
+        if (d->nretired == d->capretired) {
+                size_t cap = d->capretired ? d->capretired * 2 : 64;
+                struct lfl__rcu_retired *grown = realloc(d->retired, cap * sizeof(*grown));
+                if (!grown)
+                        return -1;
+                d->retired = grown;
+                d->capretired = cap;
+        }
+        return 0;
+}
+
+/* queue a helper-unlinked node; caller holds the domain token and reserved room */
+static inline void lfl__rcu_retire(struct lfl_rcu *d, void *node, struct lfl_arena *a,
+                                   const struct lfl_allocator *al)
+{
+        d->retired[d->nretired++] = (struct lfl__rcu_retired){ node, a, al };
+}
+
+/* detach the retired nodes queued so far; free them after a grace period */
+static inline struct lfl__rcu_retired *lfl__rcu_take(struct lfl_rcu *d, size_t *n)
+{
+        struct lfl__rcu_retired *taken;
+
+        lfl__rcu_lock(d);
+        taken = d->retired;
+        *n = d->nretired;
+        d->retired = NULL;
+        d->nretired = d->capretired = 0;
+        lfl__rcu_unlock(d);
+        return taken;
+}
+
+static inline void lfl__rcu_free_retired(struct lfl__rcu_retired *taken, size_t n)
+{
+        for (size_t i = 0; i < n; i++)
+                lfl__node_free(taken[i].arena, taken[i].allocator, taken[i].node);
+        free(taken);
+}
+
+/**
+ * @brief free the nodes unlinked by helping traversals so far
+ *
+ *        waits for one grace period when anything is pending, so it must
+ *        not be called inside a read section. lfl_rcu_sweep does the same
+ *        as part of its own grace period.
+ *
+ * @return number of nodes freed
+ */
+static inline size_t lfl_rcu_reclaim(struct lfl_rcu *d)
+{
+        size_t n;
+        struct lfl__rcu_retired *taken = lfl__rcu_take(d, &n);
+
+        if (n)
+                lfl_rcu_synchronize(d);
+        lfl__rcu_free_retired(taken, n);
+        return n;
+}
+
+/**
+ * @brief unlink removed nodes, wait out current readers, then free them
+ *
+ *        like lfl_sweep, but readers inside lfl_rcu_read_lock need no
+ *        references: a node they may stand on is freed only after a grace
+ *        period. nodes that do hold references are still skipped. one
+ *        lfl_rcu_synchronize covers the whole batch, along with the nodes
+ *        retired by helping traversals before the sweep started.
+ *
+ * @param name    list type name
+ * @param inst    list instance name
+ * @param ref     reference-count field name (usually refcount)
+ * @param dom     struct lfl_rcu
+ * @param cleanup void (*)(lfl_type(name) *) called before freeing, or NULL
+ *
+ * @return 0, or -1 when the batch could not grow; the nodes unlinked so
+ *         far are still freed and the rest stay for the next sweep
+ */
+#define lfl_rcu_sweep(name, inst, ref, dom, cleanup) \
+        ({ \
+                struct lfl__rcu_batch _rcu_batch = { 0 }; \
+                void (*_rcu_cleanup)(struct name##_linked_list *) = (cleanup); \
+                size_t _rcu_nhelped; \
+                struct lfl__rcu_retired *_rcu_helped = lfl__rcu_take(&(dom), &_rcu_nhelped); \
+                lfl__sweep(name, inst, ref, _rcu_cleanup, 1, &_rcu_batch, NULL); \
+                if (_rcu_batch.n || _rcu_nhelped) \
+                        lfl_rcu_synchronize(&(dom)); \
+                lfl__rcu_free_retired(_rcu_helped, _rcu_nhelped); \
+                if (_rcu_batch.n) { \
+                        for (size_t _ri = 0; _ri < _rcu_batch.n; _ri++) { \
+                                struct name##_linked_list *_rn = _rcu_batch.node[_ri]; \
+                                if (_rcu_cleanup) \
+                                        _rcu_cleanup(_rn); \
+                                lfl_node_free(name, _rn); \
+                        } \
+                        lfl__stat(name, reclaimed, _rcu_batch.n); \
+                } \
+                free(_rcu_batch.node); \
+                _rcu_batch.failed ? -1 : 0; \
+        })
+
+/**
+ * @brief free a node already unlinked (e.g. popped) once readers are done
+ *
+ *        blocks for a grace period; batch with lfl_rcu_sweep when possible.
+ *
+ * @param name list type name
+ * @param dom  struct lfl_rcu
+ * @param ptr  unlinked node
+ */
+#define lfl_rcu_free(name, dom, ptr) \
+        do { \
+                lfl_rcu_synchronize(&(dom)); \
+                lfl_node_free(name, (ptr)); \
+        } while (0)
+
+/*
+ * unlink curr from prev (or the head) if it is removed, its ref field is
+ * zero and it is not the last node; evaluates to 1 when it was unlinked
+ * and retired. under the list's unlink token, a prev that is not removed
+ * cannot have been unlinked, so it is still in the chain and the CAS
+ * cannot strand curr. helping is skipped while another unlinker holds the
+ * list, and when the retired queue cannot grow.
+ */
+#define lfl__rcu_help(name, inst, ref, dom, prev, curr) \
+        ({ \
+                int _helped = 0; \
+                if (atomic_load_explicit(&(curr)->removed, memory_order_acquire) && \
+                    lfl__ref_load(name, curr, ref) == 0 && \
+                    atomic_load_explicit(&(curr)->next, memory_order_relaxed) && \
+                    lfl__token_trylock(&(inst##_unlinker))) { \
+                        lfl__rcu_lock(&(dom)); \
+                        if ((!(prev) || !atomic_load_explicit(&(prev)->removed, memory_order_acquire)) && \
+                            lfl__rcu_retire_reserve(&(dom)) == 0 && lfl__claim((curr), lfl__ref_off(name, ref))) { \
+                                struct name##_linked_list *_hexp = (curr); \
+                                struct name##_linked_list *_hnext = atomic_load_explicit(&(curr)->next, memory_order_acquire); \
+                                if (atomic_compare_exchange_strong_explicit((prev) ? &(prev)->next : &(inst##_head), \
+                                                                            &_hexp, _hnext, memory_order_acq_rel, \
+                                                                            memory_order_acquire)) { \
+                                        lfl__sweep_relink(name, inst, curr, prev, _hnext); \
+                                        lfl__rcu_retire(&(dom), (curr), lfl__arena(name), lfl__allocator(name)); \
+                                        lfl__stat(name, reclaimed, 1); \
+                                        _helped = 1; \
+                                } else { \
+                                        lfl__unclaim((curr), lfl__ref_off(name, ref)); \
+                                } \
+                        } \
+                        lfl__rcu_unlock(&(dom)); \
+                        lfl__token_unlock(&(inst##_unlinker)); \
+                } \
+                _helped; \
+        })
+
+/**
+ * @brief iterate live nodes, unlinking removed ones on the way past
+ *
+ *        must run inside lfl_rcu_read_lock(&dom). a removed node with no
+ *        references is unlinked from the predecessor just visited with one
+ *        CAS and retired to the domain, to be freed by the next
+ *        lfl_rcu_reclaim or lfl_rcu_sweep; no cleanup runs on it.
+ *
+ *        unlike a harris list there are no marked next pointers: a helper
+ *        takes the list's unlink token for each unlink, so the predecessor
+ *        it CASes cannot be unlinked underneath it. every sweep takes the
+ *        same token, and helping is skipped rather than waited for while
+ *        one holds it. the last node is left for appenders. pops and moves
+ *        do not take the token, so lists that are also popped or moved
+ *        from concurrently must not be helped.
+ *
+ * @param name list type name
+ * @param inst list instance name
+ * @param ref  reference-count field name (usually refcount)
+ * @param dom  struct lfl_rcu
+ * @param item loop variable
+ */
+#define lfl_foreach_help(name, inst, ref, dom, item) \
+        struct name##_linked_list *item##_prev = NULL, *item##_next = NULL, \
+                                  *item = atomic_load_explicit(&(inst##_head), memory_order_acquire); \
+        for (; item != NULL; item = item##_next) \
+                if ((item##_next = atomic_load_explicit(&(item->next), memory_order_acquire)), \
+                    !lfl__rcu_help(name, inst, ref, dom, item##_prev, item) && \
+                    ((item##_prev = item), !atomic_load_explicit(&(item->removed), memory_order_acquire)))
+
+/**
+ * @brief lfl_remove_if for lists read inside read sections of dom
+ *
+ *        matching runs are unlinked as by lfl_remove_if, but cleanup and
+ *        free wait for one grace period, so readers inside
+ *        lfl_rcu_read_lock(&dom) may stand on them without a reference.
+ *        the same grace period frees the nodes helping traversals retired
+ *        before the call. blocks like lfl_rcu_synchronize and must not be
+ *        called inside a read section. runs that find no room in the
+ *        grace-period batch stay marked for a later sweep.
+ *
+ * @param name    list type name
+ * @param inst    list instance name
+ * @param ref     reference-count field name (usually refcount)
+ * @param dom     struct lfl_rcu
+ * @param pred    int (*)(lfl_type(name) *item, void *ctx), nonzero to remove
+ * @param ctx     opaque pointer passed to pred
+ * @param cleanup void (*)(lfl_type(name) *) called before freeing, or NULL
+ *
+ * @return number of nodes newly marked removed
+ */
+#define lfl_rcu_remove_if(name, inst, ref, dom, pred, ctx, cleanup) \
+        ({ \
+                struct lfl__par _rif_par = { \
+                        .next_off = offsetof(struct name##_linked_list, next), \
+                        .prev_off = lfl__prev_off(name), \
+                        .removed_off = offsetof(struct name##_linked_list, removed), \
+                        .ref_off = lfl__ref_off(name, ref), \
+                }; \
+                struct lfl__rcu_batch _rif_batch = { 0 }; \
+                void (*_rif_cleanup)(struct name##_linked_list *) = (cleanup); \
+                size_t _rif_nhelped; \
+                struct lfl__rcu_retired *_rif_helped = lfl__rcu_take(&(dom), &_rif_nhelped); \
+                lfl__token_lock(&(inst##_unlinker)); \
+                long _rif_marked = lfl__remove_if(&_rif_par, (_Atomic(void *) *)&(inst##_head), \
+                                                  (int (*)(void *, void *))(int (*)(struct name##_linked_list *, void *))(pred), \
+                                                  (ctx), &_rif_batch); \
+                lfl__token_unlock(&(inst##_unlinker)); \
+                if (_rif_batch.n || _rif_nhelped) \
+                        lfl_rcu_synchronize(&(dom)); \
+                lfl__rcu_free_retired(_rif_helped, _rif_nhelped); \
+                for (size_t _ri = 0; _ri < _rif_batch.n; _ri++) { \
+                        struct name##_linked_list *_rn = _rif_batch.node[_ri]; \
+                        if (_rif_cleanup) \
+                                _rif_cleanup(_rn); \
+                        lfl_node_free(name, _rn); \
+                } \
+                free(_rif_batch.node); \
+                lfl__stat(name, removes, _rif_marked); \
+                lfl__stat(name, reclaimed, _rif_batch.n); \
+                _rif_marked; \
+        })
+
+static inline int lfl__cursor_rcu_enter(void *dom)
+{
+        return lfl_rcu_read_lock(dom);
+}
+
+static inline void lfl__cursor_rcu_leave(void *dom)
+{
+        lfl_rcu_read_unlock(dom);
+}
+
+/**
+ * @brief start a cursor whose steps run inside read sections of dom
+ *
+ *        the cursor may then be advanced while lfl_rcu_sweep or helping
+ *        traversals on dom unlink nodes. a step whose read section cannot
+ *        be entered ends the scan.
+ *
+ * @param name list type name
+ * @param inst list instance name
+ * @param cur  lfl_cursor to initialize
+ * @param dom  struct lfl_rcu
+ */
+#define lfl_rcu_cursor_init(name, inst, cur, dom) \
+        do { \
+                lfl_cursor_init(name, inst, cur); \
+                (cur).guard = &(dom); \
+                (cur).enter = lfl__cursor_rcu_enter; \
+                (cur).leave = lfl__cursor_rcu_leave; \
+        } while (0)
+
+/* hand back the claims compaction took on first up to, not including, stop */
+static inline void lfl__compact_unclaim(struct lfl__par *par, void *first, void *stop)
+{
+        while (first != stop) {
+                void *next = lfl__par_next(par, first);
+                lfl__unclaim(first, par->ref_off);
+                first = next;
+        }
+}
+
+/* drop the claim, or the pin when it was held, on the node compaction kept in place */
+static inline void lfl__compact_release_last(struct lfl__par *par, void *last, int pinned)
+{
+        if (pinned)
+                atomic_fetch_sub_explicit((_Atomic(int) *)((char *)last + par->ref_off), 1, memory_order_release);
+        else
+                lfl__unclaim(last, par->ref_off);
+}
+
+/*
+ * copy every live node before the last into one fresh arena run, chained
+ * in list order, and swing the head over to the copies. the last node stays
+ * in place so appenders are never disturbed. once a grace period has
+ * passed, the old nodes are freed: removed ones after cleanup, live ones
+ * without (their payload now belongs to the copies). returns the number of
+ * nodes relocated or a negative errno; *dropped receives removed nodes freed.
+ *
+ * every node before the last is claimed first, inside a read section so a
+ * concurrent rcu sweep cannot free the next one underneath. a claim only
+ * succeeds on an unreferenced node and keeps new pins and other unlinkers
+ * off it, so the copy needs no lock and the unlink token is held just for
+ * the head swing. the last node is claimed too, or pinned when a cursor
+ * holds it, so no sweep unlinks it once appends move past it. flavors
+ * without a reference count have nothing to claim and hold the token
+ * throughout instead.
+ */
+static inline long lfl__compact(struct lfl__par *par, struct lfl_rcu *d, _Atomic(void *) *head_p,
+                                _Atomic(int) *unlinker, size_t size, size_t *dropped)
+{
+        void *first, *expected, *last, *next, *run = NULL, *new_first;
+        int hold = par->ref_off == LFL__NO_OFF, last_pinned = 0;
+        size_t live = 0, i = 0;
+        long err = 0;
+
+        *dropped = 0;
+        if (lfl_rcu_read_lock(d))
+                return -ENOMEM;
+        if (hold)
+                lfl__token_lock(unlinker);
+        first = atomic_load_explicit(head_p, memory_order_acquire);
+        if (!first || !lfl__claim(first, par->ref_off)) {
+                err = first && lfl__par_next(par, first) ? -EBUSY : 0;
+                goto out;
+        }
+        for (last = first; (next = lfl__par_next(par, last)); last = next) {
+                if (!lfl__claim(next, par->ref_off)) {
+                        if (!lfl__par_next(par, next) && lfl__pin(next, par->ref_off)) {
+                                /* a pinned tail is kept in place anyway */
+                                live += !lfl__par_removed(par, last);
+                                last = next;
+                                last_pinned = 1;
+                                break;
+                        }
+                        lfl__compact_unclaim(par, first, next);
+                        err = -EBUSY;
+                        goto out;
+                }
+                live += !lfl__par_removed(par, last);
+        }
+        if (first == last || (live && !(run = lfl_arena_alloc_run(par->arena, live)))) {
+                lfl__compact_unclaim(par, first, last);
+                lfl__compact_release_last(par, last, last_pinned);
+                err = first == last ? 0 : -ENOMEM;
+                goto out;
+        }
+        for (void *p = first; p != last; p = lfl__par_next(par, p)) {
+                char *copy;
+                if (lfl__par_removed(par, p))
+                        continue;
+                copy = (char *)run + i * par->arena->slot;
+                memcpy(copy, p, size);
+                atomic_store_explicit((_Atomic(void *) *)(copy + par->next_off),
+                                      i + 1 < live ? copy + par->arena->slot : last, memory_order_relaxed);
+                if (par->prev_off != LFL__NO_OFF)
+                        atomic_store_explicit(lfl__par_prev(par, copy), i ? copy - par->arena->slot : NULL,
+                                              memory_order_relaxed);
+                if (par->ref_off != LFL__NO_OFF)
+                        atomic_store_explicit((_Atomic(int) *)(copy + par->ref_off), 0, memory_order_relaxed);
+                i++;
+        }
+        new_first = live ? run : last;
+        expected = first;
+        if (!hold)
+                lfl__token_lock(unlinker);
+        if (!atomic_compare_exchange_strong_explicit(head_p, &expected, new_first, memory_order_acq_rel,
+                                                     memory_order_acquire)) {
+                lfl__token_unlock(unlinker);
+                for (i = 0; i < live; i++)
+                        lfl_arena_free(par->arena, (char *)run + i * par->arena->slot);
+                lfl__compact_unclaim(par, first, last);
+                lfl__compact_release_last(par, last, last_pinned);
+                lfl_rcu_read_unlock(d);
+                return -EAGAIN;
+        }
+        if (par->prev_off != LFL__NO_OFF)
+                atomic_store_explicit(lfl__par_prev(par, last),
+                                      live ? (char *)run + (live - 1) * par->arena->slot : NULL,
+                                      memory_order_release);
+        lfl__token_unlock(unlinker);
+        lfl__compact_release_last(par, last, last_pinned);
+        lfl_rcu_read_unlock(d);
+
+        lfl_rcu_synchronize(d);
+        while (first != last) {
+                next = lfl__par_next(par, first);
+                if (lfl__par_removed(par, first)) {
+                        if (par->on_reap)
+                                par->on_reap(first);
+                        (*dropped)++;
+                }
+                lfl__node_free(par->arena, par->allocator, first);
+                first = next;
+        }
+        return (long)live;
+out:
+        if (hold)
+                lfl__token_unlock(unlinker);
+        lfl_rcu_read_unlock(d);
+        return err;
+}
+
+/**
+ * @brief relocate a list's nodes into one contiguous arena run, in order
+ *
+ *        copies every live node except the last into consecutive fresh
+ *        slots of the type's bound arena and swings the head over, so a
+ *        traversal walks memory sequentially again. removed nodes are
+ *        dropped along the way. old nodes are freed after a grace period
+ *        of dom, which means the call blocks like lfl_rcu_synchronize and
+ *        must not be made inside a read section.
+ *
+ *        nodes change address: concurrent readers must traverse inside
+ *        lfl_rcu_read_lock(&dom) and may not keep node pointers past their
+ *        read section. the last node stays put, so appenders may keep
+ *        running if they add inside a read section too (they may still
+ *        hold an old tail). adding at the head, removing, popping, moving or
+ *        sweeping the list concurrently is not allowed, except helping
+ *        traversals and lfl_rcu_sweep through the same domain.
+ *
+ *        the copy needs the list quiescent: every node before the last is
+ *        claimed like a sweep claims it, so a referenced node fails the
+ *        call with -EBUSY and no reference can be taken until the head has
+ *        moved. payload writes made without a reference are lost. the
+ *        unlink token is held only for the head swing, except for flavors
+ *        without a reference count, which hold it throughout.
+ *
+ * @param name    list type name (with an arena bound by lfl_arena_bind)
+ * @param inst    list instance name
+ * @param ref     field name of atomic refcount in the node
+ * @param dom     struct lfl_rcu
+ * @param cleanup void (*)(lfl_type(name) *) for dropped removed nodes, or NULL
+ * @param out     long receiving the number of nodes relocated, or a negative
+ *                errno: -EINVAL without a bound arena, -ENOMEM when the arena
+ *                has no room for the run, -EBUSY when a node before the
+ *                last holds a reference or is being unlinked, -EAGAIN when
+ *                the head changed underneath
+ */
+#define lfl_compact(name, inst, ref, dom, cleanup, out) \
+        do { \
+                void (*_compact_cleanup)(struct name##_linked_list *) = (cleanup); \
+                struct lfl__par _compact_par = { \
+                        .next_off = offsetof(struct name##_linked_list, next), \
+                        .removed_off = offsetof(struct name##_linked_list, removed), \
+                        .prev_off = lfl__prev_off(name), \
+                        .ref_off = lfl__ref_off(name, ref), \
+                        .on_reap = (void (*)(void *))_compact_cleanup, \
+                        .arena = lfl__arena(name), \
+                        .allocator = lfl__allocator(name), \
+                }; \
+                size_t _compact_dropped = 0; \
+                out = lfl__arena(name) ? lfl__compact(&_compact_par, &(dom), (_Atomic(void *) *)&(inst##_head), \
+                                                      &(inst##_unlinker), sizeof(lfl_type(name)), \
+                                                      &_compact_dropped) \
+                                       : -EINVAL; \
+                lfl__stat(name, reclaimed, _compact_dropped); \
+        } while (0)
+
+#endif /* LFL_RCU_H */
@@ -21,9 +21,10 @@ void *producer_thread(void *arg)
 {
         int counter = 0;
         while (atomic_load(&keep_running)) {
-                lfl_add_head(test, workqueue, node);
-                node->id = ++counter;
-                node->created = time(NULL);
+                lfl_add_head_init(test, workqueue, node, {
+                        node->id = ++counter;
+                        node->created = time(NULL);
+                });
 
                 int delay_ms = 1 + rand() % 10;
                 usleep(delay_ms * 1000);
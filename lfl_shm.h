@@ -0,0 +1,938 @@
+#ifndef LFL_SHM_H
+#define LFL_SHM_H
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "lock_free_list.h"
+
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 Michael Miller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @brief queues shared between processes, and their persistence
+ *
+ *        segments are shm_open, memfd or file mappings. slot owners are
+ *        identified through /proc, so reaping dead processes' slots is
+ *        linux-only.
+ */
+
+/**
+ * @brief shared-memory queue segments
+ *
+ *        a segment is a single mapping (shm_open, memfd or a regular file)
+ *        that holds a header, a fixed number of node slots and the queue
+ *        itself, so any process that maps it can enqueue and dequeue. raw
+ *        pointers mean nothing across processes, so every link is a slot
+ *        offset from the segment base packed with a 32-bit tag:
+ *
+ *            link = tag << 32 | (slot index + 1)
+ *
+ *        the queue is a michael-scott queue over those tagged links and the
+ *        in-segment allocator is the same tagged free stack used by the node
+ *        arena, so recycled slots never cause ABA. nothing ever blocks, and a
+ *        tail left lagging by a dead enqueuer is helped forward by the next
+ *        operation.
+ *
+ *        every slot also carries a tagged owner word naming the process
+ *        responsible for it while it is off the queue and off the free
+ *        stack: the allocator from lfl_shm_new until the enqueue has linked
+ *        it, and the dequeuer from the head CAS until the old dummy is back
+ *        on the free stack. each hand-over is a CAS on that word, so a
+ *        process that dies anywhere in between leaves a slot lfl_shm_reap
+ *        can tell apart from one still in use.
+ *
+ *        a bare pid cannot name that process: pids are recycled, and a
+ *        process in another pid namespace sees a different number. so the
+ *        owner word holds an index into a process table in the header, and
+ *        each entry records the pid together with the process start time
+ *        from /proc/<pid>/stat and the inode of its pid namespace.
+ */
+#define LFL_SHM_MAGIC 0x6c666c73686d3033ULL /* "lflshm03" */
+
+/* processes that can hold slots of one segment at the same time */
+#define LFL_SHM_PROCS 256
+
+/* a process that has used the segment, identified across pid reuse */
+struct lfl_shm_proc {
+        _Atomic(int32_t) pid;                   /* 0 while the entry is free */
+        _Atomic(uint64_t) start;                /* start time in clock ticks + 1, 0 while registering */
+        _Atomic(uint64_t) ns;                   /* inode of the pid namespace */
+};
+
+struct lfl_shm_hdr {
+        uint64_t magic;
+        uint64_t size;                          /* mapping length in bytes */
+        uint64_t slot;                          /* bytes per node slot */
+        uint64_t capacity;                      /* number of slots */
+        uint64_t data;                          /* offset of slot 0 */
+        _Alignas(64) _Atomic(uint64_t) head;    /* tagged link of the dummy node */
+        _Alignas(64) _Atomic(uint64_t) tail;    /* tagged link of the last node */
+        _Alignas(64) _Atomic(uint64_t) bump;    /* next never-used slot */
+        _Atomic(uint64_t) free_top;             /* tagged free stack */
+        struct lfl_shm_proc proc[LFL_SHM_PROCS];
+};
+
+/* link header at the start of every shared-memory node */
+struct lfl_shm_link {
+        _Atomic(uint64_t) next;                 /* tagged link to the successor */
+        _Atomic(uint64_t) owner;                /* tag << 32 | proc entry + 1, negated for a reaper's claim */
+        _Atomic(uint32_t) free;                 /* free stack link while unused */
+};
+
+/* per-process view of a mapped segment */
+struct lfl_shm {
+        struct lfl_shm_hdr *hdr;
+        char *base;
+        size_t len;
+        int fd;
+        _Atomic(uint64_t) self;                 /* pid << 32 | proc entry + 1 of this process */
+};
+
+/* pid of this process for node ownership, reset in children after fork */
+static _Atomic(int32_t) lfl__shm_pid_cache;
+static pthread_once_t lfl__shm_pid_once = PTHREAD_ONCE_INIT;
+
+static inline void lfl__shm_pid_reset(void)
+{
+        atomic_store_explicit(&lfl__shm_pid_cache, 0, memory_order_relaxed);
+}
+
+static inline void lfl__shm_pid_register(void)
+{
+        pthread_atfork(NULL, NULL, lfl__shm_pid_reset);
+}
+
+static inline int32_t lfl__shm_pid(void)
+{
+        int32_t pid = atomic_load_explicit(&lfl__shm_pid_cache, memory_order_relaxed);
+
+        if (!pid) {
+                pid = (int32_t)getpid();
+                atomic_store_explicit(&lfl__shm_pid_cache, pid, memory_order_relaxed);
+        }
+        return pid;
+}
+
+/* start time of pid in clock ticks since boot, plus one; 0 if it is gone */
+static inline uint64_t lfl__shm_start_time(int32_t pid)
+{
+        char path[32], buf[1024], *p;
+        ssize_t len;
+        int fd;
+
+        snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+                return 0;
+        len = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (len <= 0)
+                return 0;
+        buf[len] = '\0';
+        /* the command name may contain spaces and parentheses; field 3 follows the last ')' */
+        p = strrchr(buf, ')');
+        for (int field = 2; p && field < 22; field++)
+                p = strchr(p + 1, ' ');
+        return p ? strtoull(p + 1, NULL, 10) + 1 : 0;
+}
+
+/* inode of the pid namespace this process sees, 0 if unknown */
+static inline uint64_t lfl__shm_pidns(void)
+{
+        struct stat st;
+
+        return stat("/proc/self/ns/pid", &st) == 0 ? (uint64_t)st.st_ino : 0;
+}
+
+/**
+ * @brief proc entry of this process, registering one on first use
+ *
+ *        a child inherits the handle but not the identity, so a pid that
+ *        no longer matches the handle registers a fresh entry.
+ *
+ * @return entry index + 1, or 0 when the table is full
+ */
+static inline int32_t lfl__shm_self(struct lfl_shm *seg)
+{
+        int32_t pid = lfl__shm_pid();
+        uint64_t self = atomic_load_explicit(&seg->self, memory_order_acquire);
+        uint64_t start;
+
+        if (self >> 32 == (uint32_t)pid)
+                return (int32_t)(uint32_t)self;
+        start = lfl__shm_start_time(pid);
+        for (int32_t i = 0; i < LFL_SHM_PROCS; i++) {
+                struct lfl_shm_proc *e = &seg->hdr->proc[i];
+                int32_t none = 0;
+
+                if (atomic_load_explicit(&e->pid, memory_order_relaxed) ||
+                    !atomic_compare_exchange_strong_explicit(&e->pid, &none, pid,
+                                                             memory_order_acq_rel, memory_order_relaxed))
+                        continue;
+                atomic_store_explicit(&e->ns, lfl__shm_pidns(), memory_order_relaxed);
+                /* without /proc the start time is unknown; UINT64_MAX falls back to kill() */
+                atomic_store_explicit(&e->start, start ? start : UINT64_MAX, memory_order_release);
+                if (atomic_compare_exchange_strong_explicit(&seg->self, &self, (uint64_t)pid << 32 | (uint32_t)(i + 1),
+                                                            memory_order_acq_rel, memory_order_acquire))
+                        return i + 1;
+                /* another thread of this process registered first */
+                atomic_store_explicit(&e->start, 0, memory_order_relaxed);
+                atomic_store_explicit(&e->pid, 0, memory_order_release);
+                return (int32_t)(uint32_t)self;
+        }
+        return 0;
+}
+
+/* free the entry if it still describes the process that started at start */
+static inline void lfl__shm_unregister(struct lfl_shm_proc *e, uint64_t start)
+{
+        if (start && atomic_compare_exchange_strong_explicit(&e->start, &start, 0,
+                                                             memory_order_acq_rel, memory_order_relaxed))
+                atomic_store_explicit(&e->pid, 0, memory_order_release);
+}
+
+/* whether the process behind an entry may still be running; *start gets the incarnation judged */
+static inline int lfl__shm_alive(struct lfl_shm_proc *e, uint64_t ns, uint64_t *start)
+{
+        int32_t pid;
+
+        *start = atomic_load_explicit(&e->start, memory_order_acquire);
+        pid = atomic_load_explicit(&e->pid, memory_order_relaxed);
+        if (!*start)
+                return pid != 0;                /* still registering */
+        if (atomic_load_explicit(&e->ns, memory_order_relaxed) != ns)
+                return 1;                       /* its pid means nothing in this namespace */
+        if (*start == UINT64_MAX)
+                return kill(pid, 0) == 0 || errno != ESRCH;
+        return lfl__shm_start_time(pid) == *start;
+}
+
+#define lfl__shm_idx(l) ((uint32_t)(l))
+#define lfl__shm_tag(l) ((l) >> 32)
+#define lfl__shm_pack(tag, idx) (((uint64_t)(tag) << 32) | (uint32_t)(idx))
+
+static inline struct lfl_shm_link *lfl__shm_node(struct lfl_shm *seg, uint32_t idx)
+{
+        return (struct lfl_shm_link *)(seg->base + seg->hdr->data + (uint64_t)(idx - 1) * seg->hdr->slot);
+}
+
+static inline uint32_t lfl__shm_index(struct lfl_shm *seg, const void *p)
+{
+        return (uint32_t)(((const char *)p - (seg->base + seg->hdr->data)) / seg->hdr->slot) + 1;
+}
+
+#define lfl__shm_holder(o) ((int32_t)(uint32_t)(o))
+
+/* hand a slot over to a proc entry if its owner word still reads expect */
+static inline int lfl__shm_claim(struct lfl_shm_link *n, uint64_t expect, int32_t holder)
+{
+        return atomic_compare_exchange_strong_explicit(&n->owner, &expect,
+                                                       lfl__shm_pack(lfl__shm_tag(expect) + 1, (uint32_t)holder),
+                                                       memory_order_acq_rel, memory_order_relaxed);
+}
+
+static inline void lfl__shm_push_free(struct lfl_shm *seg, void *p)
+{
+        struct lfl_shm_hdr *h = seg->hdr;
+
+        lfl__slab_push(&h->free_top, seg->base + h->data, h->slot, offsetof(struct lfl_shm_link, free), p);
+}
+
+/**
+ * @brief allocate a node slot inside the segment
+ *
+ *        the owner word is read before the slot leaves the free stack and
+ *        claimed right after, so a reaper that recycles a slot whose
+ *        allocator died in between makes the claim fail instead of handing
+ *        the slot out twice.
+ *
+ * @return zeroed payload with its owner set to this process, or NULL when
+ *         the segment or its process table is full
+ */
+static inline void *lfl__shm_alloc(struct lfl_shm *seg)
+{
+        struct lfl_shm_hdr *h = seg->hdr;
+        struct lfl_shm_link *n;
+        int32_t self = lfl__shm_self(seg);
+        uint64_t top, o;
+
+        if (!self)
+                return NULL;
+        for (;;) {
+                n = NULL;
+                top = atomic_load_explicit(&h->free_top, memory_order_acquire);
+                while ((uint32_t)top) {
+                        struct lfl_shm_link *c = lfl__shm_node(seg, (uint32_t)top);
+                        uint32_t next = atomic_load_explicit(&c->free, memory_order_relaxed);
+                        o = atomic_load_explicit(&c->owner, memory_order_relaxed);
+                        if (atomic_compare_exchange_weak_explicit(&h->free_top, &top,
+                                                                  lfl__shm_pack(lfl__shm_tag(top) + 1, next),
+                                                                  memory_order_acquire, memory_order_acquire)) {
+                                n = c;
+                                break;
+                        }
+                }
+                if (!n) {
+                        uint64_t s = atomic_fetch_add_explicit(&h->bump, 1, memory_order_relaxed);
+                        if (s >= h->capacity)
+                                return NULL;
+                        n = lfl__shm_node(seg, (uint32_t)s + 1);
+                        o = 0;                  /* fresh slots start zeroed */
+                }
+                if (lfl__shm_claim(n, o, self))
+                        break;
+                /* a reaper recycled the slot in the meantime; it is back on the stack */
+        }
+        memset((char *)n + sizeof(*n), 0, h->slot - sizeof(*n));
+        return n;
+}
+
+/* return a slot this process owns to the free stack */
+static inline void lfl__shm_free(struct lfl_shm *seg, void *p)
+{
+        lfl__shm_push_free(seg, p);
+}
+
+/* free the old dummy after a dequeue, unless a reaper already took it */
+static inline void lfl__shm_retire(struct lfl_shm *seg, struct lfl_shm_link *n)
+{
+        uint64_t o = atomic_load_explicit(&n->owner, memory_order_acquire);
+        int32_t self = lfl__shm_self(seg);
+
+        do {
+                if (lfl__shm_holder(o) < 0)
+                        return;
+        } while (!atomic_compare_exchange_weak_explicit(&n->owner, &o,
+                                                        lfl__shm_pack(lfl__shm_tag(o) + 1, (uint32_t)self),
+                                                        memory_order_acq_rel, memory_order_acquire));
+        lfl__shm_push_free(seg, n);
+}
+
+/**
+ * @brief lay out an empty segment on an open descriptor and map it
+ *
+ * @param seg       per-process handle to fill in
+ * @param fd        shm_open, memfd or file descriptor; owned by seg afterwards
+ * @param node_size size of one node, normally sizeof(lfl_shm_type(name))
+ * @param capacity  number of node slots
+ *
+ * @return 0 on success, -1 with errno set on failure
+ */
+static inline int lfl__shm_format(struct lfl_shm *seg, int fd, size_t node_size, size_t capacity)
+{
+        size_t align = _Alignof(max_align_t);
+        size_t slot = (node_size + align - 1) & ~(align - 1);
+        size_t data = (sizeof(struct lfl_shm_hdr) + 63) & ~(size_t)63;
+        size_t len = data + slot * (capacity + 1);
+        struct lfl_shm_hdr *h;
+        struct lfl_shm_link *dummy;
+
+        /* truncating to zero first guarantees every slot starts zeroed */
+        if (capacity == 0 || capacity > UINT32_MAX - 2 || ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t)len) != 0)
+                return -1;
+        h = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (h == MAP_FAILED)
+                return -1;
+        seg->hdr = h;
+        seg->base = (char *)h;
+        seg->len = len;
+        seg->fd = fd;
+        atomic_init(&seg->self, 0);
+        pthread_once(&lfl__shm_pid_once, lfl__shm_pid_register);
+        h->size = len;
+        h->slot = slot;
+        h->capacity = capacity + 1;             /* one slot is the queue's dummy */
+        h->data = data;
+        atomic_init(&h->bump, 0);
+        atomic_init(&h->free_top, 0);
+        dummy = lfl__shm_alloc(seg);
+        atomic_store_explicit(&dummy->owner, lfl__shm_pack(1, 0), memory_order_relaxed);
+        atomic_init(&h->head, lfl__shm_pack(0, lfl__shm_index(seg, dummy)));
+        atomic_init(&h->tail, lfl__shm_pack(0, lfl__shm_index(seg, dummy)));
+        atomic_thread_fence(memory_order_release);
+        h->magic = LFL_SHM_MAGIC;
+        return 0;
+}
+
+/**
+ * @brief map an existing segment from an open descriptor
+ *
+ * @param flags MAP_SHARED, or MAP_PRIVATE for a copy-on-write view
+ *
+ * @return 0 on success, -1 if the descriptor does not hold a segment
+ */
+static inline int lfl__shm_attach(struct lfl_shm *seg, int fd, int flags)
+{
+        struct stat st;
+        struct lfl_shm_hdr *h;
+
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*h))
+                return -1;
+        h = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, flags, fd, 0);
+        if (h == MAP_FAILED)
+                return -1;
+        if (h->magic != LFL_SHM_MAGIC || h->size != (uint64_t)st.st_size) {
+                munmap(h, (size_t)st.st_size);
+                errno = EINVAL;
+                return -1;
+        }
+        seg->hdr = h;
+        seg->base = (char *)h;
+        seg->len = (size_t)st.st_size;
+        seg->fd = fd;
+        atomic_init(&seg->self, 0);
+        pthread_once(&lfl__shm_pid_once, lfl__shm_pid_register);
+        return 0;
+}
+
+/**
+ * @brief create a segment, named via shm_open or anonymous via memfd
+ *
+ * @param path      shm_open name ("/foo") or NULL for an anonymous memfd
+ *                  that is shared with children across fork
+ *
+ * @return 0 on success, -1 on failure
+ */
+static inline int lfl__shm_create(struct lfl_shm *seg, const char *path, size_t node_size, size_t capacity)
+{
+        int fd = path ? shm_open(path, O_CREAT | O_EXCL | O_RDWR, 0600)
+                      : (int)syscall(SYS_memfd_create, "lfl_shm", 0);
+
+        if (fd < 0)
+                return -1;
+        if (lfl__shm_format(seg, fd, node_size, capacity) != 0) {
+                close(fd);
+                if (path)
+                        shm_unlink(path);
+                return -1;
+        }
+        return 0;
+}
+
+static inline int lfl__shm_open(struct lfl_shm *seg, const char *path)
+{
+        int fd = shm_open(path, O_RDWR, 0);
+
+        if (fd < 0)
+                return -1;
+        if (lfl__shm_attach(seg, fd, MAP_SHARED) != 0) {
+                close(fd);
+                return -1;
+        }
+        return 0;
+}
+
+/* unmap the segment and close its descriptor; the segment itself persists */
+static inline void lfl__shm_close(struct lfl_shm *seg)
+{
+        uint64_t self = atomic_load_explicit(&seg->self, memory_order_acquire);
+
+        /* slots this process still holds become reapable */
+        if (seg->hdr && self >> 32 == (uint32_t)lfl__shm_pid() && (uint32_t)self) {
+                struct lfl_shm_proc *e = &seg->hdr->proc[(uint32_t)self - 1];
+                lfl__shm_unregister(e, atomic_load_explicit(&e->start, memory_order_acquire));
+        }
+        if (seg->hdr)
+                munmap(seg->hdr, seg->len);
+        if (seg->fd >= 0)
+                close(seg->fd);
+        seg->hdr = NULL;
+        seg->base = NULL;
+        seg->fd = -1;
+}
+
+/* michael-scott enqueue over tagged slot links */
+static inline void lfl__shm_enqueue(struct lfl_shm *seg, void *p)
+{
+        struct lfl_shm_hdr *h = seg->hdr;
+        struct lfl_shm_link *n = p;
+        uint32_t idx = lfl__shm_index(seg, n);
+        uint64_t nl = atomic_load_explicit(&n->next, memory_order_relaxed);
+        uint64_t own = atomic_load_explicit(&n->owner, memory_order_relaxed);
+        uint64_t tail, next;
+
+        atomic_store_explicit(&n->next, lfl__shm_pack(lfl__shm_tag(nl) + 1, 0), memory_order_relaxed);
+        for (;;) {
+                tail = atomic_load_explicit(&h->tail, memory_order_acquire);
+                next = atomic_load_explicit(&lfl__shm_node(seg, lfl__shm_idx(tail))->next, memory_order_acquire);
+                if (tail != atomic_load_explicit(&h->tail, memory_order_acquire))
+                        continue;
+                if (lfl__shm_idx(next) == 0) {
+                        if (atomic_compare_exchange_weak_explicit(&lfl__shm_node(seg, lfl__shm_idx(tail))->next, &next,
+                                                                  lfl__shm_pack(lfl__shm_tag(next) + 1, idx),
+                                                                  memory_order_release, memory_order_relaxed))
+                                break;
+                } else {
+                        atomic_compare_exchange_weak_explicit(&h->tail, &tail,
+                                                              lfl__shm_pack(lfl__shm_tag(tail) + 1, lfl__shm_idx(next)),
+                                                              memory_order_release, memory_order_relaxed);
+                }
+        }
+        /* linked: the node belongs to the queue now. a dequeuer may already have taken it over */
+        lfl__shm_claim(n, own, 0);
+        atomic_compare_exchange_strong_explicit(&h->tail, &tail, lfl__shm_pack(lfl__shm_tag(tail) + 1, idx),
+                                                memory_order_release, memory_order_relaxed);
+}
+
+/**
+ * @brief michael-scott dequeue; copies the payload out of the new dummy
+ *
+ * @param out  destination node; only the fields after the link are written
+ * @param size size of the node type
+ *
+ * @return 1 if a node was dequeued, 0 if the queue was empty
+ */
+static inline int lfl__shm_dequeue(struct lfl_shm *seg, void *out, size_t size)
+{
+        struct lfl_shm_hdr *h = seg->hdr;
+        uint64_t head, tail, next;
+
+        for (;;) {
+                head = atomic_load_explicit(&h->head, memory_order_acquire);
+                tail = atomic_load_explicit(&h->tail, memory_order_acquire);
+                next = atomic_load_explicit(&lfl__shm_node(seg, lfl__shm_idx(head))->next, memory_order_acquire);
+                if (head != atomic_load_explicit(&h->head, memory_order_acquire))
+                        continue;
+                if (lfl__shm_idx(head) == lfl__shm_idx(tail)) {
+                        if (lfl__shm_idx(next) == 0)
+                                return 0;
+                        atomic_compare_exchange_weak_explicit(&h->tail, &tail,
+                                                              lfl__shm_pack(lfl__shm_tag(tail) + 1, lfl__shm_idx(next)),
+                                                              memory_order_release, memory_order_relaxed);
+                        continue;
+                }
+                memcpy((char *)out + sizeof(struct lfl_shm_link),
+                       (char *)lfl__shm_node(seg, lfl__shm_idx(next)) + sizeof(struct lfl_shm_link),
+                       size - sizeof(struct lfl_shm_link));
+                if (atomic_compare_exchange_weak_explicit(&h->head, &head,
+                                                          lfl__shm_pack(lfl__shm_tag(head) + 1, lfl__shm_idx(next)),
+                                                          memory_order_acq_rel, memory_order_relaxed))
+                        break;
+        }
+        lfl__shm_retire(seg, lfl__shm_node(seg, lfl__shm_idx(head)));
+        return 1;
+}
+
+/*
+ * mark the slots reachable from *top through the link at link_off (the
+ * free stack or the queue chain). the walk only counts when *top still
+ * holds the same tagged value afterwards; returns 0 after too many retries.
+ */
+static inline int lfl__shm_mark(struct lfl_shm *seg, _Atomic(uint64_t) *top, size_t link_off, int wide,
+                                unsigned char *mark, unsigned char bit, uint64_t used)
+{
+        for (int tries = 0; tries < 64; tries++) {
+                uint64_t t = atomic_load_explicit(top, memory_order_acquire);
+                uint64_t steps = 0;
+
+                for (uint64_t i = 1; i <= used; i++)
+                        mark[i] &= (unsigned char)~bit;
+                for (uint32_t i = (uint32_t)t; i && i <= used && steps++ <= used;) {
+                        char *n = (char *)lfl__shm_node(seg, i);
+                        mark[i] |= bit;
+                        i = wide ? lfl__shm_idx(atomic_load_explicit((_Atomic(uint64_t) *)(n + link_off), memory_order_acquire))
+                                 : atomic_load_explicit((_Atomic(uint32_t) *)(n + link_off), memory_order_acquire);
+                }
+                if (atomic_load_explicit(top, memory_order_acquire) == t)
+                        return 1;
+        }
+        return 0;
+}
+
+/**
+ * @brief return slots stranded by processes that no longer exist
+ *
+ *        a slot is stranded when it is neither on the free stack nor
+ *        reachable from the queue head, and its owner word names no live
+ *        process: an allocator or dequeuer died holding it, or died between
+ *        the structural CAS and the ownership hand-over. a process counts
+ *        as dead once its pid is gone or now belongs to a process with a
+ *        different start time; entries registered from another pid
+ *        namespace are left alone, since their pids cannot be checked from
+ *        here. owners are read and checked before the free stack and the
+ *        queue are walked, and every slot is taken with a CAS on its owner
+ *        word, so a concurrent operation that gets there first simply wins.
+ *        queued nodes whose enqueuer died before clearing its ownership are
+ *        handed to the queue. after a full pass the table entries of dead
+ *        processes are freed for reuse. safe while other processes keep
+ *        working; under sustained traffic the walks may not settle, and the
+ *        call returns 0 with errno set to EAGAIN.
+ *
+ * @return number of slots returned to the free stack
+ */
+static inline size_t lfl__shm_reap(struct lfl_shm *seg)
+{
+        struct lfl_shm_hdr *h = seg->hdr;
+        uint64_t used = atomic_load_explicit(&h->bump, memory_order_acquire);
+        int32_t self = lfl__shm_self(seg);
+        uint64_t ns = lfl__shm_pidns();
+        uint64_t start[LFL_SHM_PROCS];
+        unsigned char alive[LFL_SHM_PROCS];
+        unsigned char *mark;
+        uint64_t *owner;
+        size_t reaped = 0, cands = 0;
+
+        if (used > h->capacity)
+                used = h->capacity;
+        mark = calloc(used + 1, 1);
+        owner = malloc((used + 1) * sizeof(*owner));
+        if (!mark || !owner)
+                goto out;
+        for (uint64_t i = 1; i <= used; i++)
+                owner[i] = atomic_load_explicit(&lfl__shm_node(seg, (uint32_t)i)->owner, memory_order_acquire);
+        /* an entry only changes hands after its process died, so judging it after the owners were read is safe */
+        for (int32_t e = 0; e < LFL_SHM_PROCS; e++)
+                alive[e] = e + 1 == self || lfl__shm_alive(&h->proc[e], ns, &start[e]);
+        for (uint64_t i = 1; i <= used; i++) {
+                int32_t holder = lfl__shm_holder(owner[i]) < 0 ? -lfl__shm_holder(owner[i]) : lfl__shm_holder(owner[i]);
+                if (holder > LFL_SHM_PROCS || (holder && alive[holder - 1]))
+                        continue;
+                mark[i] = 1;
+                cands++;
+        }
+        if (cands && (!lfl__shm_mark(seg, &h->free_top, offsetof(struct lfl_shm_link, free), 0, mark, 2, used) ||
+                      !lfl__shm_mark(seg, &h->head, offsetof(struct lfl_shm_link, next), 1, mark, 4, used))) {
+                errno = EAGAIN;
+                goto out;
+        }
+        for (uint64_t i = 1; i <= used; i++) {
+                struct lfl_shm_link *n = lfl__shm_node(seg, (uint32_t)i);
+                if (!(mark[i] & 1) || (mark[i] & 2))
+                        continue;
+                if (mark[i] & 4) {
+                        if (lfl__shm_holder(owner[i]))
+                                lfl__shm_claim(n, owner[i], 0);
+                } else if (lfl__shm_claim(n, owner[i], -self)) {
+                        lfl__shm_push_free(seg, n);
+                        reaped++;
+                }
+        }
+        for (int32_t e = 0; e < LFL_SHM_PROCS; e++)
+                if (!alive[e])
+                        lfl__shm_unregister(&h->proc[e], start[e]);
+out:
+        free(mark);
+        free(owner);
+        return reaped;
+}
+
+/**
+ * @brief map a file-backed segment, formatting the file if it is new
+ *
+ *        the live queue is the file: every change lands in the page cache
+ *        and survives a process restart without any reload. a segment left
+ *        by a crashed process is usable as-is; lfl_shm_reap reclaims the
+ *        nodes it was holding.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static inline int lfl__shm_map_file(struct lfl_shm *seg, const char *path, size_t node_size, size_t capacity)
+{
+        int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        struct stat st;
+
+        if (fd < 0)
+                return -1;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                if (lfl__shm_attach(seg, fd, MAP_SHARED) == 0)
+                        return 0;
+        } else if (lfl__shm_format(seg, fd, node_size, capacity) == 0) {
+                return 0;
+        }
+        close(fd);
+        return -1;
+}
+
+/**
+ * @brief write a crash-consistent image of a segment to path
+ *
+ *        the used part of the segment is copied while it stays live. the
+ *        copy is only accepted if no dequeue happened meanwhile (the tagged
+ *        head is unchanged), which guarantees the chain from head to the
+ *        tail read beforehand is intact; later enqueues are cut off. the
+ *        image is then normalized: every slot off the chain goes back on the
+ *        free stack, and owners and the process table are cleared. it is
+ *        written to a temporary file, fsync'd and renamed over path, so a
+ *        crash leaves either the old image or the new one.
+ *
+ * @return 0 on success, -1 with errno set on failure (EAGAIN under
+ *         sustained dequeue traffic)
+ */
+static inline int lfl__shm_snapshot(struct lfl_shm *seg, const char *path)
+{
+        struct lfl_shm_hdr *h = seg->hdr;
+        uint64_t head = 0, tail = 0, used = 0;
+        size_t len = 0;
+        char *img = NULL, *tmp = NULL;
+        unsigned char *live = NULL;
+        int fd = -1, rc = -1, tries;
+
+        for (tries = 0; tries < 64; tries++) {
+                head = atomic_load_explicit(&h->head, memory_order_acquire);
+                tail = atomic_load_explicit(&h->tail, memory_order_acquire);
+                used = atomic_load_explicit(&h->bump, memory_order_acquire);
+                if (used > h->capacity)
+                        used = h->capacity;
+                len = h->data + used * h->slot;
+                free(img);
+                img = malloc(len);
+                if (!img)
+                        goto out;
+                memcpy(img, seg->base, len);
+                if (atomic_load_explicit(&h->head, memory_order_acquire) == head)
+                        break;
+        }
+        if (tries == 64) {
+                errno = EAGAIN;
+                goto out;
+        }
+
+        /* normalize the copy: mark the chain, free everything else */
+        struct lfl_shm_hdr *ih = (struct lfl_shm_hdr *)img;
+        struct lfl_shm seg_img = { .hdr = ih, .base = img, .len = len, .fd = -1 };
+        live = calloc(used + 1, 1);
+        if (!live)
+                goto out;
+        for (uint32_t i = lfl__shm_idx(head); i; ) {
+                struct lfl_shm_link *n = lfl__shm_node(&seg_img, i);
+                uint64_t next = atomic_load_explicit(&n->next, memory_order_relaxed);
+                live[i] = 1;
+                if (i == lfl__shm_idx(tail) || lfl__shm_idx(next) > used) {
+                        atomic_store_explicit(&n->next, lfl__shm_pack(lfl__shm_tag(next), 0), memory_order_relaxed);
+                        tail = lfl__shm_pack(0, i);
+                        break;
+                }
+                i = lfl__shm_idx(next);
+        }
+        atomic_store_explicit(&ih->head, lfl__shm_pack(0, lfl__shm_idx(head)), memory_order_relaxed);
+        atomic_store_explicit(&ih->tail, tail, memory_order_relaxed);
+        atomic_store_explicit(&ih->bump, used, memory_order_relaxed);
+        atomic_store_explicit(&ih->free_top, 0, memory_order_relaxed);
+        memset(ih->proc, 0, sizeof(ih->proc));
+        for (uint64_t i = used; i >= 1; i--) {
+                struct lfl_shm_link *n = lfl__shm_node(&seg_img, (uint32_t)i);
+                atomic_store_explicit(&n->owner, 0, memory_order_relaxed);
+                if (!live[i])
+                        lfl__slab_push(&ih->free_top, img + ih->data, ih->slot, offsetof(struct lfl_shm_link, free), n);
+        }
+
+        tmp = malloc(strlen(path) + 8);
+        if (!tmp)
+                goto out;
+        snprintf(tmp, strlen(path) + 8, "%s.XXXXXX", path);
+        fd = mkstemp(tmp);
+        if (fd < 0)
+                goto out;
+        if (lfl__write_all(fd, img, len) != 0 || ftruncate(fd, (off_t)h->size) != 0 || fsync(fd) != 0)
+                goto out;
+        if (rename(tmp, path) != 0)
+                goto out;
+        /* make the rename itself durable */
+        {
+                char *slash = strrchr(tmp, '/');
+                int dfd;
+                if (slash)
+                        *slash = '\0';
+                dfd = open(slash ? (slash == tmp ? "/" : tmp) : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (dfd >= 0) {
+                        fsync(dfd);
+                        close(dfd);
+                }
+        }
+        free(tmp);
+        tmp = NULL;
+        rc = 0;
+out:
+        if (fd >= 0)
+                close(fd);
+        if (tmp) {
+                unlink(tmp);
+                free(tmp);
+        }
+        free(live);
+        free(img);
+        return rc;
+}
+
+/**
+ * @brief map a snapshot image back as a segment
+ *
+ *        only the mapping is set up, so restore is O(1) regardless of the
+ *        list length; pages fault in lazily as the queue is used.
+ *
+ *        MAP_PRIVATE maps the image copy-on-write. the queue is writable,
+ *        but only in this process (children forked afterwards get their own
+ *        copy) and every change is dropped on close: the image on disk stays
+ *        as it is until the next lfl_shm_snapshot replaces it.
+ *
+ *        MAP_SHARED maps the image file itself, which becomes a live,
+ *        file-backed segment as with lfl_shm_map_file: other processes can
+ *        attach to it, and changes land in the file.
+ *
+ * @param flags MAP_PRIVATE or MAP_SHARED
+ *
+ * @return 0 on success, -1 on failure
+ */
+static inline int lfl__shm_restore(struct lfl_shm *seg, const char *path, int flags)
+{
+        int fd = open(path, (flags == MAP_SHARED ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+
+        if (fd < 0)
+                return -1;
+        if (lfl__shm_attach(seg, fd, flags) != 0) {
+                close(fd);
+                return -1;
+        }
+        return 0;
+}
+
+/**
+ * @brief define a node type for shared-memory queues
+ *
+ *        user fields go between lfl_shm_def and lfl_end, exactly as with
+ *        lfl_def. fields must not hold pointers, since the segment is mapped
+ *        at different addresses in each process.
+ *
+ * @param name base name of the node type
+ */
+#define lfl_shm_def(name) \
+        struct name##_shm_node { \
+                struct lfl_shm_link lfl_link;
+
+/* typing */
+#define lfl_shm_type(name) struct name##_shm_node
+
+/**
+ * @brief create a segment holding up to capacity queued nodes
+ *
+ * @param name     node type name
+ * @param seg      struct lfl_shm handle
+ * @param path     shm_open name, or NULL for an anonymous memfd
+ * @param capacity number of node slots
+ *
+ * @return 0 on success, -1 on failure
+ */
+#define lfl_shm_create(name, seg, path, capacity) \
+        lfl__shm_create(&(seg), (path), sizeof(lfl_shm_type(name)), (capacity))
+
+/**
+ * @brief map a segment created by another process with lfl_shm_create
+ *
+ * @return 0 on success, -1 on failure
+ */
+#define lfl_shm_open(name, seg, path) \
+        lfl__shm_open(&(seg), (path))
+
+/* unmap a segment from this process */
+#define lfl_shm_close(name, seg) \
+        lfl__shm_close(&(seg))
+
+/* remove a named segment once every process has closed it */
+#define lfl_shm_unlink(path) \
+        shm_unlink(path)
+
+/**
+ * @brief allocate a node inside the segment
+ *
+ * @return pointer to a zeroed node, or NULL when the segment is full
+ */
+#define lfl_shm_new(name, seg) \
+        ((lfl_shm_type(name) *)lfl__shm_alloc(&(seg)))
+
+/* release a node from lfl_shm_new that will not be enqueued */
+#define lfl_shm_free(name, seg, ptr) \
+        lfl__shm_free(&(seg), (ptr))
+
+/**
+ * @brief publish a filled-in node at the tail of the shared queue
+ *
+ * @param name node type name
+ * @param seg  struct lfl_shm handle
+ * @param ptr  node from lfl_shm_new, fully initialized
+ */
+#define lfl_shm_add_tail_ptr(name, seg, ptr) \
+        lfl__shm_enqueue(&(seg), (ptr))
+
+/**
+ * @brief dequeue the oldest node, copying its fields into *out
+ *
+ *        the slot is recycled immediately, so the payload is handed out by
+ *        value rather than by pointer.
+ *
+ * @param name node type name
+ * @param seg  struct lfl_shm handle
+ * @param out  pointer to a lfl_shm_type(name) receiving the fields
+ *
+ * @return 1 if a node was dequeued, 0 if the queue was empty
+ */
+#define lfl_shm_pop_head(name, seg, out) \
+        lfl__shm_dequeue(&(seg), (lfl_shm_type(name) *){ (out) }, sizeof(lfl_shm_type(name)))
+
+/* return slots stranded by processes that died holding them */
+#define lfl_shm_reap(name, seg) \
+        lfl__shm_reap(&(seg))
+
+/**
+ * @brief map a file as a persistent segment, creating it if needed
+ *
+ * @param name     node type name
+ * @param seg      struct lfl_shm handle
+ * @param path     file path
+ * @param capacity number of node slots when the file is new
+ *
+ * @return 0 on success, -1 on failure
+ */
+#define lfl_shm_map_file(name, seg, path, capacity) \
+        lfl__shm_map_file(&(seg), (path), sizeof(lfl_shm_type(name)), (capacity))
+
+/**
+ * @brief write a crash-consistent image of a live shared-memory segment
+ *
+ *        snapshots cover lfl_shm_def queues only: their links are slot
+ *        offsets, whereas regular lists are linked by raw pointers that mean
+ *        nothing once mapped back.
+ *
+ * @return 0 on success, -1 on failure
+ */
+#define lfl_shm_snapshot(name, seg, path) \
+        lfl__shm_snapshot(&(seg), (path))
+
+/**
+ * @brief map an image written by lfl_shm_snapshot as a segment
+ *
+ * @param flags MAP_PRIVATE for a throwaway copy-on-write view of the image,
+ *              MAP_SHARED to continue with the image as a live segment
+ *
+ * @return 0 on success, -1 on failure
+ */
+#define lfl_shm_restore(name, seg, path, flags) \
+        lfl__shm_restore(&(seg), (path), (flags))
+
+#endif /* LFL_SHM_H */
@@ -0,0 +1,227 @@
+#ifndef LFL_URING_H
+#define LFL_URING_H
+
+#include <liburing.h>
+
+#include "lock_free_list.h"
+
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 Michael Miller
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @brief io_uring provided-buffer pools whose buffers are list nodes
+ *
+ *        every buffer in the pool is laid out as an lfl node header followed
+ *        by the receive area, and the receive areas are registered with the
+ *        ring as a provided buffer group. when a completion names a buffer,
+ *        its node is linked straight into a consumer list: no allocation, no
+ *        copy, and no separate wrapper pointing at the data.
+ *
+ *        consumers hand finished nodes back with lfl_uring_recycle, which is
+ *        a single CAS onto a return stack and safe from any thread. the
+ *        thread that owns the ring calls lfl_uring_replenish to move every
+ *        returned buffer back into the buffer ring with one advance.
+ *
+ *        pool nodes are not heap memory: release them only through
+ *        lfl_uring_recycle, never lfl_delete, lfl_sweep or lfl_clear.
+ */
+struct lfl_uring_pool {
+        struct io_uring *ring;
+        struct io_uring_buf_ring *br;
+        char *mem;                      /* nbufs slots of stride bytes */
+        size_t stride;                  /* node header plus buffer */
+        size_t data_off;                /* offset of the buffer in a slot */
+        unsigned int buf_size;
+        unsigned int nbufs;
+        int bgid;
+        int mask;
+        _Atomic(void *) returned;       /* nodes waiting to go back to the ring */
+};
+
+/**
+ * @brief define a list node type that can serve as an io_uring buffer
+ *
+ *        user fields go between lfl_uring_def and lfl_end; the receive
+ *        buffer itself follows the node and is reached with lfl_uring_data.
+ *
+ * @param name base name of the list type
+ */
+#define lfl_uring_def(name) \
+        lfl_uring_def_ex(name, 0)
+
+/**
+ * @brief lfl_uring_def for a flavor chosen with LFL_* flags
+ *
+ * @param name  base name of the list type
+ * @param flags LFL_* flags as for lfl_def_ex
+ */
+#define lfl_uring_def_ex(name, flags) \
+        lfl_def_ex(name, flags) \
+                int32_t lfl_len; \
+                uint32_t lfl_bid;
+
+/* received bytes of a completed buffer node */
+#define lfl_uring_len(node) ((node)->lfl_len)
+
+/* start of the receive area of a buffer node */
+#define lfl_uring_data(pool, node) ((unsigned char *)(node) + (pool).data_off)
+
+static inline int lfl__uring_pool_init(struct lfl_uring_pool *p, struct io_uring *ring, int bgid,
+                                       unsigned int nbufs, unsigned int buf_size, size_t node_size)
+{
+        int ret = 0;
+
+        memset(p, 0, sizeof(*p));
+        if (nbufs == 0 || nbufs > 32768 || (nbufs & (nbufs - 1)))
+                return -EINVAL;
+        p->ring = ring;
+        p->bgid = bgid;
+        p->nbufs = nbufs;
+        p->buf_size = buf_size;
+        p->data_off = (node_size + 63) & ~(size_t)63;
+        p->stride = (p->data_off + buf_size + 63) & ~(size_t)63;
+        p->mem = mmap(NULL, p->stride * nbufs, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p->mem == MAP_FAILED) {
+                p->mem = NULL;
+                return -ENOMEM;
+        }
+        p->br = io_uring_setup_buf_ring(ring, nbufs, bgid, 0, &ret);
+        if (!p->br) {
+                munmap(p->mem, p->stride * nbufs);
+                p->mem = NULL;
+                return ret;
+        }
+        p->mask = io_uring_buf_ring_mask(nbufs);
+        for (unsigned int i = 0; i < nbufs; i++)
+                io_uring_buf_ring_add(p->br, p->mem + i * p->stride + p->data_off, buf_size,
+                                      (unsigned short)i, p->mask, (int)i);
+        io_uring_buf_ring_advance(p->br, (int)nbufs);
+        return 0;
+}
+
+static inline void lfl__uring_pool_destroy(struct lfl_uring_pool *p)
+{
+        if (p->br)
+                io_uring_free_buf_ring(p->ring, p->br, p->nbufs, p->bgid);
+        if (p->mem)
+                munmap(p->mem, p->stride * p->nbufs);
+        memset(p, 0, sizeof(*p));
+}
+
+/**
+ * @brief create a pool of nbufs buffer nodes and register it as a group
+ *
+ * @param name     list type name (defined with lfl_uring_def)
+ * @param pool     struct lfl_uring_pool
+ * @param ring     initialized struct io_uring *
+ * @param bgid     buffer group id used with IOSQE_BUFFER_SELECT
+ * @param nbufs    number of buffers, a power of two up to 32768
+ * @param buf_size bytes of receive area per buffer
+ *
+ * @return 0 on success or a negative errno
+ */
+#define lfl_uring_pool_init(name, pool, ring, bgid, nbufs, buf_size) \
+        lfl__uring_pool_init(&(pool), (ring), (bgid), (nbufs), (buf_size), sizeof(lfl_type(name)))
+
+/* unregister the buffer group and release the pool memory */
+#define lfl_uring_pool_destroy(name, pool) \
+        lfl__uring_pool_destroy(&(pool))
+
+/**
+ * @brief link the buffer named by a completion into a consumer list
+ *
+ *        completions without a selected buffer (errors, or requests that
+ *        did not use the group) leave item NULL.
+ *
+ * @param name list type name
+ * @param pool struct lfl_uring_pool
+ * @param inst list instance receiving the buffer
+ * @param cqe  struct io_uring_cqe *
+ * @param item node pointer variable set to the linked buffer or NULL
+ */
+#define lfl_uring_complete(name, pool, inst, cqe, item) \
+        do { \
+                item = NULL; \
+                if ((cqe)->flags & IORING_CQE_F_BUFFER) { \
+                        unsigned int _bid = (cqe)->flags >> IORING_CQE_BUFFER_SHIFT; \
+                        item = (struct name##_linked_list *)((pool).mem + (size_t)_bid * (pool).stride); \
+                        item->lfl_len = (cqe)->res; \
+                        item->lfl_bid = _bid; \
+                        lfl__ref_set(name, item, refcount, 0); \
+                        lfl_add_tail_ptr(name, inst, item); \
+                } \
+        } while (0)
+
+/**
+ * @brief hand a chain of consumed buffer nodes back to the pool
+ *
+ *        first..last must already be unlinked from every list and chained
+ *        through next (as left by popping them one after another and
+ *        linking them, or by a batch pop). safe from any thread.
+ *
+ * @param name  list type name
+ * @param pool  struct lfl_uring_pool
+ * @param first first node of the chain
+ * @param last  last node of the chain
+ */
+#define lfl_uring_recycle_chain(name, pool, first, last) \
+        do { \
+                void *_old = atomic_load_explicit(&(pool).returned, memory_order_relaxed); \
+                do { \
+                        atomic_store_explicit(&(last)->next, (struct name##_linked_list *)_old, memory_order_relaxed); \
+                } while (!atomic_compare_exchange_weak_explicit(&(pool).returned, &_old, (void *)(first), \
+                                                                memory_order_release, memory_order_relaxed)); \
+        } while (0)
+
+/* hand a single consumed buffer node back to the pool */
+#define lfl_uring_recycle(name, pool, node) \
+        lfl_uring_recycle_chain(name, pool, node, node)
+
+/**
+ * @brief return every recycled buffer to the ring with a single advance
+ *
+ *        must be called from the thread that owns the ring, typically once
+ *        per completion batch.
+ *
+ * @param name list type name
+ * @param pool struct lfl_uring_pool
+ * @param out  int receiving the number of buffers returned
+ */
+#define lfl_uring_replenish(name, pool, out) \
+        do { \
+                struct name##_linked_list *_node = atomic_exchange_explicit(&(pool).returned, NULL, memory_order_acquire); \
+                int _count = 0; \
+                while (_node) { \
+                        struct name##_linked_list *_next = atomic_load_explicit(&_node->next, memory_order_relaxed); \
+                        unsigned short _bid = (unsigned short)(((char *)_node - (pool).mem) / (pool).stride); \
+                        io_uring_buf_ring_add((pool).br, lfl_uring_data(pool, _node), (pool).buf_size, \
+                                              _bid, (pool).mask, _count++); \
+                        _node = _next; \
+                } \
+                if (_count) \
+                        io_uring_buf_ring_advance((pool).br, _count); \
+                out = _count; \
+        } while (0)
+
+#endif /* LFL_URING_H */
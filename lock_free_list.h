@@ -1,5 +1,21 @@
+#ifndef LOCK_FREE_LIST_H
+#define LOCK_FREE_LIST_H
+
 #include <stdlib.h>
 #include <stdatomic.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#ifndef LFL_NO_THREADS
+#include <pthread.h>
+#endif
 
 /*
  * MIT License
@@ -52,19 +68,564 @@
  * place of simpler mutex-based queues or lists.
  */
 
+/* huge page sizes accepted by lfl_arena_init */
+#define LFL_ARENA_2M ((size_t)2 << 20)
+#define LFL_ARENA_1G ((size_t)1 << 30)
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
 /**
- * @brief define a new lock-free list struct for a given type name
+ * @brief fixed-size node arena backed by huge pages
  *
- * @param name base name of the list type
+ *        a large virtual range is reserved up front and committed one huge
+ *        page at a time, so nodes carved sequentially from it share pages
+ *        (and tlb entries) with their neighbours. each chunk is first mapped
+ *        with MAP_HUGETLB; when no huge pages are available the chunk falls
+ *        back to ordinary memory advised with MADV_HUGEPAGE so transparent
+ *        huge pages can still back it.
+ *
+ *        freed nodes are pushed onto a free stack addressed by slot index
+ *        with a 32-bit tag in the upper half of the word, which keeps the
+ *        stack ABA-safe with a plain 64-bit CAS. the arena is never unmapped
+ *        while in use, so a stale read of a recycled slot is harmless.
  */
-#define lfl_def(name) \
+struct lfl_arena {
+        char *map;                      /* raw reservation, for munmap */
+        size_t map_len;                 /* raw reservation length */
+        char *base;                     /* chunk-aligned start of the arena */
+        size_t chunk;                   /* commit granule (huge page size) */
+        size_t slot;                    /* bytes per node, aligned */
+        uint64_t per_chunk;             /* slots per chunk */
+        uint64_t capacity;              /* total slots in the reservation */
+        _Atomic(unsigned char) *state;  /* per chunk: 0 idle, 1 busy, 2 ready, 3 failed */
+        _Atomic(uint64_t) bump;         /* next never-used slot */
+        _Atomic(uint64_t) free_top;     /* tag << 32 | (slot + 1), 0 when empty */
+        _Atomic(size_t) huge_chunks;    /* chunks mapped with MAP_HUGETLB */
+        _Atomic(size_t) thp_chunks;     /* chunks on the madvise fallback */
+};
+
+/**
+ * @brief reserve an arena for up to max_nodes nodes of node_size bytes
+ *
+ * @param a         arena to initialize
+ * @param node_size size of one node, normally sizeof(lfl_type(name))
+ * @param max_nodes upper bound on live nodes (reserved, not committed)
+ * @param page_size LFL_ARENA_2M, LFL_ARENA_1G or 0 for the 2 MiB default
+ *
+ * @return 0 on success, -1 if the range could not be reserved
+ */
+static inline int lfl_arena_init(struct lfl_arena *a, size_t node_size, size_t max_nodes, size_t page_size)
+{
+        size_t align = _Alignof(max_align_t);
+        size_t chunks;
+
+        memset(a, 0, sizeof(*a));
+        a->chunk = page_size ? page_size : LFL_ARENA_2M;
+        a->slot = (node_size + align - 1) & ~(align - 1);
+        a->per_chunk = a->chunk / a->slot;
+        if (a->per_chunk == 0 || max_nodes == 0 || max_nodes > UINT32_MAX - 1)
+                return -1;
+        chunks = (max_nodes + a->per_chunk - 1) / a->per_chunk;
+        a->capacity = chunks * a->per_chunk;
+        a->map_len = chunks * a->chunk + a->chunk;
+        a->map = mmap(NULL, a->map_len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (a->map == MAP_FAILED) {
+                a->map = NULL;
+                return -1;
+        }
+        a->base = (char *)(((uintptr_t)a->map + a->chunk - 1) & ~((uintptr_t)a->chunk - 1));
+        a->state = calloc(chunks, sizeof(*a->state));
+        if (!a->state) {
+                munmap(a->map, a->map_len);
+                a->map = NULL;
+                return -1;
+        }
+        return 0;
+}
+
+/**
+ * @brief release the whole arena; every node carved from it becomes invalid
+ *
+ * @param a arena to destroy
+ */
+static inline void lfl_arena_destroy(struct lfl_arena *a)
+{
+        if (a->map)
+                munmap(a->map, a->map_len);
+        free(a->state);
+        memset(a, 0, sizeof(*a));
+}
+
+/**
+ * @brief test whether a pointer was carved from the arena
+ */
+static inline int lfl_arena_owns(const struct lfl_arena *a, const void *p)
+{
+        return (const char *)p >= a->base && (const char *)p < a->base + a->capacity * a->slot;
+}
+
+/* busy-wait step: pause, and give up the cpu now and then */
+static inline void lfl__spin_wait(unsigned int *spins)
+{
+        if (++*spins % 1024 == 0) {
+                sched_yield();
+                return;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        __asm__ __volatile__("yield");
+#endif
+}
+
+/* a one-word token: taken with an exchange, waited for with lfl__spin_wait */
+static inline int lfl__token_trylock(_Atomic(int) *t)
+{
+        return !atomic_load_explicit(t, memory_order_relaxed) &&
+               !atomic_exchange_explicit(t, 1, memory_order_acquire);
+}
+
+static inline void lfl__token_lock(_Atomic(int) *t)
+{
+        unsigned int spins = 0;
+
+        while (!lfl__token_trylock(t))
+                lfl__spin_wait(&spins);
+}
+
+static inline void lfl__token_unlock(_Atomic(int) *t)
+{
+        atomic_store_explicit(t, 0, memory_order_release);
+}
+
+/* map one chunk of the reservation, huge pages first */
+static inline int lfl__arena_commit(struct lfl_arena *a, uint64_t c)
+{
+        char *addr = a->base + c * a->chunk;
+        unsigned char st = 0;
+
+        if (atomic_compare_exchange_strong_explicit(&a->state[c], &st, 1, memory_order_acquire, memory_order_acquire)) {
+#ifdef MAP_HUGETLB
+                int shift = __builtin_ctzll(a->chunk);
+                if (mmap(addr, a->chunk, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT),
+                         -1, 0) != MAP_FAILED) {
+                        atomic_fetch_add_explicit(&a->huge_chunks, 1, memory_order_relaxed);
+                        atomic_store_explicit(&a->state[c], 2, memory_order_release);
+                        return 0;
+                }
+#endif
+                if (mprotect(addr, a->chunk, PROT_READ | PROT_WRITE) != 0 &&
+                    mmap(addr, a->chunk, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+                        atomic_store_explicit(&a->state[c], 3, memory_order_release);
+                        return -1;
+                }
+#ifdef MADV_HUGEPAGE
+                madvise(addr, a->chunk, MADV_HUGEPAGE);
+#endif
+                atomic_fetch_add_explicit(&a->thp_chunks, 1, memory_order_relaxed);
+                atomic_store_explicit(&a->state[c], 2, memory_order_release);
+                return 0;
+        }
+        /* another thread is mapping this chunk; wait for it to finish */
+        unsigned int spins = 0;
+        while ((st = atomic_load_explicit(&a->state[c], memory_order_acquire)) == 1)
+                lfl__spin_wait(&spins);
+        return st == 2 ? 0 : -1;
+}
+
+/*
+ * map every chunk that slots [s, s + n) touch. slots are laid out by
+ * address, so one may straddle two chunks. returns the first chunk that
+ * could not be mapped, or UINT64_MAX when all are ready.
+ */
+static inline uint64_t lfl__arena_commit_slots(struct lfl_arena *a, uint64_t s, uint64_t n)
+{
+        for (uint64_t c = s * a->slot / a->chunk; c <= ((s + n) * a->slot - 1) / a->chunk; c++)
+                if (atomic_load_explicit(&a->state[c], memory_order_acquire) != 2 && lfl__arena_commit(a, c) != 0)
+                        return c;
+        return UINT64_MAX;
+}
+
+/*
+ * tagged index free stack shared by the node arena and the shared-memory
+ * segment allocator. slots are addressed by index (1-based, 0 terminates)
+ * and the 32-bit link lives at link_off inside each free slot.
+ */
+static inline void *lfl__slab_pop(_Atomic(uint64_t) *top_p, char *base, size_t slot, size_t link_off)
+{
+        uint64_t top = atomic_load_explicit(top_p, memory_order_acquire);
+
+        while ((uint32_t)top) {
+                char *p = base + (uint64_t)((uint32_t)top - 1) * slot;
+                uint32_t next = atomic_load_explicit((_Atomic(uint32_t) *)(p + link_off), memory_order_relaxed);
+                uint64_t want = (((top >> 32) + 1) << 32) | next;
+                if (atomic_compare_exchange_weak_explicit(top_p, &top, want, memory_order_acquire, memory_order_acquire))
+                        return p;
+        }
+        return NULL;
+}
+
+static inline void lfl__slab_push(_Atomic(uint64_t) *top_p, char *base, size_t slot, size_t link_off, void *p)
+{
+        uint32_t idx = (uint32_t)(((char *)p - base) / slot);
+        uint64_t top = atomic_load_explicit(top_p, memory_order_relaxed);
+        uint64_t want;
+
+        do {
+                atomic_store_explicit((_Atomic(uint32_t) *)((char *)p + link_off), (uint32_t)top, memory_order_relaxed);
+                want = (((top >> 32) + 1) << 32) | (idx + 1);
+        } while (!atomic_compare_exchange_weak_explicit(top_p, &top, want, memory_order_release, memory_order_relaxed));
+}
+
+/* arena allocation; recycled slots keep their old contents unless zero is set */
+static inline void *lfl__arena_alloc(struct lfl_arena *a, int zero)
+{
+        char *p = lfl__slab_pop(&a->free_top, a->base, a->slot, 0);
+        uint64_t s;
+
+        if (p) {
+                if (zero)
+                        memset(p, 0, a->slot);
+                return p;
+        }
+        s = atomic_fetch_add_explicit(&a->bump, 1, memory_order_relaxed);
+        if (s >= a->capacity)
+                return NULL;
+        if (lfl__arena_commit_slots(a, s, 1) != UINT64_MAX)
+                return NULL;
+        return a->base + s * a->slot;
+}
+
+/**
+ * @brief allocate one zeroed node from the arena
+ *
+ *        recycled slots are preferred; otherwise the next fresh slot is
+ *        carved from the current chunk, mapping a new chunk on demand.
+ *
+ * @return pointer to the node or NULL when the arena is exhausted
+ */
+static inline void *lfl_arena_alloc(struct lfl_arena *a)
+{
+        return lfl__arena_alloc(a, 1);
+}
+
+/**
+ * @brief return a node to the arena's free stack
+ *
+ * @param a arena the node was carved from
+ * @param p node pointer
+ */
+static inline void lfl_arena_free(struct lfl_arena *a, void *p)
+{
+        lfl__slab_push(&a->free_top, a->base, a->slot, 0, p);
+}
+
+/**
+ * @brief allocate n consecutive fresh slots from the arena
+ *
+ *        never reuses freed slots, so the run is contiguous and in address
+ *        order; each slot can later be freed on its own.
+ *
+ * @return first slot of the zeroed run, or NULL when the arena is exhausted
+ */
+static inline void *lfl_arena_alloc_run(struct lfl_arena *a, size_t n)
+{
+        uint64_t s = atomic_load_explicit(&a->bump, memory_order_relaxed);
+        uint64_t c;
+
+        /* reserve only when the whole run fits, so a failed request leaves bump alone */
+        do {
+                if (n == 0 || s > a->capacity || n > a->capacity - s)
+                        return NULL;
+        } while (!atomic_compare_exchange_weak_explicit(&a->bump, &s, s + n, memory_order_relaxed,
+                                                        memory_order_relaxed));
+        c = lfl__arena_commit_slots(a, s, n);
+        if (c == UINT64_MAX)
+                return a->base + s * a->slot;
+        /* give the run back: undo the reservation, or free the slots that are mapped */
+        uint64_t end = s + n;
+        if (atomic_compare_exchange_strong_explicit(&a->bump, &end, s, memory_order_relaxed, memory_order_relaxed))
+                return NULL;
+        for (uint64_t i = s; i < s + n; i++)
+                if ((i + 1) * a->slot - 1 < c * a->chunk)
+                        lfl_arena_free(a, a->base + i * a->slot);
+        return NULL;
+}
+
+/**
+ * @brief node allocator hooks
+ *
+ *        alloc returns size bytes aligned to align and zeroed (nodes are
+ *        handed out as calloc would), or NULL; free releases a node alloc
+ *        returned. ctx is passed through to both, e.g. a jemalloc arena
+ *        index for mallocx/dallocx.
+ */
+struct lfl_allocator {
+        void *(*alloc)(void *ctx, size_t size, size_t align);
+        void (*free)(void *ctx, void *p);
+        void *ctx;
+};
+
+/* default node allocation: calloc, or aligned_alloc for over-aligned types */
+static inline void *lfl__default_alloc(size_t size, size_t align)
+{
+        void *p;
+
+        if (align <= _Alignof(max_align_t))
+                return calloc(1, size);
+        p = aligned_alloc(align, (size + align - 1) & ~(align - 1));
+        if (p)
+                memset(p, 0, size);
+        return p;
+}
+
+/*
+ * global allocator hooks: define LFL_ALLOC(ctx, size, align) and
+ * LFL_FREE(ctx, p), and optionally LFL_ALLOC_CTX, before including this
+ * header to replace calloc/free for every list type without a bound arena
+ * or allocator. LFL_ALLOC must return zeroed memory.
+ */
+#ifndef LFL_ALLOC
+#define LFL_ALLOC(ctx, size, align) ((void)(ctx), lfl__default_alloc((size), (align)))
+#endif
+#ifndef LFL_FREE
+#define LFL_FREE(ctx, p) ((void)(ctx), free(p))
+#endif
+#ifndef LFL_ALLOC_CTX
+#define LFL_ALLOC_CTX NULL
+#endif
+
+/* allocation paths shared by lfl_new, lfl_add_* and the freeing macros */
+static inline void *lfl__node_alloc(struct lfl_arena *a, const struct lfl_allocator *al, size_t size, size_t align)
+{
+        if (a) {
+                void *p = lfl_arena_alloc(a);
+                if (p)
+                        return p;
+        }
+        if (al)
+                return al->alloc(al->ctx, size, align);
+        return LFL_ALLOC(LFL_ALLOC_CTX, size, align);
+}
+
+static inline void lfl__node_free(struct lfl_arena *a, const struct lfl_allocator *al, void *p)
+{
+        if (a && lfl_arena_owns(a, p))
+                lfl_arena_free(a, p);
+        else if (al)
+                al->free(al->ctx, p);
+        else
+                LFL_FREE(LFL_ALLOC_CTX, p);
+}
+
+/* list flavor flags for lfl_def_ex */
+#define LFL_SINGLY      0x1     /* no prev links */
+#define LFL_NO_REFCOUNT 0x2     /* no refcount field; sweeps treat nodes as unreferenced */
+#define LFL_PADDED      0x4     /* each node starts on its own cache line */
+#define LFL_STATS       0x8     /* per-type operation counters, see lfl_stats */
+#define LFL_NO_SPARE    0x10    /* no spare nextc/prevc links */
+
+/* operation counters kept for LFL_STATS list types */
+struct lfl_stats {
+        _Atomic(unsigned long) adds;
+        _Atomic(unsigned long) pops;
+        _Atomic(unsigned long) removes;
+        _Atomic(unsigned long) reclaimed;
+        _Atomic(unsigned long) cas_retries;
+};
+
+/* zero-size stand-in for a node field that a flavor leaves out */
+struct lfl__none {};
+
+/* type of an optional node field: type, or struct lfl__none when flag is set */
+#define lfl__field(flags, flag, type) \
+        __typeof__(*__builtin_choose_expr(((flags) & (flag)) != 0, (struct lfl__none *)0, (type *)0))
+
+/**
+ * @brief define a list struct carrying only the fields a flavor needs
+ *
+ *        flags is a constant combination of LFL_SINGLY, LFL_NO_REFCOUNT,
+ *        LFL_PADDED, LFL_STATS and LFL_NO_SPARE (0 gives the full lfl_def
+ *        layout, spare nextc/prevc links included). fields
+ *        a flavor drops become zero-size members, and the macros skip every
+ *        store to them at compile time: a singly linked queue never writes
+ *        prev. operations that cannot work without a dropped field
+ *        (lfl_foreach_rev, lfl_move_*, lfl_sort_* on LFL_SINGLY types,
+ *        lfl_cursor on LFL_NO_REFCOUNT types) fail with a static assertion.
+ *        lfl_unlink and lfl_delete on LFL_SINGLY types find the predecessor
+ *        by walking from the head.
+ *
+ *        the per-type arena and allocator bindings and the LFL_STATS
+ *        counters are only declared here, so lfl_def may also appear at
+ *        block scope; lfl_state(name) defines them.
+ *
+ * @param name  base name of the list type
+ * @param flags LFL_* flavor flags
+ */
+#define lfl_def_ex(name, flags) \
+        enum { name##_lfl_flags = (flags) }; \
+        extern __attribute__((weak)) struct lfl_arena *name##_lfl_arena; \
+        extern __attribute__((weak)) const struct lfl_allocator *name##_lfl_allocator; \
+        extern __attribute__((weak)) struct lfl_stats name##_lfl_stats; \
         struct name##_linked_list { \
+                _Alignas(((flags) & LFL_PADDED) ? 64 : _Alignof(void *)) \
                 _Atomic(struct name##_linked_list *) next; \
-                _Atomic(struct name##_linked_list *) nextc; \
-                _Atomic(struct name##_linked_list *) prev; \
-                _Atomic(struct name##_linked_list *) prevc; \
+                lfl__field(flags, LFL_NO_SPARE, _Atomic(struct name##_linked_list *)) nextc; \
+                lfl__field(flags, LFL_SINGLY, _Atomic(struct name##_linked_list *)) prev; \
+                lfl__field(flags, LFL_SINGLY | LFL_NO_SPARE, _Atomic(struct name##_linked_list *)) prevc; \
                 _Atomic(int) removed; \
-                _Atomic(int) refcount;
+                lfl__field(flags, LFL_NO_REFCOUNT, _Atomic(int)) refcount;
+
+/**
+ * @brief define a new lock-free list struct for a given type name
+ *
+ * @param name base name of the list type
+ */
+#define lfl_def(name) \
+        lfl_def_ex(name, 0)
+
+/**
+ * @brief define the per-type state of a list type
+ *
+ *        the arena and allocator bindings (lfl_arena_bind,
+ *        lfl_allocator_bind) and the LFL_STATS counters. place it at file
+ *        scope after lfl_end. the definitions are weak, so every
+ *        translation unit that uses it shares one copy and a node may be
+ *        freed in a different file than it was allocated. a type without
+ *        lfl_state in any translation unit allocates through
+ *        LFL_ALLOC/LFL_FREE, cannot be bound, and keeps no stats.
+ *
+ * @param name list type name
+ */
+#define lfl_state(name) \
+        __attribute__((weak)) struct lfl_arena *name##_lfl_arena; \
+        __attribute__((weak)) const struct lfl_allocator *name##_lfl_allocator; \
+        __attribute__((weak)) struct lfl_stats name##_lfl_stats
+
+/* whether a weak per-type object is defined; quiet where it visibly is */
+static inline int lfl__defined(const void *p)
+{
+        return p != NULL;
+}
+
+/* per-type bindings; NULL when no translation unit has lfl_state(name) */
+#define lfl__arena(name) (lfl__defined(&name##_lfl_arena) ? name##_lfl_arena : NULL)
+#define lfl__allocator(name) (lfl__defined(&name##_lfl_allocator) ? name##_lfl_allocator : NULL)
+
+/* flavor queries; each folds to a constant for a given list type */
+#define lfl__has_prev(name) (!(name##_lfl_flags & LFL_SINGLY))
+#define lfl__has_field(name, field) (sizeof(((struct name##_linked_list *)0)->field) != 0)
+
+/* address of a node's prev link; never dereferenced for LFL_SINGLY types */
+#define lfl__prev(name, node) \
+        __builtin_choose_expr(lfl__has_prev(name), &(node)->prev, (_Atomic(struct name##_linked_list *) *)0)
+
+/* store a prev link; compiled out for LFL_SINGLY types */
+#define lfl__set_prev(name, node, val, order) \
+        do { \
+                if (lfl__has_prev(name)) \
+                        atomic_store_explicit(lfl__prev(name, node), (val), order); \
+        } while (0)
+
+/* CAS a prev link from expected to val; compiled out for LFL_SINGLY types */
+#define lfl__cas_prev(name, node, expected, val) \
+        do { \
+                struct name##_linked_list *_pexp = (expected); \
+                if (lfl__has_prev(name)) \
+                        atomic_compare_exchange_strong_explicit(lfl__prev(name, node), &_pexp, (val), \
+                                                                memory_order_acq_rel, memory_order_acquire); \
+        } while (0)
+
+/* load a reference count field, reading 0 when the flavor dropped it */
+#define lfl__ref_load(name, node, ref) \
+        (lfl__has_field(name, ref) \
+                 ? atomic_load_explicit(__builtin_choose_expr(lfl__has_field(name, ref), &(node)->ref, (_Atomic(int) *)0), \
+                                        memory_order_acquire) \
+                 : 0)
+
+/* add n to a reference count field; compiled out when the flavor dropped it */
+#define lfl__ref_add(name, node, ref, n) \
+        do { \
+                if (lfl__has_field(name, ref)) \
+                        atomic_fetch_add_explicit( \
+                                __builtin_choose_expr(lfl__has_field(name, ref), &(node)->ref, (_Atomic(int) *)0), (n), \
+                                memory_order_acq_rel); \
+        } while (0)
+
+/* store a reference count field; compiled out when the flavor dropped it */
+#define lfl__ref_set(name, node, ref, v) \
+        do { \
+                if (lfl__has_field(name, ref)) \
+                        atomic_store_explicit( \
+                                __builtin_choose_expr(lfl__has_field(name, ref), &(node)->ref, (_Atomic(int) *)0), (v), \
+                                memory_order_relaxed); \
+        } while (0)
+
+/* offsets handed to the generic cores; LFL__NO_OFF marks a dropped field */
+#define LFL__NO_OFF ((size_t)-1)
+#define lfl__prev_off(name) \
+        (lfl__has_prev(name) ? offsetof(struct name##_linked_list, prev) : LFL__NO_OFF)
+#define lfl__ref_off(name, ref) \
+        (lfl__has_field(name, ref) ? offsetof(struct name##_linked_list, ref) : LFL__NO_OFF)
+
+/*
+ * reference count of a node claimed for unlinking. every unlinker moves a
+ * removed node's count from 0 to LFL__DYING before it unlinks the node, so
+ * a node pinned first is never unlinked, and a pin that lands after the
+ * claim sees a negative count and backs off.
+ */
+#define LFL__DYING (INT_MIN / 2)
+
+/* claim node for unlinking; 0 while it is pinned. flavors without ref always win */
+static inline int lfl__claim(void *node, size_t ref_off)
+{
+        int zero = 0;
+
+        return ref_off == LFL__NO_OFF ||
+               atomic_compare_exchange_strong_explicit((_Atomic(int) *)((char *)node + ref_off), &zero, LFL__DYING,
+                                                       memory_order_acq_rel, memory_order_acquire);
+}
+
+/* hand a claim back after the unlink CAS lost; pins that backed off meanwhile cancel out */
+static inline void lfl__unclaim(void *node, size_t ref_off)
+{
+        if (ref_off != LFL__NO_OFF)
+                atomic_fetch_sub_explicit((_Atomic(int) *)((char *)node + ref_off), LFL__DYING, memory_order_release);
+}
+
+/* take a reference on a node that may be claimed concurrently; 0 if it is being unlinked */
+static inline int lfl__pin(void *node, size_t ref_off)
+{
+        _Atomic(int) *ref = (_Atomic(int) *)((char *)node + ref_off);
+
+        if (atomic_fetch_add_explicit(ref, 1, memory_order_seq_cst) >= 0)
+                return 1;
+        atomic_fetch_sub_explicit(ref, 1, memory_order_release);
+        return 0;
+}
+
+/* bump an LFL_STATS counter; compiled out for other types */
+#define lfl__stat(name, field, n) \
+        ((name##_lfl_flags & LFL_STATS) && lfl__defined(&name##_lfl_stats) \
+                 ? (void)atomic_fetch_add_explicit(&name##_lfl_stats.field, (unsigned long)(n), memory_order_relaxed) \
+                 : (void)0)
+
+/**
+ * @brief operation counters of an LFL_STATS list type
+ *
+ *        counters are per type and shared by every translation unit, like
+ *        the arena binding; they stay zero for types defined without
+ *        LFL_STATS.
+ *
+ * @param name list type name
+ *
+ * @return struct lfl_stats *, or NULL without lfl_state(name)
+ */
+#define lfl_stats(name) (lfl__defined(&name##_lfl_stats) ? &name##_lfl_stats : NULL)
 
 /**
  * @brief close the list struct declaration
@@ -75,12 +636,20 @@
 /**
  * @brief declare head/tail pointers for a list instance
  *
+ *        also declares the instance's unlink token. every operation that
+ *        unlinks removed nodes (the sweeps, lfl_remove_if, helping
+ *        traversals, lfl_compact and the reclaimer) holds it, so at most
+ *        one of them works on a list at a time and none frees a node
+ *        another is about to unlink. pops, moves and lfl_unlink do not take
+ *        it.
+ *
  * @param name list type name
  * @param inst list instance name
  */
 #define lfl_vars(name, inst) \
         _Atomic(struct name ## _linked_list *) inst## _head; \
-        _Atomic(struct name ## _linked_list *) inst## _tail
+        _Atomic(struct name ## _linked_list *) inst## _tail; \
+        _Atomic(int) inst## _unlinker
 
 /**
  * @brief declare head/tail pointers for a list instance as 'external'
@@ -90,7 +659,8 @@
  */
 #define lfl_vars_extern(name, inst) \
         extern _Atomic(struct name ## _linked_list *) inst## _head; \
-        extern _Atomic(struct name ## _linked_list *) inst## _tail
+        extern _Atomic(struct name ## _linked_list *) inst## _tail; \
+        extern _Atomic(int) inst## _unlinker
 
 /**
  * @brief declare head/tail pointers for a list instance as 'static'
@@ -100,14 +670,65 @@
  */
 #define lfl_vars_static(name, inst) \
         static _Atomic(struct name ## _linked_list *) inst## _head = NULL; \
-        static _Atomic(struct name ## _linked_list *) inst## _tail = NULL
+        static _Atomic(struct name ## _linked_list *) inst## _tail = NULL; \
+        static _Atomic(int) inst## _unlinker = 0
 
 /* typing */
 #define lfl_type(name) struct name ## _linked_list
 
+/*
+ * list instance named by pointers: inside a block that declares
+ * lfl__self_head_p and lfl__self_tail_p, the instance name lfl__self makes
+ * any lfl_* macro operate on *lfl__self_head_p / *lfl__self_tail_p.
+ * sweeping macros also need lfl__self_unlinker_p.
+ */
+#define lfl__self_head (*lfl__self_head_p)
+#define lfl__self_tail (*lfl__self_tail_p)
+#define lfl__self_unlinker (*lfl__self_unlinker_p)
+
 /* allocating */
 #define lfl_new(name) \
-        ((lfl_type(name) *)calloc(1, sizeof(lfl_type(name))))
+        ((lfl_type(name) *)lfl__node_alloc(lfl__arena(name), lfl__allocator(name), sizeof(lfl_type(name)), _Alignof(lfl_type(name))))
+
+/* releasing a node obtained from lfl_new or lfl_add_* */
+#define lfl_node_free(name, ptr) \
+        lfl__node_free(lfl__arena(name), lfl__allocator(name), (ptr))
+
+/**
+ * @brief route node allocation for a list type through an arena
+ *
+ *        once bound, lfl_new, lfl_add_head and lfl_add_tail carve nodes from
+ *        the arena (falling back to the allocator hooks when it is
+ *        exhausted) and lfl_delete, lfl_sweep and lfl_clear return arena
+ *        nodes to it. the
+ *        binding is program-wide; pass NULL to unbind, which is only safe
+ *        once no arena nodes remain in lists of this type.
+ *
+ * @param name  list type name
+ * @param arena initialized arena, or NULL
+ *
+ * @return 0, or -1 when no translation unit has lfl_state(name)
+ */
+#define lfl_arena_bind(name, arena) \
+        (lfl__defined(&name##_lfl_arena) ? (name##_lfl_arena = (arena), 0) : -1)
+
+/**
+ * @brief route node allocation for a list type through allocator hooks
+ *
+ *        lfl_new, lfl_add_head and lfl_add_tail then call allocator->alloc,
+ *        and lfl_delete, lfl_sweep and lfl_clear call allocator->free. a
+ *        bound arena still takes precedence; the allocator serves what the
+ *        arena does not. like lfl_arena_bind the binding is program-wide,
+ *        and switching it is only safe once no nodes from the old allocator
+ *        remain in lists of this type.
+ *
+ * @param name      list type name
+ * @param allocator const struct lfl_allocator *, or NULL for LFL_ALLOC/LFL_FREE
+ *
+ * @return 0, or -1 when no translation unit has lfl_state(name)
+ */
+#define lfl_allocator_bind(name, allocator) \
+        (lfl__defined(&name##_lfl_allocator) ? (name##_lfl_allocator = (allocator), 0) : -1)
 
 /* for discrete operations */
 
@@ -130,6 +751,7 @@
         do { \
                 atomic_store(&(inst##_head), NULL); \
                 atomic_store(&(inst##_tail), NULL); \
+                atomic_store(&(inst##_unlinker), 0); \
         } while (0)
 
 /**
@@ -177,6 +799,7 @@
  * @param item loop variable
  */
 #define lfl_foreach_rev(name, inst, item) \
+        _Static_assert(lfl__has_prev(name), "lfl_foreach_rev needs prev links"); \
         struct name##_linked_list *item = atomic_load_explicit(&(inst##_tail), memory_order_acquire), *item##_prev = NULL; \
         for (; item != NULL; item = item##_prev) \
                 if ((item##_prev = atomic_load_explicit(&(item->prev), memory_order_acquire)), \
@@ -192,7 +815,7 @@
 #define lfl_add_tail(name, inst, item) \
         struct name##_linked_list *item; \
         do { \
-                item = calloc(1, sizeof(*item)); \
+                item = lfl_new(name); \
                 atomic_store_explicit(&item->next, NULL, memory_order_relaxed); \
                 atomic_store_explicit(&item->removed, 0, memory_order_relaxed); \
                 struct name##_linked_list *expected_tail; \
@@ -204,7 +827,7 @@
                                         &(inst##_head), &null_ptr, item, \
                                         memory_order_release, memory_order_relaxed)) { \
                                     atomic_store_explicit(&(inst##_tail), item, memory_order_release); \
-                                    atomic_store_explicit(&item->prev, NULL, memory_order_relaxed); \
+                                    lfl__set_prev(name, item, NULL, memory_order_relaxed); \
                                     break; \
                                 } \
                         } else { \
@@ -212,14 +835,16 @@
                                 if (atomic_compare_exchange_weak_explicit( \
                                         &expected_tail->next, &next, item, \
                                         memory_order_release, memory_order_relaxed)) { \
-                                    atomic_store_explicit(&item->prev, expected_tail, memory_order_relaxed); \
+                                    lfl__set_prev(name, item, expected_tail, memory_order_relaxed); \
                                     atomic_compare_exchange_weak_explicit( \
                                         &(inst##_tail), &expected_tail, item, \
                                         memory_order_release, memory_order_relaxed); \
                                     break; \
                                 } \
                         } \
+                        lfl__stat(name, cas_retries, 1); \
                 } while (1); \
+                lfl__stat(name, adds, 1); \
         } while (0)
 
 /**
@@ -232,21 +857,23 @@
 #define lfl_add_head(name, inst, item) \
         struct name##_linked_list *item; \
         do { \
-                item = calloc(1, sizeof(*item)); \
+                item = lfl_new(name); \
                 atomic_store_explicit(&item->removed, 0, memory_order_relaxed); \
                 struct name##_linked_list *old_head; \
                 do { \
                         old_head = atomic_load_explicit(&(inst##_head), memory_order_acquire); \
                         atomic_store_explicit(&item->next, old_head, memory_order_relaxed); \
-                        atomic_store_explicit(&item->prev, NULL, memory_order_relaxed); \
+                        lfl__set_prev(name, item, NULL, memory_order_relaxed); \
                 } while (!atomic_compare_exchange_weak_explicit( \
                         &(inst##_head), &old_head, item, \
-                        memory_order_release, memory_order_relaxed)); \
+                        memory_order_release, memory_order_relaxed) && \
+                         (lfl__stat(name, cas_retries, 1), 1)); \
                 if (old_head) { \
-                        atomic_store_explicit(&old_head->prev, item, memory_order_release); \
+                        lfl__set_prev(name, old_head, item, memory_order_release); \
                 } else { \
                         atomic_store_explicit(&(inst##_tail), item, memory_order_release); \
                 } \
+                lfl__stat(name, adds, 1); \
         } while (0)
 
 /**
@@ -272,7 +899,7 @@
                                         &(inst##_head), &null_ptr, ptr, \
                                         memory_order_release, memory_order_relaxed)) { \
                                     atomic_store_explicit(&(inst##_tail), ptr, memory_order_release); \
-                                    atomic_store_explicit(&ptr->prev, NULL, memory_order_relaxed); \
+                                    lfl__set_prev(name, ptr, NULL, memory_order_relaxed); \
                                     break; \
                                 } \
                         } else { \
@@ -280,14 +907,16 @@
                                 if (atomic_compare_exchange_weak_explicit( \
                                         &expected_tail->next, &next, ptr, \
                                         memory_order_release, memory_order_relaxed)) { \
-                                    atomic_store_explicit(&ptr->prev, expected_tail, memory_order_relaxed); \
+                                    lfl__set_prev(name, ptr, expected_tail, memory_order_relaxed); \
                                     atomic_compare_exchange_weak_explicit( \
                                         &(inst##_tail), &expected_tail, ptr, \
                                         memory_order_release, memory_order_relaxed); \
                                     break; \
                                 } \
                         } \
+                        lfl__stat(name, cas_retries, 1); \
                 } while (1); \
+                lfl__stat(name, adds, 1); \
         } while (0)
 
 /**
@@ -307,15 +936,213 @@
                 do { \
                         old_head = atomic_load_explicit(&(inst##_head), memory_order_acquire); \
                         atomic_store_explicit(&ptr->next, old_head, memory_order_relaxed); \
-                        atomic_store_explicit(&ptr->prev, NULL, memory_order_relaxed); \
+                        lfl__set_prev(name, ptr, NULL, memory_order_relaxed); \
                 } while (!atomic_compare_exchange_weak_explicit( \
                         &(inst##_head), &old_head, ptr, \
-                        memory_order_release, memory_order_relaxed)); \
+                        memory_order_release, memory_order_relaxed) && \
+                         (lfl__stat(name, cas_retries, 1), 1)); \
                 if (old_head) { \
-                        atomic_store_explicit(&old_head->prev, ptr, memory_order_release); \
+                        lfl__set_prev(name, old_head, ptr, memory_order_release); \
                 } else { \
                         atomic_store_explicit(&(inst##_tail), ptr, memory_order_release); \
                 } \
+                lfl__stat(name, adds, 1); \
+        } while (0)
+
+/**
+ * @brief allocate a node, run an initializer, then publish it at the tail
+ *
+ *        the initializer block runs before the release CAS that links the
+ *        node, so concurrent readers never observe a half-built payload.
+ *        it is passed as the trailing argument(s) so commas inside it are
+ *        fine.
+ *
+ * @param name list type name
+ * @param inst list instance name
+ * @param item variable declared to receive the new node
+ * @param ...  initializer block, e.g. { item->id = 1; }
+ */
+#define lfl_add_tail_init(name, inst, item, ...) \
+        struct name##_linked_list *item = lfl_new(name); \
+        do { \
+                __VA_ARGS__ \
+                lfl_add_tail_ptr(name, inst, item); \
+        } while (0)
+
+/**
+ * @brief allocate a node, run an initializer, then publish it at the head
+ *
+ * @param name list type name
+ * @param inst list instance name
+ * @param item variable declared to receive the new node
+ * @param ...  initializer block, e.g. { item->id = 1; }
+ */
+#define lfl_add_head_init(name, inst, item, ...) \
+        struct name##_linked_list *item = lfl_new(name); \
+        do { \
+                __VA_ARGS__ \
+                lfl_add_head_ptr(name, inst, item); \
+        } while (0)
+
+/**
+ * @brief splice a pre-linked chain of nodes onto the tail with one CAS
+ *
+ *        the caller links first..last through next/prev beforehand; the
+ *        whole chain becomes visible to readers at once. a tail left
+ *        lagging by another appender is helped forward first.
+ *
+ * @param name  list type name
+ * @param inst  list instance name
+ * @param first first node of the chain
+ * @param last  last node of the chain
+ */
+#define lfl_add_tail_chain(name, inst, first, last) \
+        do { \
+                struct name##_linked_list *_chain_first = (first); \
+                struct name##_linked_list *_chain_last = (last); \
+                atomic_store_explicit(&_chain_last->next, NULL, memory_order_relaxed); \
+                do { \
+                        struct name##_linked_list *expected_tail = atomic_load_explicit(&(inst##_tail), memory_order_acquire); \
+                        struct name##_linked_list *next = NULL; \
+                        lfl__set_prev(name, _chain_first, expected_tail, memory_order_relaxed); \
+                        if (expected_tail == NULL) { \
+                                if (atomic_compare_exchange_weak_explicit( \
+                                        &(inst##_head), &next, _chain_first, \
+                                        memory_order_release, memory_order_relaxed)) { \
+                                    atomic_store_explicit(&(inst##_tail), _chain_last, memory_order_release); \
+                                    break; \
+                                } \
+                        } else if (atomic_compare_exchange_weak_explicit( \
+                                        &expected_tail->next, &next, _chain_first, \
+                                        memory_order_release, memory_order_relaxed)) { \
+                                atomic_compare_exchange_strong_explicit( \
+                                        &(inst##_tail), &expected_tail, _chain_last, \
+                                        memory_order_release, memory_order_relaxed); \
+                                break; \
+                        } else if (next) { \
+                                atomic_compare_exchange_weak_explicit( \
+                                        &(inst##_tail), &expected_tail, next, \
+                                        memory_order_release, memory_order_relaxed); \
+                        } \
+                        lfl__stat(name, cas_retries, 1); \
+                } while (1); \
+        } while (0)
+
+/* default batch size and maximum hold time of an insertion buffer */
+#define LFL_BUFFER_MAX 64
+#define LFL_BUFFER_DELAY_US 1000
+
+/**
+ * @brief producer-side insertion buffer for one thread and one list
+ *
+ *        nodes added with lfl_add_tail_buffered are chained locally and
+ *        spliced onto the shared list with one CAS (lfl_add_tail_chain) when
+ *        the batch fills, when its oldest node has waited max_delay, or on
+ *        lfl_buffer_flush. a zeroed buffer uses LFL_BUFFER_MAX and
+ *        LFL_BUFFER_DELAY_US, so a _Thread_local one needs no setup. the
+ *        delay is only checked when the owner adds or polls, so an idle
+ *        producer should call lfl_buffer_poll from its wait loop.
+ */
+struct lfl_buffer {
+        void *first;
+        void *last;
+        size_t count;
+        size_t max;                     /* 0: LFL_BUFFER_MAX */
+        uint64_t max_delay_ns;          /* 0: LFL_BUFFER_DELAY_US */
+        uint64_t deadline_ns;           /* flush due once the clock passes this */
+};
+
+/* cheap monotonic clock for flush deadlines */
+static inline uint64_t lfl__buffer_now(void)
+{
+        struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC_COARSE
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+        return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* nonzero when the buffer holds a full batch or its deadline has passed */
+static inline int lfl__buffer_due(struct lfl_buffer *b)
+{
+        if (!b->first)
+                return 0;
+        return b->count >= (b->max ? b->max : LFL_BUFFER_MAX) || lfl__buffer_now() >= b->deadline_ns;
+}
+
+/* declare a per-thread buffer */
+#define lfl_buffer_vars(buf) \
+        _Thread_local struct lfl_buffer buf
+
+/**
+ * @brief set a buffer's batch size and maximum hold time
+ *
+ * @param buf          struct lfl_buffer
+ * @param max_nodes    nodes per flush
+ * @param max_delay_us longest a node may wait before being published
+ */
+#define lfl_buffer_init(buf, max_nodes, max_delay_us) \
+        do { \
+                memset(&(buf), 0, sizeof(buf)); \
+                (buf).max = (max_nodes); \
+                (buf).max_delay_ns = (uint64_t)(max_delay_us) * 1000u; \
+        } while (0)
+
+/**
+ * @brief publish every buffered node with a single splice
+ *
+ * @param name list type name
+ * @param inst list instance name
+ * @param buf  struct lfl_buffer
+ */
+#define lfl_buffer_flush(name, inst, buf) \
+        do { \
+                if ((buf).first) { \
+                        lfl_add_tail_chain(name, inst, (struct name##_linked_list *)(buf).first, \
+                                           (struct name##_linked_list *)(buf).last); \
+                        (buf).first = (buf).last = NULL; \
+                        (buf).count = 0; \
+                } \
+        } while (0)
+
+/* flush if the batch is full or the oldest node has waited too long */
+#define lfl_buffer_poll(name, inst, buf) \
+        do { \
+                if (lfl__buffer_due(&(buf))) \
+                        lfl_buffer_flush(name, inst, buf); \
+        } while (0)
+
+/**
+ * @brief queue an initialized node for the tail through a local buffer
+ *
+ *        the node is not visible to other threads until the buffer flushes;
+ *        order among one buffer's nodes is preserved.
+ *
+ * @param name list type name
+ * @param inst list instance name
+ * @param buf  struct lfl_buffer owned by the calling thread
+ * @param ptr  initialized node
+ */
+#define lfl_add_tail_buffered(name, inst, buf, ptr) \
+        do { \
+                struct name##_linked_list *_bnode = (ptr); \
+                struct name##_linked_list *_blast = (buf).last; \
+                atomic_store_explicit(&_bnode->next, NULL, memory_order_relaxed); \
+                lfl__set_prev(name, _bnode, _blast, memory_order_relaxed); \
+                atomic_store_explicit(&_bnode->removed, 0, memory_order_relaxed); \
+                if (_blast) { \
+                        atomic_store_explicit(&_blast->next, _bnode, memory_order_relaxed); \
+                } else { \
+                        (buf).first = _bnode; \
+                        (buf).deadline_ns = lfl__buffer_now() + \
+                                ((buf).max_delay_ns ? (buf).max_delay_ns : LFL_BUFFER_DELAY_US * 1000u); \
+                } \
+                (buf).last = _bnode; \
+                (buf).count++; \
+                lfl_buffer_poll(name, inst, buf); \
         } while (0)
 
 /**
@@ -328,20 +1155,33 @@
 #define lfl_remove(name, inst, target) \
         do { \
                 atomic_store_explicit(&(target->removed), 1, memory_order_release); \
+                lfl__stat(name, removes, 1); \
         } while (0)
 
 /**
- * @brief atomically remove node from list and free
+ * @brief atomically unlink a node from the list without freeing it
+ *
+ *        for nodes whose memory the caller manages, such as intrusive hooks
+ *        or pool buffers.
  *
  * @param name  list type name
  * @param inst  list instance name
- * @param ptr   pointer to node to delete
+ * @param ptr   pointer to node to unlink
  */
-
-#define lfl_delete(name, inst, ptr) \
+#define lfl_unlink(name, inst, ptr) \
         do { \
-                struct name##_linked_list *prev = atomic_load_explicit(&(ptr->prev), memory_order_acquire); \
+                struct name##_linked_list *prev = NULL; \
                 struct name##_linked_list *next = atomic_load_explicit(&(ptr->next), memory_order_acquire); \
+                if (lfl__has_prev(name)) { \
+                        prev = atomic_load_explicit(lfl__prev(name, ptr), memory_order_acquire); \
+                } else { \
+                        /* singly linked: find the predecessor from the head */ \
+                        struct name##_linked_list *_scan = atomic_load_explicit(&(inst##_head), memory_order_acquire); \
+                        while (_scan && _scan != ptr) { \
+                                prev = _scan; \
+                                _scan = atomic_load_explicit(&(_scan->next), memory_order_acquire); \
+                        } \
+                } \
                 if (prev) { \
                         struct name##_linked_list *expected = ptr; \
                         atomic_compare_exchange_weak_explicit(&(prev->next), &expected, next, memory_order_acq_rel, memory_order_acquire); \
@@ -350,13 +1190,25 @@
                         atomic_compare_exchange_weak_explicit(&(inst##_head), &expected, next, memory_order_acq_rel, memory_order_acquire); \
                 } \
                 if (next) { \
-                        struct name##_linked_list *expected = ptr; \
-                        atomic_compare_exchange_weak_explicit(&(next->prev), &expected, prev, memory_order_acq_rel, memory_order_acquire); \
+                        lfl__cas_prev(name, next, ptr, prev); \
                 } else { \
                         struct name##_linked_list *expected = ptr; \
                         atomic_compare_exchange_weak_explicit(&(inst##_tail), &expected, prev, memory_order_acq_rel, memory_order_acquire); \
                 } \
-                free(ptr); \
+        } while (0)
+
+/**
+ * @brief atomically remove node from list and free
+ *
+ * @param name  list type name
+ * @param inst  list instance name
+ * @param ptr   pointer to node to delete
+ */
+
+#define lfl_delete(name, inst, ptr) \
+        do { \
+                lfl_unlink(name, inst, ptr); \
+                lfl_node_free(name, ptr); \
         } while (0)
 
 /**
@@ -387,59 +1239,160 @@
                 } \
         } while (0)
 
-/**
- * @brief atomically sweep logically removed nodes with refcount == 0,
- *        and optionally call a cleanup function before freeing
- *
- * @param name     list type name
- * @param inst     instance name
- * @param ref      field name of atomic refcount in the node
- * @param cleanup  pointer to cleanup function or NULL
- */
+/* after unlinking curr, point its successor (or the tail) back at prev */
+#define lfl__sweep_relink(name, inst, curr, prev, next) \
+        do { \
+                struct name##_linked_list *_gone = (curr); \
+                if (next) \
+                        lfl__cas_prev(name, next, _gone, prev); \
+                else \
+                        atomic_compare_exchange_strong_explicit(&(inst##_tail), &_gone, (prev), memory_order_acq_rel, memory_order_acquire); \
+        } while (0)
 
-#define lfl_sweep(name, inst, ref, ...) \
+/*
+ * hand an unlinked node to cleanup and free, or defer it to a grace period.
+ * a node the caller keeps loses its claim, so it can be linked again.
+ */
+#define lfl__sweep_dispose(name, ref, curr, cleanup_fn, release, retire) \
         do { \
-                struct name##_linked_list *prev = NULL; \
-                struct name##_linked_list *curr = atomic_load_explicit(&(inst##_head), memory_order_acquire); \
-                void (*cleanup_fn)(struct name##_linked_list *) = NULL; \
-                if (sizeof((void *[]){__VA_ARGS__}) / sizeof(void *) > 0) \
-                        cleanup_fn = __VA_ARGS__; \
-                while (curr) { \
+                if (retire) { \
+                        lfl__rcu_defer((retire), (curr)); \
+                } else { \
+                        if (!(release)) \
+                                lfl__ref_set(name, curr, ref, 0); \
+                        if (cleanup_fn) cleanup_fn(curr); \
+                        if (release) lfl_node_free(name, curr); \
+                        lfl__stat(name, reclaimed, 1); \
+                } \
+        } while (0)
+
+/* optional limits and results of one sweep pass */
+struct lfl__sweep_ctl {
+        size_t budget;          /* stop after unlinking this many, 0 = no limit */
+        size_t unlinked;
+        size_t kept;            /* nodes left in the list by a complete pass */
+        size_t pinned;          /* removed nodes skipped for their references */
+        int stopped;            /* the budget ran out before the tail */
+        void *resume;           /* pinned node to continue after, kept between passes */
+        int nowait;             /* skip the pass while another unlinker holds the list */
+        int busy;               /* the pass was skipped */
+};
+
+/*
+ * a budgeted sweep stops after prev: pin prev with a reference so the next
+ * pass continues there instead of at the head. flavors without a
+ * reference count cannot pin, and start over.
+ */
+#define lfl__sweep_pause(name, ref, sweep_ctl, prev, curr) \
+        do { \
+                (sweep_ctl)->stopped = (curr) != NULL; \
+                if ((curr) && (prev) && lfl__has_field(name, ref) && lfl__pin(prev, lfl__ref_off(name, ref))) \
+                        (sweep_ctl)->resume = (prev); \
+        } while (0)
+
+/*
+ * sweep core, run under the list's unlink token: release is 0 for nodes
+ * whose memory the caller manages; retire, when not NULL, collects unlinked
+ * nodes instead (see lfl_rcu_sweep) and stops the pass when it cannot grow;
+ * ctl, when not NULL, bounds the pass and reports what it did
+ */
+#define lfl__sweep(name, inst, ref, cleanup, release, retire, ctl) \
+        do { \
+                struct lfl__sweep_ctl *sweep_ctl = (ctl); \
+                if (sweep_ctl && sweep_ctl->nowait) { \
+                        sweep_ctl->busy = !lfl__token_trylock(&(inst##_unlinker)); \
+                        if (sweep_ctl->busy) \
+                                break; \
+                } else { \
+                        lfl__token_lock(&(inst##_unlinker)); \
+                } \
+                struct name##_linked_list *prev = NULL; \
+                struct name##_linked_list *curr = atomic_load_explicit(&(inst##_head), memory_order_acquire); \
+                void (*cleanup_fn)(struct name##_linked_list *) = (cleanup); \
+                struct lfl__rcu_batch *retire_to = (retire); \
+                struct name##_linked_list *resumed = sweep_ctl ? sweep_ctl->resume : NULL; \
+                if (resumed) { \
+                        /* continue a budgeted pass after the node it pinned */ \
+                        sweep_ctl->resume = NULL; \
+                        prev = resumed; \
+                        curr = atomic_load_explicit(&(prev->next), memory_order_acquire); \
+                } else if (sweep_ctl) { \
+                        sweep_ctl->kept = sweep_ctl->pinned = 0; \
+                } \
+                while (curr) { \
                         struct name##_linked_list *next = atomic_load_explicit(&(curr->next), memory_order_acquire); \
                         int removed = atomic_load_explicit(&(curr->removed), memory_order_acquire); \
-                        int refs = atomic_load_explicit(&(curr->ref), memory_order_acquire); \
-                        if (removed && refs == 0) { \
+                        if (removed && retire_to && lfl__rcu_reserve(retire_to)) \
+                                break; /* leave it linked for a later pass */ \
+                        if (removed && lfl__claim(curr, lfl__ref_off(name, ref))) { \
                                 if (prev) { \
                                         struct name##_linked_list *expected = curr; \
                                         if (atomic_compare_exchange_weak_explicit(&(prev->next), &expected, next, memory_order_acq_rel, memory_order_acquire)) { \
-                                                if (cleanup_fn) cleanup_fn(curr); \
-                                                free(curr); \
+                                                lfl__sweep_relink(name, inst, curr, prev, next); \
+                                                lfl__sweep_dispose(name, ref, curr, cleanup_fn, release, retire_to); \
                                                 curr = next; \
+                                                if (sweep_ctl && ++sweep_ctl->unlinked == sweep_ctl->budget) { \
+                                                        lfl__sweep_pause(name, ref, sweep_ctl, prev, curr); \
+                                                        break; \
+                                                } \
                                                 continue; \
                                         } else { \
+                                                lfl__unclaim(curr, lfl__ref_off(name, ref)); \
                                                 prev = NULL; \
                                                 curr = atomic_load_explicit(&(inst##_head), memory_order_acquire); \
+                                                if (sweep_ctl) \
+                                                        sweep_ctl->kept = sweep_ctl->pinned = 0; \
                                                 continue; \
                                         } \
                                 } else { \
                                         struct name##_linked_list *expected = curr; \
                                         if (atomic_compare_exchange_weak_explicit(&(inst##_head), &expected, next, memory_order_acq_rel, memory_order_acquire)) { \
-                                                if (cleanup_fn) cleanup_fn(curr); \
-                                                free(curr); \
+                                                lfl__sweep_relink(name, inst, curr, prev, next); \
+                                                lfl__sweep_dispose(name, ref, curr, cleanup_fn, release, retire_to); \
                                                 curr = next; \
+                                                if (sweep_ctl && ++sweep_ctl->unlinked == sweep_ctl->budget) { \
+                                                        lfl__sweep_pause(name, ref, sweep_ctl, prev, curr); \
+                                                        break; \
+                                                } \
                                                 continue; \
                                         } else { \
+                                                lfl__unclaim(curr, lfl__ref_off(name, ref)); \
                                                 prev = NULL; \
                                                 curr = atomic_load_explicit(&(inst##_head), memory_order_acquire); \
+                                                if (sweep_ctl) \
+                                                        sweep_ctl->kept = sweep_ctl->pinned = 0; \
                                                 continue; \
                                         } \
                                 } \
                         } \
+                        if (sweep_ctl) { \
+                                sweep_ctl->kept++; \
+                                sweep_ctl->pinned += removed != 0; \
+                        } \
                         prev = curr; \
                         curr = next; \
                 } \
+                if (resumed) \
+                        lfl__ref_add(name, resumed, ref, -1); \
+                lfl__token_unlock(&(inst##_unlinker)); \
         } while (0)
 
+/**
+ * @brief atomically sweep logically removed nodes with refcount == 0,
+ *        and optionally call a cleanup function before freeing
+ *
+ * @param name     list type name
+ * @param inst     instance name
+ * @param ref      field name of atomic refcount in the node
+ * @param cleanup  pointer to cleanup function or NULL
+ */
+#define lfl_sweep(name, inst, ref, ...) \
+        do { \
+                void (*_sweep_cleanup)(struct name##_linked_list *) = NULL; \
+                if (sizeof((void *[]){__VA_ARGS__}) / sizeof(void *) > 0) \
+                        _sweep_cleanup = __VA_ARGS__; \
+                lfl__sweep(name, inst, ref, _sweep_cleanup, 1, NULL, NULL); \
+        } while (0)
 
 /**
  * @brief free all nodes in the list (for shutdown)
@@ -452,7 +1405,7 @@
                 struct name##_linked_list *cursor = atomic_load_explicit(&(inst##_head), memory_order_acquire); \
                 while (cursor) { \
                         struct name##_linked_list *next = atomic_load_explicit(&cursor->next, memory_order_relaxed); \
-                        free(cursor); \
+                        lfl_node_free(name, cursor); \
                         cursor = next; \
                 } \
                 atomic_store(&(inst##_head), NULL); \
@@ -492,7 +1445,7 @@
                 struct name##_linked_list *cursor = atomic_load_explicit(&(inst##_head), memory_order_acquire); \
                 while (cursor) { \
                         int removed = atomic_load_explicit(&cursor->removed, memory_order_acquire); \
-                        int refs = atomic_load_explicit(&cursor->ref, memory_order_acquire); \
+                        int refs = lfl__ref_load(name, cursor, ref); \
                         if (removed && refs > 0) _pending++; \
                         cursor = atomic_load_explicit(&cursor->next, memory_order_acquire); \
                 } \
@@ -518,10 +1471,263 @@
                         if (atomic_compare_exchange_weak_explicit(&(inst##_head), &cursor, next, memory_order_acq_rel, memory_order_acquire)) { \
                                 item = cursor; \
                                 if (!next) atomic_store_explicit(&(inst##_tail), (struct name##_linked_list *)NULL, memory_order_release); \
+                                else lfl__cas_prev(name, next, cursor, (struct name##_linked_list *)NULL); \
+                                lfl__stat(name, pops, 1); \
                                 atomic_store_explicit(&(item->next), (struct name##_linked_list *)NULL, memory_order_release); \
-                                atomic_store_explicit(&(item->prev), (struct name##_linked_list *)NULL, memory_order_release); \
+                                lfl__set_prev(name, item, (struct name##_linked_list *)NULL, memory_order_release); \
                                 break; \
                         } \
+                        lfl__stat(name, cas_retries, 1); \
+                } \
+        } while (0)
+
+/**
+ * @brief atomically remove up to max nodes from the head with one CAS
+ *
+ *        walks ahead up to max nodes and claims the whole prefix with a
+ *        single CAS on inst##_head. when the prefix drains the list the tail
+ *        is detached too (including a tail left lagging inside the prefix);
+ *        an appender that raced onto the last claimed node gets its nodes
+ *        handed back to the head. the claimed nodes stay
+ *        linked through next: visit exactly out_count of them starting at
+ *        out_first, since the last one's next points past the batch.
+ *
+ *        the last node is left in place while the appender that added it
+ *        to an empty list has not published the tail yet, so a lone node
+ *        in that state reads as empty. the pop never waits on a preempted
+ *        appender.
+ *
+ * @param name      list type name
+ * @param inst      list instance name
+ * @param out_first variable receiving the first claimed node, or NULL
+ * @param max       most nodes to claim
+ * @param out_count variable receiving the number of nodes claimed
+ */
+#define lfl_pop_head_n(name, inst, out_first, max, out_count) \
+        lfl__pop_head_n(name, inst, out_first, max, out_count, 0)
+
+/*
+ * a drained batch ends on last: point last->next at a closed sentinel, a
+ * removed (and, when the flavor counts references, pinned) node with no
+ * successor. only its address and those fields matter, so each expansion
+ * keeps its own. an appender that loaded the old tail now fails
+ * its link CAS and reloads the tail instead of linking onto a popped node;
+ * evaluates to whatever one linked before the close, or NULL.
+ */
+#define lfl__pop_close(name, last) \
+        ({ \
+                static struct name##_linked_list _closed; \
+                struct name##_linked_list *_open = NULL; \
+                if (!atomic_load_explicit(&_closed.removed, memory_order_relaxed)) { \
+                        lfl__ref_set(name, &_closed, refcount, 1); \
+                        atomic_store_explicit(&_closed.removed, 1, memory_order_relaxed); \
+                } \
+                atomic_compare_exchange_strong_explicit(&(last)->next, &_open, &_closed, \
+                                                        memory_order_acq_rel, memory_order_acquire); \
+                _open; \
+        })
+
+/* lfl_pop_head_n giving up after tries lost head CASes (0: never) */
+#define lfl__pop_head_n(name, inst, out_first, max, out_count, tries) \
+        do { \
+                struct name##_linked_list *_first = atomic_load_explicit(&(inst##_head), memory_order_acquire); \
+                size_t _max = (max), _n = 0; \
+                unsigned int _tries = (tries), _lost = 0; \
+                out_first = NULL; \
+                while (_first && _max) { \
+                        struct name##_linked_list *_last = _first, *_pen = NULL, *_after; \
+                        _n = 1; \
+                        while (_n < _max && (_after = atomic_load_explicit(&_last->next, memory_order_acquire))) { \
+                                _pen = _last; \
+                                _last = _after; \
+                                _n++; \
+                        } \
+                        _after = atomic_load_explicit(&_last->next, memory_order_acquire); \
+                        if (!_after && !atomic_load_explicit(&(inst##_tail), memory_order_acquire)) { \
+                                /* _last went onto an empty list whose tail is not published yet: */ \
+                                /* draining now would let that store land on a popped node */ \
+                                if (!_pen) \
+                                        break; \
+                                _after = _last; \
+                                _last = _pen; \
+                                _n--; \
+                        } \
+                        if (!atomic_compare_exchange_weak_explicit(&(inst##_head), &_first, _after, memory_order_acq_rel, memory_order_acquire)) { \
+                                if (_tries && ++_lost >= _tries) \
+                                        break; \
+                                continue; \
+                        } \
+                        if (!_after) { \
+                                /* drained: detach the tail, unless an appender already moved it on */ \
+                                unsigned int _spins = 0; \
+                                for (;;) { \
+                                        struct name##_linked_list *_t = atomic_load_explicit(&(inst##_tail), memory_order_acquire); \
+                                        struct name##_linked_list *_scan = _first; \
+                                        while (_t && _scan != _t && _scan != _last) \
+                                                _scan = atomic_load_explicit(&_scan->next, memory_order_acquire); \
+                                        if (_t && _scan == _t) { \
+                                                if (!atomic_compare_exchange_strong_explicit(&(inst##_tail), &_t, (struct name##_linked_list *)NULL, \
+                                                                                            memory_order_acq_rel, memory_order_acquire)) \
+                                                        continue; \
+                                                if ((_after = lfl__pop_close(name, _last))) { \
+                                                        /* linked onto _last, but its tail swing failed: re-append it */ \
+                                                        struct name##_linked_list *_end = _after, *_nx; \
+                                                        while ((_nx = atomic_load_explicit(&_end->next, memory_order_acquire))) \
+                                                                _end = _nx; \
+                                                        lfl_add_tail_chain(name, inst, _after, _end); \
+                                                        _after = NULL; \
+                                                } \
+                                                break; \
+                                        } \
+                                        if ((_after = atomic_load_explicit(&_last->next, memory_order_acquire))) { \
+                                                /* an appender linked onto _last and moved the tail past it */ \
+                                                atomic_store_explicit(&(inst##_head), _after, memory_order_release); \
+                                                break; \
+                                        } \
+                                        if (_t) { \
+                                                /* the tail lags on a node popped earlier: finish its appender's swing */ \
+                                                struct name##_linked_list *_tn = atomic_load_explicit(&_t->next, memory_order_acquire); \
+                                                if (_tn) { \
+                                                        atomic_compare_exchange_strong_explicit(&(inst##_tail), &_t, _tn, \
+                                                                                                memory_order_acq_rel, memory_order_acquire); \
+                                                        continue; \
+                                                } \
+                                        } \
+                                        lfl__spin_wait(&_spins); \
+                                } \
+                        } \
+                        if (_after) \
+                                lfl__cas_prev(name, _after, _last, (struct name##_linked_list *)NULL); \
+                        lfl__stat(name, pops, _n); \
+                        lfl__set_prev(name, _first, (struct name##_linked_list *)NULL, memory_order_release); \
+                        out_first = _first; \
+                        break; \
+                } \
+                out_count = out_first ? _n : 0; \
+        } while (0)
+
+/* per-thread xorshift generator for randomized choices */
+static inline uint32_t lfl__rand(void)
+{
+        static _Thread_local uint32_t s;
+
+        if (!s)
+                s = ((uint32_t)(uintptr_t)&s ^ (uint32_t)lfl__buffer_now()) | 1;
+        s ^= s << 13;
+        s ^= s >> 17;
+        s ^= s << 5;
+        return s;
+}
+
+/**
+ * @brief declare a relaxed-FIFO queue of k independent sublists
+ *
+ *        each operation picks two sublists at random and uses the better
+ *        one: inserts go to the sublist that has received fewer items, and
+ *        removals come from the sublist whose head is older, judged by how
+ *        many items it has handed out. threads therefore rarely contend on
+ *        the same head or tail.
+ *
+ *        ordering bound: each sublist is strictly FIFO, and two-choice
+ *        balancing keeps the per-sublist counters within a small gap g of
+ *        one another (O(log log k) with high probability). an item can then
+ *        be overtaken by roughly k * (g + 1) items inserted after it. the
+ *        bound is probabilistic, not a hard guarantee. when both choices are
+ *        empty a removal scans every sublist, so nothing is stranded and
+ *        NULL means all k were empty.
+ *
+ * @param name list type name
+ * @param inst queue instance name
+ * @param k    number of sublists (a few per core is typical)
+ */
+#define lfl_kfifo_vars(name, inst, k) \
+        struct { \
+                _Alignas(64) _Atomic(struct name##_linked_list *) head; \
+                _Atomic(struct name##_linked_list *) tail; \
+                _Atomic(unsigned long) enq; \
+                _Atomic(unsigned long) deq; \
+        } inst##_sub[k]
+
+#define lfl_kfifo_vars_static(name, inst, k) \
+        static lfl_kfifo_vars(name, inst, k)
+
+/* number of sublists in a k-fifo instance */
+#define lfl_kfifo_k(inst) (sizeof(inst##_sub) / sizeof(inst##_sub[0]))
+
+#define lfl_kfifo_init(name, inst) \
+        do { \
+                for (size_t _s = 0; _s < lfl_kfifo_k(inst); _s++) { \
+                        atomic_store(&inst##_sub[_s].head, NULL); \
+                        atomic_store(&inst##_sub[_s].tail, NULL); \
+                        atomic_store(&inst##_sub[_s].enq, 0); \
+                        atomic_store(&inst##_sub[_s].deq, 0); \
+                } \
+        } while (0)
+
+/**
+ * @brief append an initialized node to the less loaded of two sublists
+ *
+ * @param name list type name
+ * @param inst queue instance name
+ * @param ptr  node to insert
+ */
+#define lfl_kfifo_add_tail_ptr(name, inst, ptr) \
+        do { \
+                struct name##_linked_list *_kptr = (ptr); \
+                uint32_t _kr = lfl__rand(); \
+                size_t _ki = _kr % lfl_kfifo_k(inst), _kj = (_kr >> 16) % lfl_kfifo_k(inst); \
+                if (atomic_load_explicit(&inst##_sub[_kj].enq, memory_order_relaxed) < \
+                    atomic_load_explicit(&inst##_sub[_ki].enq, memory_order_relaxed)) \
+                        _ki = _kj; \
+                _Atomic(struct name##_linked_list *) *lfl__self_head_p = &inst##_sub[_ki].head; \
+                _Atomic(struct name##_linked_list *) *lfl__self_tail_p = &inst##_sub[_ki].tail; \
+                lfl_add_tail_ptr(name, lfl__self, _kptr); \
+                atomic_fetch_add_explicit(&inst##_sub[_ki].enq, 1, memory_order_relaxed); \
+        } while (0)
+
+/**
+ * @brief allocate a node and append it, like lfl_add_tail
+ *
+ * @param name list type name
+ * @param inst queue instance name
+ * @param item variable declared to receive the new node
+ */
+#define lfl_kfifo_add_tail(name, inst, item) \
+        struct name##_linked_list *item; \
+        do { \
+                item = lfl_new(name); \
+                lfl_kfifo_add_tail_ptr(name, inst, item); \
+        } while (0)
+
+/**
+ * @brief remove a node from the older of two sublists, like lfl_pop_head
+ *
+ * @param name list type name
+ * @param inst queue instance name
+ * @param item variable receiving the node, or NULL when every sublist is empty
+ */
+#define lfl_kfifo_pop_head(name, inst, item) \
+        do { \
+                uint32_t _kr = lfl__rand(); \
+                size_t _kk = lfl_kfifo_k(inst), _ki = _kr % _kk, _kj = (_kr >> 16) % _kk; \
+                size_t _kn __attribute__((unused)) = 0; \
+                item = NULL; \
+                if (atomic_load_explicit(&inst##_sub[_kj].deq, memory_order_relaxed) < \
+                    atomic_load_explicit(&inst##_sub[_ki].deq, memory_order_relaxed)) { \
+                        size_t _kt = _ki; \
+                        _ki = _kj; \
+                        _kj = _kt; \
+                } \
+                /* the two choices first, then every sublist once */ \
+                for (size_t _ka = 0; _ka < _kk + 2 && !item; _ka++) { \
+                        size_t _ks = _ka == 0 ? _ki : _ka == 1 ? _kj : (_ki + _ka - 1) % _kk; \
+                        if (!atomic_load_explicit(&inst##_sub[_ks].head, memory_order_acquire)) \
+                                continue; \
+                        _Atomic(struct name##_linked_list *) *lfl__self_head_p = &inst##_sub[_ks].head; \
+                        _Atomic(struct name##_linked_list *) *lfl__self_tail_p = &inst##_sub[_ks].tail; \
+                        lfl_pop_head_n(name, lfl__self, item, 1, _kn); \
+                        if (item) \
+                                atomic_fetch_add_explicit(&inst##_sub[_ks].deq, 1, memory_order_relaxed); \
                 } \
         } while (0)
 
@@ -551,7 +1757,8 @@
                                         atomic_store_explicit(&(prev->next), (struct name##_linked_list *)NULL, memory_order_release); \
                                         item = curr; \
                                         atomic_store_explicit(&(item->next), (struct name##_linked_list *)NULL, memory_order_release); \
-                                        atomic_store_explicit(&(item->prev), (struct name##_linked_list *)NULL, memory_order_release); \
+                                        lfl__set_prev(name, item, (struct name##_linked_list *)NULL, memory_order_release); \
+                                        lfl__stat(name, pops, 1); \
                                         break; \
                                 } \
                         } else { \
@@ -559,7 +1766,8 @@
                                         atomic_store_explicit(&(inst##_tail), (struct name##_linked_list *)NULL, memory_order_release); \
                                         item = curr; \
                                         atomic_store_explicit(&(item->next), (struct name##_linked_list *)NULL, memory_order_release); \
-                                        atomic_store_explicit(&(item->prev), (struct name##_linked_list *)NULL, memory_order_release); \
+                                        lfl__set_prev(name, item, (struct name##_linked_list *)NULL, memory_order_release); \
+                                        lfl__stat(name, pops, 1); \
                                         break; \
                                 } \
                         } \
@@ -578,6 +1786,7 @@
  */
 #define lfl_move_before(name, inst, nodeA, nodeB) \
         do { \
+                _Static_assert(lfl__has_prev(name), "lfl_move_before needs prev links"); \
                 struct name##_linked_list *prev_b = atomic_load_explicit(&(nodeB->prev), memory_order_acquire); \
                 struct name##_linked_list *next_b = atomic_load_explicit(&(nodeB->next), memory_order_acquire); \
                 if (prev_b) { \
@@ -597,7 +1806,7 @@
                 struct name##_linked_list *prev_a = atomic_load_explicit(&(nodeA->prev), memory_order_acquire); \
                 do { \
                         prev_a = atomic_load_explicit(&(nodeA->prev), memory_order_acquire); \
-                        atomic_store_explicit(&(nodeB->prev), prev_a, memory_order_relaxed); \
+                        lfl__set_prev(name, nodeB, prev_a, memory_order_relaxed); \
                         atomic_store_explicit(&(nodeB->next), nodeA, memory_order_relaxed); \
                 } while (!atomic_compare_exchange_weak_explicit(&(nodeA->prev), &prev_a, nodeB, memory_order_acq_rel, memory_order_acquire)); \
                 if (prev_a) { \
@@ -619,6 +1828,7 @@
  */
 #define lfl_move_after(name, inst, nodeA, nodeB) \
         do { \
+                _Static_assert(lfl__has_prev(name), "lfl_move_after needs prev links"); \
                 struct name##_linked_list *prev_b = atomic_load_explicit(&(nodeB->prev), memory_order_acquire); \
                 struct name##_linked_list *next_b = atomic_load_explicit(&(nodeB->next), memory_order_acquire); \
                 if (prev_b) { \
@@ -639,7 +1849,7 @@
                 do { \
                         next_a = atomic_load_explicit(&(nodeA->next), memory_order_acquire); \
                         atomic_store_explicit(&(nodeB->next), next_a, memory_order_relaxed); \
-                        atomic_store_explicit(&(nodeB->prev), nodeA, memory_order_relaxed); \
+                        lfl__set_prev(name, nodeB, nodeA, memory_order_relaxed); \
                 } while (!atomic_compare_exchange_weak_explicit(&(nodeA->next), &next_a, nodeB, memory_order_acq_rel, memory_order_acquire)); \
                 if (next_a) { \
                         struct name##_linked_list *exp = nodeA; \
@@ -699,3 +1909,2059 @@
                         _outer = atomic_load_explicit(&(_outer->next), memory_order_acquire); \
                 } \
         } while (0)
+
+/* nodes unlinked by one lfl_rcu_sweep, waiting for the grace period */
+struct lfl__rcu_batch {
+        void **node;
+        size_t n;
+        size_t cap;
+        int failed;             /* the batch could not grow; the sweep stopped early */
+};
+
+/* make room for n more nodes before unlinking them; -1 when out of memory */
+static inline int lfl__rcu_reserve_n(struct lfl__rcu_batch *b, size_t n)
+{
+        while (b->cap - b->n < n) {
+                size_t cap = b->cap ? b->cap * 2 : 64;
+                void **grown = realloc(b->node, cap * sizeof(void *));
+                if (!grown) {
+                        b->failed = 1;
+                        return -1;
+                }
+                b->node = grown;
+                b->cap = cap;
+        }
+        return 0;
+}
+
+static inline int lfl__rcu_reserve(struct lfl__rcu_batch *b)
+{
+        return lfl__rcu_reserve_n(b, 1);
+}
+
+/* room was reserved with lfl__rcu_reserve */
+static inline void lfl__rcu_defer(struct lfl__rcu_batch *b, void *node)
+{
+        b->node[b->n++] = node;
+}
+
+/**
+ * @brief address a list instance for the functions generated by lfl_impl
+ *
+ * @param inst list instance name
+ */
+#define lfl_inst(inst) &(inst##_head), &(inst##_tail), &(inst##_unlinker)
+
+/* parameter list shared by the generated functions */
+#define lfl__impl_params(name) \
+        _Atomic(struct name##_linked_list *) *lfl__self_head_p, \
+        _Atomic(struct name##_linked_list *) *lfl__self_tail_p, \
+        __attribute__((unused)) _Atomic(int) *lfl__self_unlinker_p
+
+/**
+ * @brief generate named functions for a list type
+ *
+ *        each operation is emitted once per translation unit as a static
+ *        inline function wrapping the corresponding macro, so the compiler
+ *        decides what to inline and profiles show real symbols. use after
+ *        lfl_end; instances are passed with lfl_inst:
+ *
+ *            lfl_impl(job)
+ *            job_add_tail(lfl_inst(queue), node);
+ *            lfl_type(job) *next = job_pop_head(lfl_inst(queue));
+ *
+ *        generated: name_add_tail, name_add_head, name_add_tail_chain,
+ *        name_pop_head, name_pop_head_n, name_pop_tail, name_remove,
+ *        name_unlink, name_delete, name_sweep, name_count and name_clear.
+ *        sweeps use the refcount field; lfl_impl_ex names another one.
+ *        name_lfl_sweep is a type-erased budgeted sweep used by
+ *        lfl_reclaimer_watch.
+ *
+ * @param name list type name
+ */
+#define lfl_impl(name) lfl_impl_ex(name, refcount)
+
+/**
+ * @brief lfl_impl for types whose sweeps honour a field other than refcount
+ *
+ * @param name list type name
+ * @param ref  reference-count field checked by name_sweep and name_lfl_sweep
+ */
+#define lfl_impl_ex(name, ref) \
+        __attribute__((unused)) static inline void name##_add_tail(lfl__impl_params(name), struct name##_linked_list *ptr) \
+        { \
+                lfl_add_tail_ptr(name, lfl__self, ptr); \
+        } \
+        __attribute__((unused)) static inline void name##_add_head(lfl__impl_params(name), struct name##_linked_list *ptr) \
+        { \
+                lfl_add_head_ptr(name, lfl__self, ptr); \
+        } \
+        __attribute__((unused)) static inline void name##_add_tail_chain(lfl__impl_params(name), struct name##_linked_list *first, \
+                                                                          struct name##_linked_list *last) \
+        { \
+                lfl_add_tail_chain(name, lfl__self, first, last); \
+        } \
+        __attribute__((unused)) static inline struct name##_linked_list *name##_pop_head(lfl__impl_params(name)) \
+        { \
+                struct name##_linked_list *item = NULL; \
+                lfl_pop_head(name, lfl__self, item); \
+                return item; \
+        } \
+        __attribute__((unused)) static inline size_t name##_pop_head_n(lfl__impl_params(name), struct name##_linked_list **out_first, \
+                                                                       size_t max) \
+        { \
+                size_t count = 0; \
+                lfl_pop_head_n(name, lfl__self, *out_first, max, count); \
+                return count; \
+        } \
+        __attribute__((unused)) static inline struct name##_linked_list *name##_pop_tail(lfl__impl_params(name)) \
+        { \
+                struct name##_linked_list *item = NULL; \
+                lfl_pop_tail(name, lfl__self, item); \
+                return item; \
+        } \
+        __attribute__((unused)) static inline void name##_remove(lfl__impl_params(name), struct name##_linked_list *ptr) \
+        { \
+                (void)lfl__self_head_p; \
+                (void)lfl__self_tail_p; \
+                lfl_remove(name, lfl__self, ptr); \
+        } \
+        __attribute__((unused)) static inline void name##_unlink(lfl__impl_params(name), struct name##_linked_list *ptr) \
+        { \
+                lfl_unlink(name, lfl__self, ptr); \
+        } \
+        __attribute__((unused)) static inline void name##_delete(lfl__impl_params(name), struct name##_linked_list *ptr) \
+        { \
+                lfl_delete(name, lfl__self, ptr); \
+        } \
+        __attribute__((unused)) static inline void name##_sweep(lfl__impl_params(name), \
+                                                                void (*cleanup)(struct name##_linked_list *)) \
+        { \
+                lfl__sweep(name, lfl__self, ref, cleanup, 1, NULL, NULL); \
+        } \
+        __attribute__((unused)) static inline size_t name##_count(lfl__impl_params(name)) \
+        { \
+                size_t count = 0; \
+                (void)lfl__self_tail_p; \
+                lfl_count(name, lfl__self, count); \
+                return count; \
+        } \
+        __attribute__((unused)) static inline void name##_clear(lfl__impl_params(name)) \
+        { \
+                lfl_clear(name, lfl__self); \
+        } \
+        __attribute__((unused)) static inline void name##_lfl_sweep(void *head, void *tail, _Atomic(int) *unlinker, \
+                                                                    void (*cleanup)(void), struct lfl__sweep_ctl *ctl) \
+        { \
+                _Atomic(struct name##_linked_list *) *lfl__self_head_p = head; \
+                _Atomic(struct name##_linked_list *) *lfl__self_tail_p = tail; \
+                _Atomic(int) *lfl__self_unlinker_p = unlinker; \
+                lfl__sweep(name, lfl__self, ref, (void (*)(struct name##_linked_list *))cleanup, 1, NULL, ctl); \
+        }
+
+#ifndef LFL_RECLAIM_MAX
+#define LFL_RECLAIM_MAX 16      /* lists one reclaimer can watch */
+#endif
+
+/**
+ * @brief background reclaimer that sweeps lists when garbage piles up
+ *
+ *        every watched list has its own garbage counter, which removes
+ *        through its watch handle bump (lfl_reclaimer_remove and
+ *        lfl_reclaimer_remove_if); plain lfl_remove does not know about
+ *        the reclaimer and is never slowed down by it. a reclaimer pass looks at every list and
+ *        sweeps one only when its garbage reaches max_garbage nodes, or
+ *        ratio_pct percent of the list (as measured by its last complete
+ *        sweep) with at least LFL_RECLAIM_MIN nodes. a sweep stops after
+ *        unlinking budget nodes, so one pass never stalls for long; the
+ *        next pass picks up where it stopped, regardless of the thresholds.
+ *        to continue there, the sweep pins its last node with a reference;
+ *        flavors without a reference count start over at the head.
+ *
+ *        passes run either on a thread started with lfl_reclaimer_start,
+ *        which runs at SCHED_IDLE priority and wakes every interval_us, or
+ *        inline from lfl_reclaimer_poll, e.g. in a producer loop. only one
+ *        pass runs at a time, and lfl_reclaimer_stop waits for it.
+ *
+ *        a reclaimer sweep holds the list's unlink token like any other
+ *        sweep and skips a list whose token is taken, so hand sweeps and
+ *        lfl_remove_if may still run on a watched list; nodes they free
+ *        are not subtracted from its counter and only bring the next
+ *        reclaimer sweep forward. the reclaimer frees at once, so lists
+ *        read without references inside rcu read sections must not be
+ *        watched.
+ */
+struct lfl_reclaim_watch {
+        void *head;
+        void *tail;
+        _Atomic(int) *unlinker;
+        void (*sweep)(void *, void *, _Atomic(int) *, void (*)(void), struct lfl__sweep_ctl *);
+        void (*cleanup)(void);
+        _Atomic(size_t) garbage;        /* removes since the last sweep */
+        size_t length;                  /* nodes kept by the last complete sweep */
+        size_t pinned;                  /* referenced garbage it had to skip */
+        struct lfl__sweep_ctl ctl;      /* carried over while a sweep is unfinished */
+};
+
+struct lfl_reclaimer {
+        struct lfl_reclaim_watch list[LFL_RECLAIM_MAX];
+        _Atomic(int) nlists;
+        unsigned int ratio_pct;
+        size_t max_garbage;
+        size_t budget;
+        unsigned int interval_us;
+        _Atomic(int) busy;              /* a pass is running */
+        _Atomic(int) stop;
+        int running;
+#ifndef LFL_NO_THREADS
+        pthread_t thread;
+#endif
+        _Atomic(size_t) sweeps;
+        _Atomic(size_t) reclaimed;
+};
+
+#ifndef LFL_RECLAIM_MIN
+#define LFL_RECLAIM_MIN 64      /* garbage below this never triggers on ratio alone */
+#endif
+
+/**
+ * @brief initialize a reclaimer
+ *
+ * @param r           reclaimer
+ * @param ratio_pct   sweep when garbage reaches this percentage of a list, 0 to disable
+ * @param max_garbage sweep when garbage reaches this many nodes, 0 to disable
+ * @param budget      most nodes unlinked per list per pass, 0 for no limit
+ */
+static inline void lfl_reclaimer_init(struct lfl_reclaimer *r, unsigned int ratio_pct, size_t max_garbage,
+                                      size_t budget)
+{
+        memset(r, 0, sizeof(*r));
+        r->ratio_pct = ratio_pct;
+        r->max_garbage = max_garbage;
+        r->budget = budget;
+        r->interval_us = 1000;
+}
+
+static inline int lfl__reclaim_due(const struct lfl_reclaimer *r, struct lfl_reclaim_watch *l)
+{
+        size_t g = atomic_load_explicit(&l->garbage, memory_order_relaxed);
+
+        g = g > l->pinned ? g - l->pinned : 0;
+        if (l->ctl.stopped && g)
+                return 1;
+        if (r->max_garbage && g >= r->max_garbage)
+                return 1;
+        return r->ratio_pct && g >= LFL_RECLAIM_MIN && g * 100 >= (size_t)r->ratio_pct * (l->length + g);
+}
+
+/* drop n from a garbage counter without wrapping below zero */
+static inline void lfl__reclaim_settle(_Atomic(size_t) *garbage, size_t n)
+{
+        size_t g = atomic_load_explicit(garbage, memory_order_relaxed);
+
+        while (!atomic_compare_exchange_weak_explicit(garbage, &g, g > n ? g - n : 0, memory_order_relaxed,
+                                                      memory_order_relaxed))
+                ;
+}
+
+/* account add newly removed and sub freed nodes to a watched list */
+static inline void lfl__reclaim_count(struct lfl_reclaim_watch *l, size_t add, size_t sub)
+{
+        if (add)
+                atomic_fetch_add_explicit(&l->garbage, add, memory_order_relaxed);
+        if (sub)
+                lfl__reclaim_settle(&l->garbage, sub);
+}
+
+/**
+ * @brief run one pass over the watched lists unless another is running
+ *
+ * @return nodes freed by this pass, 0 when nothing was due or it was busy
+ */
+static inline size_t lfl_reclaimer_poll(struct lfl_reclaimer *r)
+{
+        size_t freed = 0;
+        int n;
+
+        if (atomic_load_explicit(&r->busy, memory_order_relaxed) ||
+            atomic_exchange_explicit(&r->busy, 1, memory_order_acquire))
+                return 0;
+        n = atomic_load_explicit(&r->nlists, memory_order_acquire);
+        for (int i = 0; i < n; i++) {
+                struct lfl_reclaim_watch *l = &r->list[i];
+                if (!l->head || !lfl__reclaim_due(r, l))
+                        continue;
+                /* kept and pinned run on across the passes of one unfinished sweep */
+                l->ctl.budget = r->budget;
+                l->ctl.unlinked = 0;
+                l->ctl.stopped = 0;
+                l->ctl.nowait = 1;
+                l->sweep(l->head, l->tail, l->unlinker, l->cleanup, &l->ctl);
+                if (l->ctl.busy)
+                        continue;       /* another unlinker has the list; try next pass */
+                lfl__reclaim_settle(&l->garbage, l->ctl.unlinked);
+                if (!l->ctl.stopped) {
+                        l->length = l->ctl.kept;
+                        l->pinned = l->ctl.pinned;
+                }
+                freed += l->ctl.unlinked;
+                atomic_fetch_add_explicit(&r->sweeps, 1, memory_order_relaxed);
+        }
+        atomic_fetch_add_explicit(&r->reclaimed, freed, memory_order_relaxed);
+        atomic_store_explicit(&r->busy, 0, memory_order_release);
+        return freed;
+}
+
+#ifndef LFL_NO_THREADS
+#ifdef SCHED_IDLE
+#define LFL__SCHED_IDLE SCHED_IDLE
+#else
+#define LFL__SCHED_IDLE 5       /* the linux value, hidden without _GNU_SOURCE */
+#endif
+
+static void *lfl__reclaimer_main(void *arg)
+{
+        struct lfl_reclaimer *r = arg;
+        struct timespec ts = { r->interval_us / 1000000, (long)(r->interval_us % 1000000) * 1000 };
+        struct sched_param sp = { 0 };
+
+        /* best effort: without it the thread just runs at normal priority */
+        pthread_setschedparam(pthread_self(), LFL__SCHED_IDLE, &sp);
+        while (!atomic_load_explicit(&r->stop, memory_order_acquire)) {
+                lfl_reclaimer_poll(r);
+                nanosleep(&ts, NULL);
+        }
+        return NULL;
+}
+
+/**
+ * @brief start the background thread; set interval_us before calling
+ *
+ * @return 0 on success or an error number from pthread_create
+ */
+static inline int lfl_reclaimer_start(struct lfl_reclaimer *r)
+{
+        int err;
+
+        atomic_store_explicit(&r->stop, 0, memory_order_relaxed);
+        err = pthread_create(&r->thread, NULL, lfl__reclaimer_main, r);
+        r->running = err == 0;
+        return err;
+}
+#else
+/* built with LFL_NO_THREADS: call lfl_reclaimer_poll from an existing loop instead */
+static inline int lfl_reclaimer_start(struct lfl_reclaimer *r)
+{
+        (void)r;
+        return ENOSYS;
+}
+#endif
+
+/*
+ * stop and join the background thread, if any, wait out an inline pass,
+ * then finish every sweep left unfinished so no node stays pinned by a
+ * resume cursor
+ */
+static inline void lfl_reclaimer_stop(struct lfl_reclaimer *r)
+{
+        int n = atomic_load_explicit(&r->nlists, memory_order_acquire);
+        unsigned int spins = 0;
+
+#ifndef LFL_NO_THREADS
+        if (r->running) {
+                atomic_store_explicit(&r->stop, 1, memory_order_release);
+                pthread_join(r->thread, NULL);
+                r->running = 0;
+        }
+#endif
+        /* an inline lfl_reclaimer_poll may still be mid-pass */
+        while (atomic_exchange_explicit(&r->busy, 1, memory_order_acquire))
+                lfl__spin_wait(&spins);
+        for (int i = 0; i < n; i++) {
+                struct lfl_reclaim_watch *l = &r->list[i];
+                if (!l->ctl.resume)
+                        continue;
+                l->ctl.budget = l->ctl.unlinked = 0;
+                l->ctl.nowait = 0;
+                l->sweep(l->head, l->tail, l->unlinker, l->cleanup, &l->ctl);
+                lfl__reclaim_settle(&l->garbage, l->ctl.unlinked);
+                atomic_fetch_add_explicit(&r->reclaimed, l->ctl.unlinked, memory_order_relaxed);
+        }
+        atomic_store_explicit(&r->busy, 0, memory_order_release);
+}
+
+static inline struct lfl_reclaim_watch *lfl__reclaimer_add(struct lfl_reclaimer *r, void *head, void *tail,
+                                                           _Atomic(int) *unlinker,
+                                                           void (*sweep)(void *, void *, _Atomic(int) *,
+                                                                         void (*)(void), struct lfl__sweep_ctl *),
+                                                           void (*cleanup)(void))
+{
+        int i = atomic_load_explicit(&r->nlists, memory_order_relaxed);
+
+        if (i == LFL_RECLAIM_MAX)
+                return NULL;
+        r->list[i] = (struct lfl_reclaim_watch){ .head = head, .tail = tail, .unlinker = unlinker,
+                                                 .sweep = sweep, .cleanup = cleanup };
+        atomic_store_explicit(&r->nlists, i + 1, memory_order_release);
+        return &r->list[i];
+}
+
+/**
+ * @brief hand a list to the reclaimer
+ *
+ *        requires lfl_impl(name), or lfl_impl_ex(name, ref) to sweep on
+ *        another field. the returned handle owns the list's garbage
+ *        counter: remove through lfl_reclaimer_remove and
+ *        lfl_reclaimer_remove_if to count. the handle lives inside rec.
+ *        register lists before starting the thread or polling.
+ *
+ * @param name    list type name
+ * @param inst    list instance name
+ * @param rec     struct lfl_reclaimer
+ * @param cleanup void (*)(lfl_type(name) *) called before freeing, or NULL
+ *
+ * @return struct lfl_reclaim_watch *, or NULL when LFL_RECLAIM_MAX lists
+ *         are already watched
+ */
+#define lfl_reclaimer_watch(name, inst, rec, cleanup) \
+        lfl__reclaimer_add(&(rec), &(inst##_head), &(inst##_tail), &(inst##_unlinker), name##_lfl_sweep, \
+                           (void (*)(void))(void (*)(struct name##_linked_list *))(cleanup))
+
+/**
+ * @brief lfl_remove that counts the node against a watched list
+ *
+ * @param name   list type name
+ * @param inst   list instance name
+ * @param watch  struct lfl_reclaim_watch * returned by lfl_reclaimer_watch
+ * @param target pointer to node to remove
+ */
+#define lfl_reclaimer_remove(name, inst, watch, target) \
+        do { \
+                lfl_remove(name, inst, target); \
+                lfl__reclaim_count((watch), 1, 0); \
+        } while (0)
+
+/**
+ * @brief intrusive list hook
+ *
+ *        an object embeds one lfl_hook per list it can be on, so a single
+ *        allocation can sit on several lists at once. each hook carries its
+ *        own next/prev, removed flag and refcount, so removal and sweeping
+ *        are tracked per list. hook lists never free memory: the object's
+ *        owner releases it, typically from a sweep cleanup once every hook
+ *        is off its list.
+ *
+ *        the hook type is an ordinary list type named lfl_hook, so every
+ *        lfl_* macro that does not allocate or free works on hook lists by
+ *        passing lfl_hook as the name. the lfl_hook_* wrappers below add the
+ *        container-of step between hooks and their objects.
+ */
+lfl_def(lfl_hook)
+lfl_end
+
+typedef struct lfl_hook_linked_list lfl_hook;
+
+/* object containing the hook at ptr, which is its member named member */
+#define lfl_hook_entry(ptr, type, member) \
+        ((type *)((char *)(ptr) - offsetof(type, member)))
+
+/* declare / initialize head and tail pointers of a hook list */
+#define lfl_hook_vars(inst) lfl_vars(lfl_hook, inst)
+#define lfl_hook_init(inst) lfl_init(lfl_hook, inst)
+
+/**
+ * @brief iterate over the objects on a hook list, skipping removed hooks
+ *
+ *        like lfl_foreach, the next hook is stashed before the body runs so
+ *        the current object may be removed or unlinked inside the loop.
+ *
+ * @param type   object type containing the hook
+ * @param member name of the lfl_hook member linking this list
+ * @param inst   list instance name
+ * @param obj    loop variable (type *)
+ */
+#define lfl_hook_foreach(type, member, inst, obj) \
+        type *obj = NULL; \
+        lfl_hook *obj##_hook = atomic_load_explicit(&(inst##_head), memory_order_acquire), *obj##_hook_next = NULL; \
+        for (; obj##_hook != NULL; obj##_hook = obj##_hook_next) \
+                if ((obj##_hook_next = atomic_load_explicit(&(obj##_hook->next), memory_order_acquire)), \
+                    (obj = lfl_hook_entry(obj##_hook, type, member)), \
+                    !atomic_load_explicit(&(obj##_hook->removed), memory_order_acquire))
+
+/**
+ * @brief link an object onto the tail / head of a hook list
+ *
+ * @param inst   list instance name
+ * @param obj    object pointer
+ * @param member name of the lfl_hook member to link through
+ */
+#define lfl_hook_add_tail(inst, obj, member) \
+        do { \
+                lfl_hook *_hook = &(obj)->member; \
+                lfl_add_tail_ptr(lfl_hook, inst, _hook); \
+        } while (0)
+
+#define lfl_hook_add_head(inst, obj, member) \
+        do { \
+                lfl_hook *_hook = &(obj)->member; \
+                lfl_add_head_ptr(lfl_hook, inst, _hook); \
+        } while (0)
+
+/* logically remove an object from one hook list; its other hooks are untouched */
+#define lfl_hook_remove(inst, obj, member) \
+        atomic_store_explicit(&(obj)->member.removed, 1, memory_order_release)
+
+/* unlink an object from one hook list immediately; nothing is freed */
+#define lfl_hook_unlink(inst, obj, member) \
+        do { \
+                lfl_hook *_hook = &(obj)->member; \
+                lfl_unlink(lfl_hook, inst, _hook); \
+        } while (0)
+
+/* nonzero while the object's hook is not marked removed */
+#define lfl_hook_linked(obj, member) \
+        (!atomic_load_explicit(&(obj)->member.removed, memory_order_acquire))
+
+/**
+ * @brief find the first object on a hook list whose field equals value
+ *
+ * @param type   object type containing the hook
+ * @param member name of the lfl_hook member linking this list
+ * @param inst   list instance name
+ * @param obj    variable declared to receive the match or NULL
+ * @param field  object field to compare
+ * @param value  value to compare against
+ */
+#define lfl_hook_find(type, member, inst, obj, field, value) \
+        type *obj = NULL; \
+        do { \
+                lfl_hook_foreach(type, member, inst, obj##_scan) { \
+                        if (obj##_scan->field == (value)) { \
+                                obj = obj##_scan; \
+                                break; \
+                        } \
+                } \
+        } while (0)
+
+/**
+ * @brief pop the first object off a hook list
+ *
+ * @param type   object type containing the hook
+ * @param member name of the lfl_hook member linking this list
+ * @param inst   list instance name
+ * @param obj    type * variable set to the object, or NULL when empty
+ */
+#define lfl_hook_pop_head(type, member, inst, obj) \
+        do { \
+                lfl_hook *_hook = NULL; \
+                lfl_pop_head(lfl_hook, inst, _hook); \
+                obj = _hook ? lfl_hook_entry(_hook, type, member) : NULL; \
+        } while (0)
+
+/* count objects on a hook list whose hook is not removed */
+#define lfl_hook_count(inst, out) lfl_count(lfl_hook, inst, out)
+
+/**
+ * @brief unlink removed hooks with refcount == 0 from one hook list
+ *
+ *        nothing is freed; cleanup receives each unlinked hook and can use
+ *        lfl_hook_entry to reach the object, e.g. to free it once its last
+ *        hook is gone.
+ *
+ * @param inst    list instance name
+ * @param cleanup void (*)(lfl_hook *) or NULL
+ */
+#define lfl_hook_sweep(inst, cleanup) \
+        lfl__sweep(lfl_hook, inst, refcount, cleanup, 0, NULL, NULL)
+
+/* forget every hook on the list without touching the objects */
+#define lfl_hook_clear(inst) lfl_init(lfl_hook, inst)
+
+/* nodes per work unit handed to a parallel worker */
+#define LFL_PAR_CHUNK 4096
+
+/* chunks one worker walks in lockstep so their cache misses overlap */
+#ifndef LFL_PAR_WAYS
+#define LFL_PAR_WAYS 4
+#endif
+
+/* the chunk table grows in blocks so a published entry never moves */
+#define LFL__PAR_BLOCK 1024
+#define LFL__PAR_BLOCKS 4096
+
+struct lfl__par_chunk {
+        void *first;                    /* runs up to the next chunk's first node */
+        void *last;                     /* sweeping: last node kept */
+        void **samples;                 /* indexed scans: pinned splits found inside */
+        size_t nsamples;
+        size_t rest;                    /* live nodes after the last sample */
+};
+
+/**
+ * @brief sampled skip index for repeated parallel scans of one list
+ *
+ *        holds every LFL_PAR_CHUNKth node of the list, pinned through a
+ *        reference field, so lfl_parallel_foreach_ix can hand out chunks
+ *        without walking to them first. each indexed scan resamples the
+ *        chunks it walks, so the index follows the list as it grows and
+ *        shrinks. set up with lfl_par_index_init, release with
+ *        lfl_par_index_destroy.
+ */
+struct lfl_par_index {
+        void **nodes;                   /* split points in list order */
+        size_t n;
+        size_t ref_off;
+};
+
+struct lfl__par {
+        struct lfl__par_chunk **blocks;
+        _Atomic(size_t) nchunks;        /* chunks published so far */
+        _Atomic(int) scouted;           /* the walk hit the end: nchunks is final */
+        void *scout;                    /* where the walk stopped */
+        size_t scout_n;                 /* nodes walked since the last split */
+        size_t next_off;
+        size_t removed_off;
+        void (*fn)(void *, void *, int);
+        void *ctx;
+        _Atomic(size_t) claim;          /* next chunk to hand out */
+        struct lfl_par_index *index;    /* resampled by this scan, or NULL */
+
+        /* sweeping only */
+        size_t prev_off;
+        size_t ref_off;
+        void (*on_reap)(void *);        /* cleanup callback for freed nodes */
+        struct lfl_arena *arena;
+        const struct lfl_allocator *allocator;
+        _Atomic(long) reclaimed;
+};
+
+struct lfl__par_worker {
+        struct lfl__par *par;
+        int id;
+#ifndef LFL_NO_THREADS
+        pthread_t thread;
+#endif
+};
+
+/* one chunk a foreach worker is part way through */
+struct lfl__par_way {
+        struct lfl__par_chunk *chunk;
+        void *node;
+        void *end;
+        size_t since;                   /* live nodes since the last sample */
+};
+
+#define lfl__par_next(par, node) \
+        atomic_load_explicit((_Atomic(void *) *)((char *)(node) + (par)->next_off), memory_order_acquire)
+
+#define lfl__par_removed(par, node) \
+        atomic_load_explicit((_Atomic(int) *)((char *)(node) + (par)->removed_off), memory_order_acquire)
+
+#define lfl__par_chunk(par, i) \
+        (&(par)->blocks[(i) / LFL__PAR_BLOCK][(i) % LFL__PAR_BLOCK])
+
+#define lfl__par_pin(ix, node, n) \
+        atomic_fetch_add_explicit((_Atomic(int) *)((char *)(node) + (ix)->ref_off), (n), memory_order_acq_rel)
+
+/* append a chunk starting at first; 0 when the table is full or out of memory */
+static inline int lfl__par_publish(struct lfl__par *par, void *first)
+{
+        size_t n = atomic_load_explicit(&par->nchunks, memory_order_relaxed);
+        size_t b = n / LFL__PAR_BLOCK;
+
+        if (b == LFL__PAR_BLOCKS)
+                return 0;
+        if (!par->blocks[b] && !(par->blocks[b] = calloc(LFL__PAR_BLOCK, sizeof(struct lfl__par_chunk))))
+                return 0;
+        par->blocks[b][n % LFL__PAR_BLOCK].first = first;
+        atomic_store_explicit(&par->nchunks, n + 1, memory_order_release);
+        return 1;
+}
+
+/*
+ * walk on from where the scout stopped, publishing a split every
+ * LFL_PAR_CHUNK nodes, until upto chunks exist or the list ends. workers
+ * start on a chunk as soon as the one after it is published, so nobody
+ * waits for the whole walk. if the table cannot grow, the last chunk just
+ * runs to the end of the list.
+ */
+static inline void lfl__par_scout(struct lfl__par *par, size_t upto)
+{
+        void *node = par->scout;
+
+        while (node && atomic_load_explicit(&par->nchunks, memory_order_relaxed) < upto) {
+                node = lfl__par_next(par, node);
+                if (node && ++par->scout_n == LFL_PAR_CHUNK) {
+                        par->scout_n = 0;
+                        if (!lfl__par_publish(par, node))
+                                node = NULL;
+                }
+        }
+        par->scout = node;
+        if (!node)
+                atomic_store_explicit(&par->scouted, 1, memory_order_release);
+}
+
+/*
+ * start the chunk table at head, then at every indexed node; the scout
+ * carries on from the last of them. -1 on ENOMEM.
+ */
+static inline int lfl__par_open(struct lfl__par *par, void *head)
+{
+        par->blocks = calloc(LFL__PAR_BLOCKS, sizeof(*par->blocks));
+        if (!par->blocks)
+                return -1;
+        if (head && lfl__par_publish(par, head) && par->index)
+                for (size_t i = 0; i < par->index->n; i++)
+                        if (par->index->nodes[i] != head && !lfl__par_publish(par, par->index->nodes[i]))
+                                break;
+        if (atomic_load_explicit(&par->nchunks, memory_order_relaxed))
+                par->scout = lfl__par_chunk(par, atomic_load_explicit(&par->nchunks, memory_order_relaxed) - 1)->first;
+        if (!par->scout)
+                atomic_store_explicit(&par->scouted, 1, memory_order_release);
+        return 0;
+}
+
+static inline void lfl__par_close(struct lfl__par *par)
+{
+        for (size_t b = 0; b < LFL__PAR_BLOCKS && par->blocks[b]; b++) {
+                for (size_t i = 0; i < LFL__PAR_BLOCK; i++)
+                        free(par->blocks[b][i].samples);
+                free(par->blocks[b]);
+        }
+        free(par->blocks);
+}
+
+/* 1 when chunk i and its end are published, 0 if not yet, -1 past the end */
+static inline int lfl__par_ready(struct lfl__par *par, size_t i)
+{
+        int done = atomic_load_explicit(&par->scouted, memory_order_acquire);
+        size_t n = atomic_load_explicit(&par->nchunks, memory_order_acquire);
+
+        if (i + 1 < n || (done && i < n))
+                return 1;
+        return done ? -1 : 0;
+}
+
+/*
+ * hand out the next chunk. with wait set, block until the scout has
+ * published its end; otherwise only take a chunk that is ready now.
+ * 0 once there is nothing left to take.
+ */
+static inline int lfl__par_claim(struct lfl__par *par, size_t *i, int wait)
+{
+        unsigned int spins = 0;
+        size_t c;
+        int r;
+
+        if (!wait) {
+                c = atomic_load_explicit(&par->claim, memory_order_relaxed);
+                while (lfl__par_ready(par, c) > 0)
+                        if (atomic_compare_exchange_weak_explicit(&par->claim, &c, c + 1,
+                                                                  memory_order_relaxed, memory_order_relaxed)) {
+                                *i = c;
+                                return 1;
+                        }
+                return 0;
+        }
+        c = atomic_fetch_add_explicit(&par->claim, 1, memory_order_relaxed);
+        while ((r = lfl__par_ready(par, c)) == 0)
+                lfl__spin_wait(&spins);
+        *i = c;
+        return r > 0;
+}
+
+/* first node of the chunk after i, or NULL for the last chunk */
+static inline void *lfl__par_end(struct lfl__par *par, size_t i)
+{
+        return i + 1 < atomic_load_explicit(&par->nchunks, memory_order_acquire)
+                ? lfl__par_chunk(par, i + 1)->first : NULL;
+}
+
+/* pin node as a split for the next indexed scan; skipped on ENOMEM or when it is being unlinked */
+static inline void lfl__par_sample(struct lfl__par *par, struct lfl__par_chunk *c, void *node)
+{
+        size_t n = c->nsamples;
+
+        if (n >= 4 ? !(n & (n - 1)) : !n) {
+                void **grown = realloc(c->samples, (n ? 2 * n : 4) * sizeof(void *));
+                if (!grown)
+                        return;
+                c->samples = grown;
+        }
+        if (lfl__pin(node, par->index->ref_off))
+                c->samples[c->nsamples++] = node;
+}
+
+/*
+ * worker loop: keep up to LFL_PAR_WAYS chunks in flight and step each one
+ * node at a time in turn, so the loads of their next pointers overlap
+ * instead of one cache miss waiting on the last. only an idle worker
+ * blocks on the scout.
+ */
+static inline void *lfl__par_run(void *arg)
+{
+        struct lfl__par_worker *w = arg;
+        struct lfl__par *par = w->par;
+        struct lfl__par_way way[LFL_PAR_WAYS];
+        int nways = 0, refill = 1;
+        size_t i;
+
+        for (;;) {
+                while (refill && nways < LFL_PAR_WAYS && lfl__par_claim(par, &i, nways == 0)) {
+                        way[nways].chunk = lfl__par_chunk(par, i);
+                        way[nways].node = way[nways].chunk->first;
+                        way[nways].end = lfl__par_end(par, i);
+                        way[nways].since = 0;
+                        nways++;
+                }
+                refill = 0;
+                if (!nways)
+                        break;
+                for (int k = 0; k < nways; ) {
+                        struct lfl__par_way *wy = &way[k];
+                        void *node = wy->node;
+                        if (!node || node == wy->end) {
+                                wy->chunk->rest = wy->since;
+                                *wy = way[--nways];
+                                refill = 1;
+                                continue;
+                        }
+                        wy->node = lfl__par_next(par, node);
+                        if (!lfl__par_removed(par, node)) {
+                                par->fn(node, par->ctx, w->id);
+                                if (par->index && ++wy->since >= LFL_PAR_CHUNK) {
+                                        lfl__par_sample(par, wy->chunk, node);
+                                        wy->since = 0;
+                                }
+                        }
+                        k++;
+                }
+        }
+        return NULL;
+}
+
+/* resolve a requested worker count; <= 0 means one per online cpu */
+static inline int lfl__par_threads(int nthreads)
+{
+        if (nthreads <= 0) {
+                long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                nthreads = cpus > 0 ? (int)cpus : 1;
+        }
+        return nthreads;
+}
+
+/*
+ * run a worker loop on the caller plus up to nthreads - 1 spawned threads.
+ * the caller scouts just far enough to see whether the list has a chunk
+ * for every worker, starts the helpers, finishes the walk, then works.
+ * with a single worker nothing is scouted: the last chunk runs to the end.
+ * built with LFL_NO_THREADS, the caller is the only worker. returns the
+ * number of workers that ran, or -1.
+ */
+static inline int lfl__par_launch(struct lfl__par *par, int nthreads, void *(*run)(void *))
+{
+        struct lfl__par_worker *workers;
+        int started = 1;
+        size_t n;
+
+#ifdef LFL_NO_THREADS
+        nthreads = 1;
+#endif
+        if (nthreads > 1) {
+                lfl__par_scout(par, (size_t)nthreads + 1);
+        } else {
+                /* a lone worker walks the tail itself; splitting it only adds a pass */
+                par->scout = NULL;
+                atomic_store_explicit(&par->scouted, 1, memory_order_release);
+        }
+        n = atomic_load_explicit(&par->nchunks, memory_order_relaxed);
+        if (par->scout == NULL && (size_t)nthreads > n)
+                nthreads = n ? (int)n : 1;
+        workers = calloc(nthreads, sizeof(*workers));
+        if (!workers)
+                return -1;
+        for (int t = 0; t < nthreads; t++) {
+                workers[t].par = par;
+                workers[t].id = t;
+        }
+#ifndef LFL_NO_THREADS
+        for (int t = 1; t < nthreads; t++, started++)
+                if (pthread_create(&workers[t].thread, NULL, run, &workers[t]) != 0)
+                        break;
+#endif
+        lfl__par_scout(par, SIZE_MAX);
+        run(&workers[0]);
+#ifndef LFL_NO_THREADS
+        for (int t = 1; t < started; t++)
+                pthread_join(workers[t].thread, NULL);
+#endif
+        free(workers);
+        return started;
+}
+
+/* drop the pins taken by lfl__par_sample when the scan's samples go unused */
+static inline void lfl__par_unsample(struct lfl__par *par)
+{
+        for (size_t i = 0; i < atomic_load_explicit(&par->nchunks, memory_order_relaxed); i++) {
+                struct lfl__par_chunk *c = lfl__par_chunk(par, i);
+                for (size_t s = 0; s < c->nsamples; s++)
+                        lfl__par_pin(par->index, c->samples[s], -1);
+        }
+}
+
+/*
+ * rebuild the index from this scan: the old splits that still lead a
+ * decent stretch of live nodes, plus the nodes sampled inside each chunk.
+ * dropped splits are unpinned; on ENOMEM the old index stays as it was.
+ */
+static inline void lfl__par_reindex(struct lfl__par *par)
+{
+        struct lfl_par_index *ix = par->index;
+        size_t nchunks = atomic_load_explicit(&par->nchunks, memory_order_relaxed);
+        size_t cap = nchunks, n = 0, since = 0;
+        void **nodes;
+
+        for (size_t i = 0; i < nchunks; i++)
+                cap += lfl__par_chunk(par, i)->nsamples;
+        nodes = malloc((cap ? cap : 1) * sizeof(void *));
+        if (!nodes) {
+                lfl__par_unsample(par);
+                return;
+        }
+        for (size_t i = 0; i < nchunks; i++) {
+                struct lfl__par_chunk *c = lfl__par_chunk(par, i);
+                /* chunk 0 starts at the head, which needs no pin */
+                if (i && since >= LFL_PAR_CHUNK / 2 && !lfl__par_removed(par, c->first) &&
+                    lfl__pin(c->first, ix->ref_off)) {
+                        nodes[n++] = c->first;
+                        since = 0;
+                }
+                for (size_t s = 0; s < c->nsamples; s++)
+                        nodes[n++] = c->samples[s];
+                since = (c->nsamples ? 0 : since) + c->rest;
+        }
+        for (size_t i = 0; i < ix->n; i++)
+                lfl__par_pin(ix, ix->nodes[i], -1);
+        free(ix->nodes);
+        ix->nodes = nodes;
+        ix->n = n;
+}
+
+/*
+ * the caller walks the list publishing a split every LFL_PAR_CHUNK nodes
+ * (or starts from an index's splits and walks only what lies past them)
+ * while it and nthreads - 1 helpers claim chunks from a shared counter, so
+ * an uneven chunk never stalls the others. returns the number of workers
+ * that ran, or -1 if the chunk table could not be allocated.
+ */
+static inline int lfl__parallel_foreach(void *head, size_t next_off, size_t removed_off,
+                                        struct lfl_par_index *index, int nthreads,
+                                        void (*fn)(void *, void *, int), void *ctx)
+{
+        struct lfl__par par = {
+                .next_off = next_off, .removed_off = removed_off, .fn = fn, .ctx = ctx, .index = index,
+        };
+        int ran;
+
+        if (lfl__par_open(&par, head) != 0)
+                return -1;
+        ran = lfl__par_launch(&par, lfl__par_threads(nthreads), lfl__par_run);
+        if (index && ran > 0)
+                lfl__par_reindex(&par);
+        else if (index)
+                lfl__par_unsample(&par);
+        lfl__par_close(&par);
+        return ran;
+}
+
+/**
+ * @brief visit every live node on several threads at once
+ *
+ *        the calling thread walks the next pointers and publishes a chunk
+ *        boundary every LFL_PAR_CHUNK nodes; up to nthreads - 1 helpers
+ *        start on each chunk as soon as its end is known, so no worker
+ *        waits for the whole walk. fn receives the worker index (0 ..
+ *        nthreads - 1) so per-thread results can be kept without atomics
+ *        and merged by the caller afterwards. nodes appended during the
+ *        call may or may not be visited; removal and deletion rules are the
+ *        same as for lfl_foreach.
+ *
+ * @param name     list type name
+ * @param inst     list instance name
+ * @param nthreads worker count, or <= 0 for one per online cpu
+ * @param fn       void (*)(lfl_type(name) *item, void *ctx, int worker)
+ * @param ctx      opaque pointer passed to fn
+ *
+ * @return number of workers that ran, or -1 on allocation failure
+ */
+#define lfl_parallel_foreach(name, inst, nthreads, fn, ctx) \
+        lfl_parallel_foreach_ix(name, inst, NULL, nthreads, fn, ctx)
+
+/**
+ * @brief lfl_parallel_foreach starting from a skip index
+ *
+ *        chunks start at the index's pinned splits, so workers begin at
+ *        once and only the part of the list past the last split is walked
+ *        to find more. the scan resamples the index as it goes. while an
+ *        index holds nodes, they must not be popped, unlinked, moved or
+ *        cleared, and only one scan may use it at a time.
+ *
+ * @param index    struct lfl_par_index *, or NULL for a plain scan
+ */
+#define lfl_parallel_foreach_ix(name, inst, index, nthreads, fn, ctx) \
+        lfl__parallel_foreach(atomic_load_explicit(&(inst##_head), memory_order_acquire), \
+                              offsetof(struct name##_linked_list, next), \
+                              offsetof(struct name##_linked_list, removed), (index), (nthreads), \
+                              (void (*)(void *, void *, int))(void (*)(struct name##_linked_list *, void *, int))(fn), \
+                              (ctx))
+
+/**
+ * @brief set up an empty skip index for name's lists
+ *
+ * @param name list type name
+ * @param ix   struct lfl_par_index
+ * @param ref  field name of the atomic reference count that pins splits
+ */
+#define lfl_par_index_init(name, ix, ref) \
+        do { \
+                _Static_assert(lfl__has_field(name, ref), "lfl_par_index pins splits through a reference field"); \
+                (ix).nodes = NULL; \
+                (ix).n = 0; \
+                (ix).ref_off = offsetof(struct name##_linked_list, ref); \
+        } while (0)
+
+/* unpin every split; the index is empty afterwards and may be reused */
+static inline void lfl_par_index_destroy(struct lfl_par_index *ix)
+{
+        for (size_t i = 0; i < ix->n; i++)
+                lfl__par_pin(ix, ix->nodes[i], -1);
+        free(ix->nodes);
+        ix->nodes = NULL;
+        ix->n = 0;
+}
+
+/* per-worker counter padded to its own cache line */
+struct lfl__par_tally {
+        _Alignas(64) long n;
+};
+
+static inline void lfl__par_count_fn(void *item, void *ctx, int worker)
+{
+        (void)item;
+        ((struct lfl__par_tally *)ctx)[worker].n++;
+}
+
+static inline long lfl__parallel_count(void *head, size_t next_off, size_t removed_off,
+                                       struct lfl_par_index *index, int nthreads)
+{
+        struct lfl__par_tally *tally;
+        long total = 0;
+        int ran;
+
+        nthreads = lfl__par_threads(nthreads);
+        tally = aligned_alloc(64, nthreads * sizeof(*tally));
+        if (!tally)
+                return -1;
+        memset(tally, 0, nthreads * sizeof(*tally));
+        ran = lfl__parallel_foreach(head, next_off, removed_off, index, nthreads, lfl__par_count_fn, tally);
+        for (int t = 0; t < ran; t++)
+                total += tally[t].n;
+        free(tally);
+        return ran < 0 ? -1 : total;
+}
+
+/**
+ * @brief lfl_count using several threads
+ *
+ * @param name     list type name
+ * @param inst     list instance name
+ * @param nthreads worker count, or <= 0 for one per online cpu
+ * @param out      variable receiving the live node count (-1 on failure)
+ */
+#define lfl_parallel_count(name, inst, nthreads, out) \
+        lfl_parallel_count_ix(name, inst, NULL, nthreads, out)
+
+/* lfl_parallel_count starting from a skip index, as lfl_parallel_foreach_ix */
+#define lfl_parallel_count_ix(name, inst, index, nthreads, out) \
+        do { \
+                out = lfl__parallel_count(atomic_load_explicit(&(inst##_head), memory_order_acquire), \
+                                          offsetof(struct name##_linked_list, next), \
+                                          offsetof(struct name##_linked_list, removed), \
+                                          (index), (nthreads)); \
+        } while (0)
+
+#define lfl__par_prev(par, node) \
+        ((_Atomic(void *) *)((char *)(node) + (par)->prev_off))
+
+#define lfl__par_ref(par, node) \
+        ((par)->ref_off == LFL__NO_OFF ? 0 \
+                : atomic_load_explicit((_Atomic(int) *)((char *)(node) + (par)->ref_off), memory_order_acquire))
+
+/* a node the sweep may unlink: removed, unreferenced, and not the last node */
+#define lfl__par_dead(par, node, next) \
+        ((next) && lfl__par_removed(par, node) && lfl__par_ref(par, node) == 0)
+
+/* lfl__par_dead, and claimed for unlinking; see LFL__DYING */
+#define lfl__par_doomed(par, node, next) \
+        (lfl__par_dead(par, node, next) && lfl__claim((node), (par)->ref_off))
+
+/* unlink the run first..last from between prev (NULL for the head) and next */
+static inline int lfl__par_unlink(struct lfl__par *par, _Atomic(void *) *head_p, void *prev,
+                                  void *first, void *last, void *next)
+{
+        void *expected = first;
+        _Atomic(void *) *link = prev ? (_Atomic(void *) *)((char *)prev + par->next_off) : head_p;
+
+        if (!atomic_compare_exchange_strong_explicit(link, &expected, next, memory_order_acq_rel, memory_order_acquire))
+                return 0;
+        expected = last;
+        if (par->prev_off != LFL__NO_OFF)
+                atomic_compare_exchange_strong_explicit(lfl__par_prev(par, next), &expected, prev,
+                                                        memory_order_acq_rel, memory_order_acquire);
+        return 1;
+}
+
+/* run the cleanup callback over a batch of unlinked nodes, then free them */
+static inline void lfl__par_reap(struct lfl__par *par, void **dead, size_t n)
+{
+        if (par->on_reap)
+                for (size_t i = 0; i < n; i++)
+                        par->on_reap(dead[i]);
+        for (size_t i = 0; i < n; i++)
+                lfl__node_free(par->arena, par->allocator, dead[i]);
+        atomic_fetch_add_explicit(&par->reclaimed, (long)n, memory_order_relaxed);
+}
+
+/*
+ * sweep worker: a chunk's first node is left alone so it is a stable
+ * predecessor that no other worker writes through; only nodes after it
+ * are unlinked. a node whose unlink CAS loses a race is kept for the
+ * next sweep rather than restarting the chunk.
+ */
+static inline void *lfl__par_sweep_run(void *arg)
+{
+        struct lfl__par_worker *w = arg;
+        struct lfl__par *par = w->par;
+        void *batch[256];
+        size_t nbatch = 0, i;
+
+        while (lfl__par_claim(par, &i, 1)) {
+                struct lfl__par_chunk *c = lfl__par_chunk(par, i);
+                void *prev = c->first;
+                void *end = lfl__par_end(par, i);
+                void *curr = lfl__par_next(par, prev);
+                while (curr && curr != end) {
+                        void *next = lfl__par_next(par, curr);
+                        if (lfl__par_doomed(par, curr, next)) {
+                                if (lfl__par_unlink(par, NULL, prev, curr, curr, next)) {
+                                        batch[nbatch++] = curr;
+                                        if (nbatch == sizeof(batch) / sizeof(batch[0])) {
+                                                lfl__par_reap(par, batch, nbatch);
+                                                nbatch = 0;
+                                        }
+                                        curr = next;
+                                        continue;
+                                }
+                                lfl__unclaim(curr, par->ref_off);
+                        }
+                        prev = curr;
+                        curr = next;
+                }
+                c->last = prev;
+        }
+        lfl__par_reap(par, batch, nbatch);
+        return NULL;
+}
+
+/*
+ * chunks are swept in parallel, then the chunk-leading nodes are swept
+ * sequentially, each against the last node kept in the chunk before it.
+ */
+static inline long lfl__parallel_sweep(_Atomic(void *) *head_p, size_t next_off, size_t prev_off,
+                                       size_t removed_off, size_t ref_off, int nthreads,
+                                       void (*cleanup)(void *), struct lfl_arena *arena,
+                                       const struct lfl_allocator *allocator)
+{
+        struct lfl__par par = {
+                .next_off = next_off, .removed_off = removed_off, .prev_off = prev_off,
+                .ref_off = ref_off, .on_reap = cleanup, .arena = arena, .allocator = allocator,
+        };
+        void *pred = NULL;
+
+        if (lfl__par_open(&par, atomic_load_explicit(head_p, memory_order_acquire)) != 0)
+                return -1;
+        if (lfl__par_launch(&par, lfl__par_threads(nthreads), lfl__par_sweep_run) < 0) {
+                lfl__par_close(&par);
+                return -1;
+        }
+
+        for (size_t i = 0; i < atomic_load_explicit(&par.nchunks, memory_order_relaxed); i++) {
+                struct lfl__par_chunk *c = lfl__par_chunk(&par, i);
+                void *lead = c->first;
+                void *next = lfl__par_next(&par, lead);
+                if (lfl__par_doomed(&par, lead, next)) {
+                        if (lfl__par_unlink(&par, head_p, pred, lead, lead, next)) {
+                                lfl__par_reap(&par, &lead, 1);
+                                if (c->last == lead)
+                                        continue;
+                        } else {
+                                lfl__unclaim(lead, par.ref_off);
+                        }
+                }
+                pred = c->last;
+        }
+
+        lfl__par_close(&par);
+        return atomic_load_explicit(&par.reclaimed, memory_order_relaxed);
+}
+
+/**
+ * @brief lfl_sweep spread over several threads
+ *
+ *        the list is split into chunks as in lfl_parallel_foreach and every
+ *        worker unlinks removed nodes with refcount == 0 inside its own
+ *        chunks, so workers never CAS the same pointer. each worker batches
+ *        its unlinked nodes and runs cleanup and the frees per batch;
+ *        cleanup therefore runs on worker threads. the last node of the
+ *        list is never unlinked, so concurrent tail appends stay safe; it
+ *        is picked up by a later sweep once something follows it. holds the
+ *        list's unlink token, so other sweeps of the list wait for it.
+ *
+ * @param name     list type name
+ * @param inst     list instance name
+ * @param ref      field name of atomic refcount in the node
+ * @param nthreads worker count, or <= 0 for one per online cpu
+ * @param cleanup  void (*)(lfl_type(name) *) or NULL
+ * @param out      long receiving the number of nodes freed (-1 on failure)
+ */
+#define lfl_parallel_sweep(name, inst, ref, nthreads, cleanup, out) \
+        do { \
+                void (*_psweep_cleanup)(struct name##_linked_list *) = (cleanup); \
+                lfl__token_lock(&(inst##_unlinker)); \
+                out = lfl__parallel_sweep((_Atomic(void *) *)&(inst##_head), \
+                                          offsetof(struct name##_linked_list, next), \
+                                          lfl__prev_off(name), \
+                                          offsetof(struct name##_linked_list, removed), \
+                                          lfl__ref_off(name, ref), (nthreads), \
+                                          (void (*)(void *))_psweep_cleanup, lfl__arena(name), \
+                                          lfl__allocator(name)); \
+                lfl__token_unlock(&(inst##_unlinker)); \
+                if (out > 0) \
+                        lfl__stat(name, reclaimed, out); \
+        } while (0)
+
+/*
+ * single pass under the unlink token: mark matches, then unlink each run of
+ * consecutive removed, unreferenced nodes with one CAS on the node before
+ * the run. unlinked nodes are cleaned up and freed in batches, or, with
+ * retire, collected for a grace period; once retire cannot grow, runs stay
+ * linked. a run whose CAS loses a race stays marked for a later sweep.
+ * returns the number of nodes marked.
+ */
+static inline long lfl__remove_if(struct lfl__par *par, _Atomic(void *) *head_p,
+                                  int (*pred)(void *, void *), void *ctx, struct lfl__rcu_batch *retire)
+{
+        void *batch[256];
+        size_t nbatch = 0, run = 0;
+        void *prev = NULL, *first = NULL, *last = NULL;
+        void *curr = atomic_load_explicit(head_p, memory_order_acquire);
+        long marked = 0;
+
+        while (curr) {
+                void *next = lfl__par_next(par, curr);
+                _Atomic(int) *removed = (_Atomic(int) *)((char *)curr + par->removed_off);
+                if (!atomic_load_explicit(removed, memory_order_acquire) && pred(curr, ctx)) {
+                        atomic_store_explicit(removed, 1, memory_order_release);
+                        marked++;
+                }
+                if (lfl__par_doomed(par, curr, next)) {
+                        if (!first)
+                                first = curr;
+                        last = curr;
+                        run++;
+                        curr = next;
+                        continue;
+                }
+                if (first) {
+                        int unlinked = (!retire || lfl__rcu_reserve_n(retire, run) == 0) &&
+                                       lfl__par_unlink(par, head_p, prev, first, last, curr);
+                        for (void *n = first, *n_next; n != curr; n = n_next) {
+                                n_next = lfl__par_next(par, n);
+                                if (!unlinked) {
+                                        lfl__unclaim(n, par->ref_off);
+                                } else if (retire) {
+                                        lfl__rcu_defer(retire, n);
+                                } else {
+                                        batch[nbatch++] = n;
+                                        if (nbatch == sizeof(batch) / sizeof(batch[0])) {
+                                                lfl__par_reap(par, batch, nbatch);
+                                                nbatch = 0;
+                                        }
+                                }
+                        }
+                        first = NULL;
+                        run = 0;
+                }
+                prev = curr;
+                curr = next;
+        }
+        lfl__par_reap(par, batch, nbatch);
+        return marked;
+}
+
+/**
+ * @brief remove every node matching a predicate
+ *
+ *        matching nodes are marked removed, and each run of consecutive
+ *        removed nodes whose ref field is zero is unlinked with a single CAS and
+ *        handed to cleanup and free in batches. nodes still referenced, or
+ *        in a run that loses a CAS race, stay marked for a later sweep. the
+ *        last node of the list is marked but never unlinked, so concurrent
+ *        tail appends stay safe.
+ *
+ *        the pass holds the list's unlink token, so other sweeps of the
+ *        list wait for it. unlinked nodes are freed at once, like
+ *        lfl_sweep: threads walking the list without a reference must not
+ *        run beside it. lfl_rcu_remove_if frees after a grace period
+ *        instead.
+ *
+ * @param name    list type name
+ * @param inst    list instance name
+ * @param ref     reference-count field name (usually refcount)
+ * @param pred    int (*)(lfl_type(name) *item, void *ctx), nonzero to remove
+ * @param ctx     opaque pointer passed to pred
+ * @param cleanup void (*)(lfl_type(name) *) called before freeing, or NULL
+ *
+ * @return number of nodes newly marked removed
+ */
+#define lfl_remove_if(name, inst, ref, pred, ctx, cleanup) \
+        lfl__remove_if_counted(name, inst, ref, NULL, pred, ctx, cleanup)
+
+/**
+ * @brief lfl_remove_if on a watched list
+ *
+ *        matches it could not unlink at once are counted against the
+ *        list's reclaimer garbage.
+ *
+ * @param watch struct lfl_reclaim_watch * returned by lfl_reclaimer_watch
+ *
+ * @return number of nodes newly marked removed
+ */
+#define lfl_reclaimer_remove_if(name, inst, ref, watch, pred, ctx, cleanup) \
+        lfl__remove_if_counted(name, inst, ref, watch, pred, ctx, cleanup)
+
+#define lfl__remove_if_counted(name, inst, ref, watch, pred, ctx, cleanup) \
+        ({ \
+                struct lfl_reclaim_watch *_rif_watch = (watch); \
+                struct lfl__par _rif_par = { \
+                        .next_off = offsetof(struct name##_linked_list, next), \
+                        .prev_off = lfl__prev_off(name), \
+                        .removed_off = offsetof(struct name##_linked_list, removed), \
+                        .ref_off = lfl__ref_off(name, ref), \
+                        .on_reap = (void (*)(void *))(void (*)(struct name##_linked_list *))(cleanup), \
+                        .arena = lfl__arena(name), \
+                        .allocator = lfl__allocator(name), \
+                }; \
+                lfl__token_lock(&(inst##_unlinker)); \
+                long _rif_marked = lfl__remove_if(&_rif_par, (_Atomic(void *) *)&(inst##_head), \
+                                                  (int (*)(void *, void *))(int (*)(struct name##_linked_list *, void *))(pred), \
+                                                  (ctx), NULL); \
+                lfl__token_unlock(&(inst##_unlinker)); \
+                long _rif_freed = atomic_load_explicit(&_rif_par.reclaimed, memory_order_relaxed); \
+                lfl__stat(name, removes, _rif_marked); \
+                lfl__stat(name, reclaimed, _rif_freed); \
+                if (_rif_watch) \
+                        lfl__reclaim_count(_rif_watch, (size_t)_rif_marked, (size_t)_rif_freed); \
+                _rif_marked; \
+        })
+
+/**
+ * @brief resumable traversal state
+ *
+ *        unlike lfl_foreach, a cursor is an ordinary object: it can live in
+ *        a struct, be advanced a slice at a time and be resumed later. the
+ *        node it last returned is pinned by holding a reference on its
+ *        refcount, so sweeps leave that node linked and allocated while the
+ *        cursor is paused on it.
+ *
+ *        a step reads a node before its pin is in place. a cursor started
+ *        with lfl_rcu_cursor_init takes each step inside a read section of
+ *        its domain and may run against lfl_rcu_sweep and helping
+ *        traversals on that domain. a cursor started with lfl_cursor_init
+ *        has no such guard: sweeps that free nodes at once (lfl_sweep,
+ *        lfl_remove_if, lfl_parallel_sweep) must not overlap its steps.
+ */
+typedef struct lfl_cursor {
+        _Atomic(void *) *head_p;
+        void *node;                     /* pinned node, NULL before start / after end */
+        size_t next_off;
+        size_t removed_off;
+        size_t ref_off;
+        int done;
+        void *guard;                    /* read-side domain, or NULL */
+        int (*enter)(void *guard);
+        void (*leave)(void *guard);
+} lfl_cursor;
+
+#define lfl__cursor_ref(cur, node) ((_Atomic(int) *)((char *)(node) + (cur)->ref_off))
+#define lfl__cursor_link(cur, node) ((_Atomic(void *) *)((char *)(node) + (cur)->next_off))
+
+/*
+ * pin the node *link points at. a node an unlinker has claimed refuses the
+ * pin (see LFL__DYING) and is stepped over through its own next pointer,
+ * which the read section keeps readable. otherwise check that the link
+ * still points there, so a node popped in between is not kept.
+ */
+static inline void *lfl__cursor_pin(lfl_cursor *cur, _Atomic(void *) *link)
+{
+        void *node = atomic_load_explicit(link, memory_order_acquire);
+
+        while (node) {
+                void *again;
+                if (!lfl__pin(node, cur->ref_off)) {
+                        link = lfl__cursor_link(cur, node);
+                        node = atomic_load_explicit(link, memory_order_acquire);
+                        continue;
+                }
+                again = atomic_load_explicit(link, memory_order_seq_cst);
+                if (again == node)
+                        break;
+                atomic_fetch_sub_explicit(lfl__cursor_ref(cur, node), 1, memory_order_acq_rel);
+                node = again;
+        }
+        return node;
+}
+
+static inline void lfl__cursor_close(lfl_cursor *cur)
+{
+        if (cur->node)
+                atomic_fetch_sub_explicit(lfl__cursor_ref(cur, cur->node), 1, memory_order_acq_rel);
+        cur->node = NULL;
+        cur->done = 1;
+}
+
+/*
+ * step to the next live node, pinning it and unpinning the previous one.
+ * removed nodes are skipped hand over hand, so every node the walk reads
+ * is pinned while it is read.
+ */
+static inline void *lfl__cursor_next(lfl_cursor *cur)
+{
+        void *prev = cur->node;
+        void *node;
+
+        if (cur->done)
+                return NULL;
+        if (cur->guard && cur->enter(cur->guard) != 0) {
+                lfl__cursor_close(cur);
+                return NULL;
+        }
+        node = lfl__cursor_pin(cur, prev ? lfl__cursor_link(cur, prev) : cur->head_p);
+        while (node && atomic_load_explicit((_Atomic(int) *)((char *)node + cur->removed_off), memory_order_acquire)) {
+                void *skip = node;
+                node = lfl__cursor_pin(cur, lfl__cursor_link(cur, skip));
+                atomic_fetch_sub_explicit(lfl__cursor_ref(cur, skip), 1, memory_order_acq_rel);
+        }
+        if (!node)
+                cur->done = 1;
+        if (prev)
+                atomic_fetch_sub_explicit(lfl__cursor_ref(cur, prev), 1, memory_order_acq_rel);
+        if (cur->guard)
+                cur->leave(cur->guard);
+        cur->node = node;
+        return node;
+}
+
+/**
+ * @brief start a cursor at the head of a list instance
+ *
+ * @param name list type name
+ * @param inst list instance name
+ * @param cur  lfl_cursor to initialize
+ */
+#define lfl_cursor_init(name, inst, cur) \
+        do { \
+                _Static_assert(lfl__has_field(name, refcount), "lfl_cursor pins nodes through refcount"); \
+                (cur).head_p = (_Atomic(void *) *)&(inst##_head); \
+                (cur).node = NULL; \
+                (cur).next_off = offsetof(struct name##_linked_list, next); \
+                (cur).removed_off = offsetof(struct name##_linked_list, removed); \
+                (cur).ref_off = offsetof(struct name##_linked_list, refcount); \
+                (cur).done = 0; \
+                (cur).guard = NULL; \
+        } while (0)
+
+/**
+ * @brief advance a cursor to the next node that is not logically removed
+ *
+ *        the returned node stays pinned until the following call or
+ *        lfl_cursor_close. if the pinned node is popped while the cursor is
+ *        paused, its next pointer is cleared and the scan ends there.
+ *
+ * @param name list type name
+ * @param cur  lfl_cursor
+ *
+ * @return the next live node, or NULL once the end has been reached
+ */
+#define lfl_cursor_next(name, cur) \
+        ((struct name##_linked_list *)lfl__cursor_next(&(cur)))
+
+/* release the cursor's pin; required if the scan is abandoned early */
+#define lfl_cursor_close(cur) \
+        lfl__cursor_close(&(cur))
+
+/**
+ * @brief per-node sequence counter for in-place payload updates
+ *
+ *        declare a field of this type between lfl_def and lfl_end and pass
+ *        its name to the seqlock helpers below. writers bracket updates with
+ *        lfl_write_begin / lfl_write_end; readers copy the fields they need
+ *        between lfl_read_begin and lfl_read_retry and go again if a writer
+ *        overlapped. an odd value means a write is in progress. concurrent
+ *        writers of the same node serialize on the counter.
+ */
+typedef _Atomic(unsigned int) lfl_seq;
+
+/* claim the counter: move it from even to odd, waiting out another writer */
+static inline void lfl__write_begin(lfl_seq *seq)
+{
+        unsigned int s = atomic_load_explicit(seq, memory_order_relaxed);
+        unsigned int spins = 0;
+
+        for (;;) {
+                if (s & 1) {
+                        lfl__spin_wait(&spins);
+                        s = atomic_load_explicit(seq, memory_order_relaxed);
+                        continue;
+                }
+                if (atomic_compare_exchange_weak_explicit(seq, &s, s + 1, memory_order_acquire, memory_order_relaxed))
+                        break;
+        }
+        /* keep the payload stores after the odd value */
+        atomic_thread_fence(memory_order_release);
+}
+
+static inline unsigned int lfl__read_begin(lfl_seq *seq)
+{
+        unsigned int s;
+        unsigned int spins = 0;
+
+        while ((s = atomic_load_explicit(seq, memory_order_acquire)) & 1)
+                lfl__spin_wait(&spins);
+        return s;
+}
+
+static inline int lfl__read_retry(lfl_seq *seq, unsigned int start)
+{
+        /* keep the payload loads before the re-check */
+        atomic_thread_fence(memory_order_acquire);
+        return atomic_load_explicit(seq, memory_order_relaxed) != start;
+}
+
+/**
+ * @brief start an in-place update of a node's payload
+ *
+ * @param node  node pointer
+ * @param field name of the node's lfl_seq field
+ */
+#define lfl_write_begin(node, field) \
+        lfl__write_begin(&(node)->field)
+
+/* publish the update started by lfl_write_begin */
+#define lfl_write_end(node, field) \
+        atomic_fetch_add_explicit(&(node)->field, 1, memory_order_release)
+
+/**
+ * @brief start a consistent read of a node's payload
+ *
+ * @param node  node pointer
+ * @param field name of the node's lfl_seq field
+ *
+ * @return token to pass to lfl_read_retry
+ */
+#define lfl_read_begin(node, field) \
+        lfl__read_begin(&(node)->field)
+
+/**
+ * @brief check whether a read raced with a writer
+ *
+ * @param node  node pointer
+ * @param field name of the node's lfl_seq field
+ * @param start token returned by lfl_read_begin
+ *
+ * @return nonzero if the copied fields may be torn and must be re-read
+ */
+#define lfl_read_retry(node, field, start) \
+        lfl__read_retry(&(node)->field, (start))
+
+/* write a whole buffer in large chunks */
+static inline int lfl__write_all(int fd, const char *buf, size_t len)
+{
+        while (len) {
+                ssize_t n = write(fd, buf, len > ((size_t)1 << 30) ? ((size_t)1 << 30) : len);
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return -1;
+                }
+                buf += n;
+                len -= (size_t)n;
+        }
+        return 0;
+}
+
+/* writer for lfl_serialize_fd; ctx points at the descriptor */
+static inline int lfl__fd_write(const void *buf, size_t len, void *ctx)
+{
+        return lfl__write_all(*(const int *)ctx, buf, len);
+}
+
+/* reader for lfl_deserialize_fd; ctx points at the descriptor */
+static inline ssize_t lfl__fd_read(void *buf, size_t len, void *ctx)
+{
+        ssize_t n;
+
+        while ((n = read(*(const int *)ctx, buf, len)) < 0 && errno == EINTR)
+                ;
+        return n;
+}
+
+/* records are staged through buffers of this size */
+#ifndef LFL_STREAM_BUF
+#define LFL_STREAM_BUF ((size_t)1 << 20)
+#endif
+
+/* buffered fixed-size record stream over caller-supplied writer or reader */
+struct lfl__stream {
+        int (*write)(const void *buf, size_t len, void *ctx);
+        ssize_t (*read)(void *buf, size_t len, void *ctx);
+        void *ctx;
+        int err;
+        size_t rec;
+        char *buf;
+        size_t cap;
+        size_t len;
+        size_t pos;
+};
+
+static inline int lfl__stream_open(struct lfl__stream *st, size_t rec_size, void *ctx)
+{
+        memset(st, 0, sizeof(*st));
+        if (rec_size == 0 || rec_size > LFL_STREAM_BUF) {
+                errno = EINVAL;
+                return -1;
+        }
+        st->ctx = ctx;
+        st->rec = rec_size;
+        st->cap = LFL_STREAM_BUF - LFL_STREAM_BUF % rec_size;
+        st->buf = malloc(st->cap);
+        return st->buf ? 0 : -1;
+}
+
+static inline int lfl__stream_flush(struct lfl__stream *st)
+{
+        if (!st->err && st->len && st->write(st->buf, st->len, st->ctx) != 0)
+                st->err = errno ? errno : EIO;
+        st->len = 0;
+        return st->err ? -1 : 0;
+}
+
+/* reserve room for the next record, flushing a full buffer first */
+static inline void *lfl__stream_put(struct lfl__stream *st)
+{
+        void *rec;
+
+        if (st->len + st->rec > st->cap && lfl__stream_flush(st) != 0)
+                return NULL;
+        rec = st->buf + st->len;
+        st->len += st->rec;
+        return rec;
+}
+
+/* next record from the stream, refilling the buffer with large reads */
+static inline const void *lfl__stream_get(struct lfl__stream *st)
+{
+        const void *rec;
+
+        if (st->len - st->pos < st->rec) {
+                size_t rest = st->len - st->pos;
+                memmove(st->buf, st->buf + st->pos, rest);
+                st->len = rest;
+                st->pos = 0;
+                while (st->len < st->cap) {
+                        ssize_t n = st->read(st->buf + st->len, st->cap - st->len, st->ctx);
+                        if (n < 0) {
+                                st->err = errno ? errno : EIO;
+                                return NULL;
+                        }
+                        if (n == 0)
+                                break;
+                        st->len += (size_t)n;
+                }
+                if (st->len < st->rec) {
+                        if (st->len)
+                                st->err = EINVAL;       /* truncated trailing record */
+                        return NULL;
+                }
+        }
+        rec = st->buf + st->pos;
+        st->pos += st->rec;
+        return rec;
+}
+
+/* true once every buffered record has been handed out */
+static inline int lfl__stream_drained(const struct lfl__stream *st)
+{
+        return st->len - st->pos < st->rec;
+}
+
+static inline void lfl__stream_close(struct lfl__stream *st)
+{
+        free(st->buf);
+        st->buf = NULL;
+}
+
+/**
+ * @brief stream every live node through a writer as fixed-size records
+ *
+ *        walks the list like lfl_foreach, so each node that is not
+ *        logically removed is encoded once as the walk reaches it. records
+ *        are packed into LFL_STREAM_BUF sized buffers and each full buffer
+ *        is handed to writer in one call, so a file, socket or writev-based
+ *        writer sees a handful of large writes instead of one per node.
+ *
+ * @param name     list type name
+ * @param inst     list instance name
+ * @param writer   int writer(const void *buf, size_t len, void *ctx):
+ *                 consume all len bytes and return 0, or -1 with errno set
+ * @param ctx      opaque pointer passed to writer
+ * @param rec_size bytes per record
+ * @param encode   void encode(const lfl_type(name) *node, void *rec)
+ * @param out      long receiving the number of records, or -1 on error
+ */
+#define lfl_serialize(name, inst, writer, ctx, rec_size, encode, out) \
+        do { \
+                struct lfl__stream _st; \
+                long _n = -1; \
+                if (lfl__stream_open(&_st, (rec_size), (ctx)) == 0) { \
+                        _st.write = (writer); \
+                        _n = 0; \
+                        lfl_foreach(name, inst, _item) { \
+                                void *_rec = lfl__stream_put(&_st); \
+                                if (!_rec) \
+                                        break; \
+                                encode(_item, _rec); \
+                                _n++; \
+                        } \
+                        if (lfl__stream_flush(&_st) != 0) \
+                                _n = -1; \
+                        lfl__stream_close(&_st); \
+                } \
+                out = _n; \
+        } while (0)
+
+/**
+ * @brief lfl_serialize to a file, pipe or socket descriptor
+ *
+ * @param fd descriptor written with large write(2) calls
+ */
+#define lfl_serialize_fd(name, inst, fd, rec_size, encode, out) \
+        do { \
+                int _ser_fd = (fd); \
+                lfl_serialize(name, inst, lfl__fd_write, &_ser_fd, rec_size, encode, out); \
+        } while (0)
+
+/**
+ * @brief rebuild nodes from a record stream and append them to the tail
+ *
+ *        nodes decoded from each buffer are linked privately and spliced
+ *        onto the list with a single lfl_add_tail_chain, so loading costs
+ *        one CAS per buffer rather than one per node.
+ *
+ * @param name     list type name
+ * @param inst     list instance name
+ * @param reader   ssize_t reader(void *buf, size_t len, void *ctx): fill up
+ *                 to len bytes and return the count, 0 at the end of the
+ *                 stream, or -1 with errno set
+ * @param ctx      opaque pointer passed to reader
+ * @param rec_size bytes per record
+ * @param decode   void decode(const void *rec, lfl_type(name) *node)
+ * @param out      long receiving the number of nodes added, or -1 on error;
+ *                 nodes read before an error stay in the list
+ */
+#define lfl_deserialize(name, inst, reader, ctx, rec_size, decode, out) \
+        do { \
+                struct lfl__stream _st; \
+                long _n = -1; \
+                if (lfl__stream_open(&_st, (rec_size), (ctx)) == 0) { \
+                        struct name##_linked_list *_first = NULL, *_last = NULL; \
+                        const void *_rec; \
+                        _st.read = (reader); \
+                        _n = 0; \
+                        while ((_rec = lfl__stream_get(&_st)) != NULL) { \
+                                struct name##_linked_list *_node = lfl_new(name); \
+                                if (!_node) { \
+                                        _st.err = ENOMEM; \
+                                        break; \
+                                } \
+                                decode(_rec, _node); \
+                                lfl__set_prev(name, _node, _last, memory_order_relaxed); \
+                                if (_last) \
+                                        atomic_store_explicit(&_last->next, _node, memory_order_relaxed); \
+                                else \
+                                        _first = _node; \
+                                _last = _node; \
+                                _n++; \
+                                if (lfl__stream_drained(&_st)) { \
+                                        lfl_add_tail_chain(name, inst, _first, _last); \
+                                        _first = _last = NULL; \
+                                } \
+                        } \
+                        if (_first) \
+                                lfl_add_tail_chain(name, inst, _first, _last); \
+                        if (_st.err) \
+                                _n = -1; \
+                        lfl__stream_close(&_st); \
+                } \
+                out = _n; \
+        } while (0)
+
+/**
+ * @brief lfl_deserialize from a descriptor positioned at the first record
+ *
+ * @param fd descriptor read with large read(2) calls
+ */
+#define lfl_deserialize_fd(name, inst, fd, rec_size, decode, out) \
+        do { \
+                int _des_fd = (fd); \
+                lfl_deserialize(name, inst, lfl__fd_read, &_des_fd, rec_size, decode, out); \
+        } while (0)
+
+/**
+ * @brief fetch-and-add segment queue
+ *
+ *        a linked list of array segments in the style of FAAArrayQueue:
+ *        enqueuers and dequeuers claim slots with atomic_fetch_add on the
+ *        segment's enqidx / deqidx, so under contention threads spread over
+ *        different slots instead of retrying one CAS. a CAS is only needed
+ *        to hand over a slot and, once per LFL_FAAQ_SEG operations, to link
+ *        or advance a segment. it is lock-free (an enqueuer whose slot was
+ *        taken by a faster dequeuer retries), not wait-free.
+ *
+ *        segments come from a private arena and are recycled through its
+ *        ABA-safe free stack, never unmapped while the queue exists. every
+ *        access to a segment holds a count in seg->users and re-checks that
+ *        the segment is still head or tail; a segment retired off the head
+ *        goes back to the pool only when its last user leaves.
+ *
+ *        items are arbitrary non-NULL pointers, normally lfl nodes.
+ */
+#define LFL_FAAQ_SEG 1024
+
+/* seg->users flag: unlinked from the queue, recycle once idle */
+#define LFL__FAAQ_RETIRED (1UL << 62)
+
+/* marks a slot whose dequeuer arrived before its enqueuer */
+#define LFL__FAAQ_TAKEN ((void *)1)
+
+struct lfl__faaq_seg {
+        _Atomic(uint32_t) link;         /* pool free-stack link, must stay first */
+        _Atomic(unsigned long) users;
+        _Atomic(struct lfl__faaq_seg *) next;
+        _Alignas(64) _Atomic(unsigned int) enqidx;
+        _Alignas(64) _Atomic(unsigned int) deqidx;
+        _Alignas(64) _Atomic(void *) items[LFL_FAAQ_SEG];
+};
+
+struct lfl_faaq {
+        _Alignas(64) _Atomic(struct lfl__faaq_seg *) head;
+        _Alignas(64) _Atomic(struct lfl__faaq_seg *) tail;
+        struct lfl_arena pool;
+};
+
+/* prepare a segment for the tail, optionally holding a first item */
+static inline struct lfl__faaq_seg *lfl__faaq_seg_new(struct lfl_faaq *q, void *first)
+{
+        struct lfl__faaq_seg *seg = lfl__arena_alloc(&q->pool, 0);
+
+        if (!seg)
+                return NULL;
+        /* users is left alone: a stale reader may still be backing out */
+        for (unsigned int i = 0; i < LFL_FAAQ_SEG; i++)
+                atomic_store_explicit(&seg->items[i], NULL, memory_order_relaxed);
+        atomic_store_explicit(&seg->items[0], first, memory_order_relaxed);
+        atomic_store_explicit(&seg->enqidx, first ? 1 : 0, memory_order_relaxed);
+        atomic_store_explicit(&seg->deqidx, 0, memory_order_relaxed);
+        atomic_store_explicit(&seg->next, NULL, memory_order_relaxed);
+        return seg;
+}
+
+/* pin the segment currently in *where so it cannot be recycled under us */
+static inline struct lfl__faaq_seg *lfl__faaq_acquire(_Atomic(struct lfl__faaq_seg *) *where)
+{
+        for (;;) {
+                struct lfl__faaq_seg *seg = atomic_load_explicit(where, memory_order_acquire);
+                atomic_fetch_add_explicit(&seg->users, 1, memory_order_acq_rel);
+                if (atomic_load_explicit(where, memory_order_acquire) == seg)
+                        return seg;
+                atomic_fetch_sub_explicit(&seg->users, 1, memory_order_acq_rel);
+        }
+}
+
+/* whoever sees a retired segment go idle returns it to the pool, once */
+static inline void lfl__faaq_recycle(struct lfl_faaq *q, struct lfl__faaq_seg *seg, unsigned long users)
+{
+        if (users == LFL__FAAQ_RETIRED &&
+            atomic_compare_exchange_strong_explicit(&seg->users, &users, 0, memory_order_acq_rel, memory_order_relaxed))
+                lfl_arena_free(&q->pool, seg);
+}
+
+static inline void lfl__faaq_release(struct lfl_faaq *q, struct lfl__faaq_seg *seg)
+{
+        lfl__faaq_recycle(q, seg, atomic_fetch_sub_explicit(&seg->users, 1, memory_order_acq_rel) - 1);
+}
+
+static inline void lfl__faaq_retire(struct lfl_faaq *q, struct lfl__faaq_seg *seg)
+{
+        lfl__faaq_recycle(q, seg, atomic_fetch_add_explicit(&seg->users, LFL__FAAQ_RETIRED, memory_order_acq_rel) +
+                                          LFL__FAAQ_RETIRED);
+}
+
+/**
+ * @brief set up an empty queue able to hold max_segments segments at once
+ *
+ * @param q            queue to initialize
+ * @param max_segments bound on live segments (LFL_FAAQ_SEG items each)
+ *
+ * @return 0 on success, -1 if the segment pool could not be reserved
+ */
+static inline int lfl_faaq_init(struct lfl_faaq *q, size_t max_segments)
+{
+        struct lfl__faaq_seg *seg;
+
+        if (lfl_arena_init(&q->pool, sizeof(struct lfl__faaq_seg), max_segments, 0) != 0)
+                return -1;
+        seg = lfl__faaq_seg_new(q, NULL);
+        if (!seg) {
+                lfl_arena_destroy(&q->pool);
+                return -1;
+        }
+        atomic_store(&q->head, seg);
+        atomic_store(&q->tail, seg);
+        return 0;
+}
+
+/* release every segment; items still queued are not touched */
+static inline void lfl_faaq_destroy(struct lfl_faaq *q)
+{
+        lfl_arena_destroy(&q->pool);
+        atomic_store(&q->head, NULL);
+        atomic_store(&q->tail, NULL);
+}
+
+/* append item; 0 on success, -1 when the segment pool is exhausted */
+static inline int lfl__faaq_enqueue(struct lfl_faaq *q, void *item)
+{
+        for (;;) {
+                struct lfl__faaq_seg *tail = lfl__faaq_acquire(&q->tail);
+                unsigned int idx = atomic_fetch_add_explicit(&tail->enqidx, 1, memory_order_acq_rel);
+
+                if (idx < LFL_FAAQ_SEG) {
+                        void *expected = NULL;
+                        int ok = atomic_compare_exchange_strong_explicit(&tail->items[idx], &expected, item,
+                                                                         memory_order_release, memory_order_relaxed);
+                        lfl__faaq_release(q, tail);
+                        if (ok)
+                                return 0;
+                        continue;
+                }
+
+                /* segment full: link a new one holding the item, or help a lagging tail */
+                struct lfl__faaq_seg *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+                if (!next) {
+                        struct lfl__faaq_seg *seg = lfl__faaq_seg_new(q, item);
+                        if (!seg) {
+                                lfl__faaq_release(q, tail);
+                                return -1;
+                        }
+                        if (atomic_compare_exchange_strong_explicit(&tail->next, &next, seg,
+                                                                    memory_order_release, memory_order_acquire)) {
+                                struct lfl__faaq_seg *expected = tail;
+                                atomic_compare_exchange_strong_explicit(&q->tail, &expected, seg,
+                                                                        memory_order_release, memory_order_relaxed);
+                                lfl__faaq_release(q, tail);
+                                return 0;
+                        }
+                        lfl_arena_free(&q->pool, seg);
+                }
+                struct lfl__faaq_seg *expected = tail;
+                atomic_compare_exchange_strong_explicit(&q->tail, &expected, next,
+                                                        memory_order_release, memory_order_relaxed);
+                lfl__faaq_release(q, tail);
+        }
+}
+
+/* remove the oldest item, or NULL when the queue is empty */
+static inline void *lfl__faaq_dequeue(struct lfl_faaq *q)
+{
+        for (;;) {
+                struct lfl__faaq_seg *head = lfl__faaq_acquire(&q->head);
+
+                if (atomic_load_explicit(&head->deqidx, memory_order_acquire) >=
+                            atomic_load_explicit(&head->enqidx, memory_order_acquire) &&
+                    !atomic_load_explicit(&head->next, memory_order_acquire)) {
+                        lfl__faaq_release(q, head);
+                        return NULL;
+                }
+                unsigned int idx = atomic_fetch_add_explicit(&head->deqidx, 1, memory_order_acq_rel);
+                if (idx < LFL_FAAQ_SEG) {
+                        void *item = atomic_exchange_explicit(&head->items[idx], LFL__FAAQ_TAKEN, memory_order_acq_rel);
+                        lfl__faaq_release(q, head);
+                        if (item)
+                                return item;
+                        continue;
+                }
+
+                /* segment drained: move head on, first making sure tail is not left behind */
+                struct lfl__faaq_seg *next = atomic_load_explicit(&head->next, memory_order_acquire);
+                if (!next) {
+                        lfl__faaq_release(q, head);
+                        return NULL;
+                }
+                struct lfl__faaq_seg *expected = head;
+                atomic_compare_exchange_strong_explicit(&q->tail, &expected, next,
+                                                        memory_order_release, memory_order_relaxed);
+                expected = head;
+                if (atomic_compare_exchange_strong_explicit(&q->head, &expected, next,
+                                                            memory_order_acq_rel, memory_order_relaxed))
+                        lfl__faaq_retire(q, head);
+                lfl__faaq_release(q, head);
+        }
+}
+
+/**
+ * @brief append a node to a fetch-and-add queue
+ *
+ * @param name list type name
+ * @param q    struct lfl_faaq
+ * @param ptr  non-NULL node pointer
+ *
+ * @return 0 on success, -1 when the segment pool is exhausted
+ */
+#define lfl_faaq_add_tail(name, q, ptr) \
+        lfl__faaq_enqueue(&(q), (struct name##_linked_list *)(ptr))
+
+/**
+ * @brief remove the oldest node from a fetch-and-add queue
+ *
+ * @param name list type name
+ * @param q    struct lfl_faaq
+ * @param item variable receiving the node, or NULL when empty
+ */
+#define lfl_faaq_pop_head(name, q, item) \
+        do { \
+                item = (struct name##_linked_list *)lfl__faaq_dequeue(&(q)); \
+        } while (0)
+
+#endif /* LOCK_FREE_LIST_H */